@@ -9,8 +9,28 @@
 #import <Foundation/Foundation.h>
 #import <MapKit/MapKit.h>
 
+#import "KPAnnotation.h"
+
 @interface TestAnnotation : NSObject <MKAnnotation>
 
 @property (nonatomic, assign) CLLocationCoordinate2D coordinate;
 
 @end
+
+@interface TestWeightedAnnotation : TestAnnotation <KPWeightedAnnotation>
+
+@property (nonatomic, assign) double weight;
+
+@end
+
+@interface TestCategorizedAnnotation : TestAnnotation <KPCategorizedAnnotation>
+
+@property (nonatomic, assign) NSUInteger clusteringCategory;
+
+@end
+
+@interface TestPrioritizedAnnotation : TestAnnotation <KPPrioritizedAnnotation>
+
+@property (nonatomic, assign) double clusteringPriority;
+
+@end
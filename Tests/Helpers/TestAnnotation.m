@@ -19,3 +19,12 @@
 }
 
 @end
+
+@implementation TestWeightedAnnotation
+@end
+
+@implementation TestCategorizedAnnotation
+@end
+
+@implementation TestPrioritizedAnnotation
+@end
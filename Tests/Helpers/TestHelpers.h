@@ -2,6 +2,10 @@
 #import <XCTest/XCTest.h>
 #import <MapKit/MapKit.h>
 
+#import "KPAnnotation.h"
+#import "KPAnnotationTree.h"
+#import "TestAnnotation.h"
+
 // https://github.com/EvgenyKarkan/EKAlgorithms/blob/master/EKAlgorithms/NSArray%2BEKStuff.m
 static inline NSArray *arrayShuffle(NSArray *array) {
     NSUInteger i = array.count;
@@ -59,6 +63,21 @@ static inline MKMapPoint MKMapRectWorldPointRandom() {
     return MKMapPointMake(randomWithinRange(0, MKMapSizeWorld.width), randomWithinRange(0, MKMapSizeWorld.height));
 }
 
+// Bounding map rect of annotations, padded so that it is never empty (e.g. for dataset of equal annotations)
+static inline MKMapRect MKMapRectBoundingAnnotations(NSArray *annotations) {
+    MKMapRect boundingRect = MKMapRectNull;
+
+    for (id <MKAnnotation> annotation in annotations) {
+        MKMapPoint mapPoint = MKMapPointForCoordinate(annotation.coordinate);
+
+        boundingRect = MKMapRectUnion(boundingRect, MKMapRectMake(mapPoint.x, mapPoint.y, 0, 0));
+    }
+
+    double padding = MAX(MAX(boundingRect.size.width, boundingRect.size.height) / 10, 1000);
+
+    return MKMapRectInset(boundingRect, -padding, -padding);
+}
+
 static inline BOOL CLLocationCoordinates2DEqual(CLLocationCoordinate2D coordinate, CLLocationCoordinate2D otherCoordinate) {
     static const double precision = 0.00000000001;
 
@@ -67,6 +86,50 @@ static inline BOOL CLLocationCoordinates2DEqual(CLLocationCoordinate2D coordinat
     fabs(coordinate.longitude - otherCoordinate.longitude) < precision;
 }
 
+static inline NSArray *NSArrayOfAnnotationsOfClusters(NSArray *clusters) {
+    NSMutableArray *annotations = [NSMutableArray array];
+
+    for (KPAnnotation *cluster in clusters) {
+        [annotations addObjectsFromArray:cluster.annotations.allObjects];
+    }
+
+    return annotations;
+}
+
+// Every annotation of the tree inside mapRect belongs to exactly one of the clusters, and the clusters have no other annotations
+#define AssertClustersPartitionAnnotationsInMapRect(clusters, annotationTree, mapRect) \
+    do { \
+        NSArray *annotationsOfClusters = NSArrayOfAnnotationsOfClusters(clusters); \
+        NSArray *annotationsBySearch = [(annotationTree) annotationsInMapRect:(mapRect)]; \
+        XCTAssertFalse(NSArrayHasDuplicates(annotationsOfClusters)); \
+        XCTAssertEqual(annotationsOfClusters.count, annotationsBySearch.count); \
+        XCTAssertEqualObjects([NSSet setWithArray:annotationsOfClusters], [NSSet setWithArray:annotationsBySearch]); \
+    } while (0)
+
+// Random TestWeightedAnnotations of weights from 1 to 100
+NSArray *TestWeightedAnnotationsDataset(NSUInteger numberOfAnnotations);
+
+// Reducers of the weights and latitudes of TestWeightedAnnotations checked by AssertReducedValuesOfClustersMatchTheirAnnotations()
+NSArray *TestAttributeReducers(void);
+
+#define AssertReducedValuesOfClustersMatchTheirAnnotations(clusters) \
+    do { \
+        for (KPAnnotation *cluster in (clusters)) { \
+            double units = 0, severity = -DBL_MAX, southernmost = DBL_MAX, heavy = 0; \
+            for (TestWeightedAnnotation *annotation in cluster.annotations) { \
+                units += annotation.weight; \
+                severity = MAX(severity, annotation.weight); \
+                southernmost = MIN(southernmost, annotation.coordinate.latitude); \
+                heavy += annotation.weight > 50 ? 1 : 0; \
+            } \
+            XCTAssertEqual([cluster reducedValueForAttributeNamed:@"units"].doubleValue, units); \
+            XCTAssertEqual([cluster reducedValueForAttributeNamed:@"severity"].doubleValue, severity); \
+            XCTAssertEqual([cluster reducedValueForAttributeNamed:@"southernmost"].doubleValue, southernmost); \
+            XCTAssertEqual([cluster reducedValueForAttributeNamed:@"heavy"].doubleValue, heavy); \
+            XCTAssertNil([cluster reducedValueForAttributeNamed:@"unknown"]); \
+        } \
+    } while (0)
+
 
 #import <dispatch/dispatch.h>
 
@@ -82,3 +145,7 @@ FOUNDATION_EXPORT uint64_t dispatch_benchmark(size_t count, void (^block)(void))
 void BenchmarkReentrant(NSUInteger benchmarkNumber, void (^block)(void));
 void BenchmarkReentrantPrintResults(void);
 void BenchmarkReentrantResetResults(void);
+
+// Benchmarks every algorithm on every dataset of KPTestDatasets, clustering the bounding rect of the dataset with the margin
+// of a screen on every side as KPClusteringController does. Returns the average time of every algorithm in nanoseconds, summed over the datasets.
+NSArray *BenchmarkClusteringAlgorithms(NSArray *algorithmNames, NSArray *algorithms);
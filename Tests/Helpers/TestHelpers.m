@@ -1,6 +1,11 @@
 
 #import "TestHelpers.h"
 
+#import "KPClusteringAlgorithm.h"
+#import "KPAttributeReducer.h"
+#import "MockMapView.h"
+#import "Datasets.h"
+
 static uint64_t Benchmarks[10] = {0};
 
 
@@ -23,3 +28,76 @@ void BenchmarkReentrantPrintResults(void) {
 void BenchmarkReentrantResetResults(void) {
     memset(&Benchmarks, 0, sizeof(uint64_t) * sizeof(10));
 }
+
+
+NSArray *BenchmarkClusteringAlgorithms(NSArray *algorithmNames, NSArray *algorithms) {
+    uint64_t *times = calloc(algorithms.count, sizeof(uint64_t));
+
+    for (NSArray *annotations in [KPTestDatasets datasets]) {
+        KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+        MockMapView *mockMapView = [MockMapView new];
+        mockMapView.mockVisibleMapRect = MKMapRectBoundingAnnotations(annotations);
+
+        MKMapRect clusteringRect = MKMapRectInset(mockMapView.mockVisibleMapRect,
+                                                  -mockMapView.mockVisibleMapRect.size.width,
+                                                  -mockMapView.mockVisibleMapRect.size.height);
+
+        printf("Dataset of %lu annotations\n", (unsigned long)annotations.count);
+
+        for (NSUInteger algorithmIdx = 0; algorithmIdx < algorithms.count; algorithmIdx++) {
+            id <KPClusteringAlgorithm> algorithm = algorithms[algorithmIdx];
+
+            uint64_t time = dispatch_benchmark(10, ^{
+                [algorithm clusterAnnotationsInMapRect:clusteringRect parentMapView:mockMapView annotationTree:annotationTree];
+            });
+
+            printf("%s: average time is %f milliseconds\n", [algorithmNames[algorithmIdx] UTF8String], (float)time / 1000000);
+
+            times[algorithmIdx] += time;
+        }
+    }
+
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:algorithms.count];
+
+    for (NSUInteger algorithmIdx = 0; algorithmIdx < algorithms.count; algorithmIdx++) {
+        [result addObject:@(times[algorithmIdx])];
+    }
+
+    free(times);
+
+    return result;
+}
+
+
+NSArray *TestWeightedAnnotationsDataset(NSUInteger numberOfAnnotations) {
+    NSMutableArray *annotations = [NSMutableArray array];
+
+    for (TestAnnotation *testAnnotation in [KPTestDatasets datasetRandomWithNumberOfAnnotations:numberOfAnnotations]) {
+        TestWeightedAnnotation *annotation = [TestWeightedAnnotation new];
+        annotation.coordinate = testAnnotation.coordinate;
+        annotation.weight = 1 + arc4random_uniform(100);
+
+        [annotations addObject:annotation];
+    }
+
+    return annotations;
+}
+
+
+NSArray *TestAttributeReducers(void) {
+    return @[
+        [[KPAttributeReducer alloc] initWithName:@"units" operation:KPAttributeReducerOperationSum valueBlock:^double(id <MKAnnotation> annotation) {
+            return [(TestWeightedAnnotation *)annotation weight];
+        }],
+        [[KPAttributeReducer alloc] initWithName:@"severity" operation:KPAttributeReducerOperationMaximum valueBlock:^double(id <MKAnnotation> annotation) {
+            return [(TestWeightedAnnotation *)annotation weight];
+        }],
+        [[KPAttributeReducer alloc] initWithName:@"southernmost" operation:KPAttributeReducerOperationMinimum valueBlock:^double(id <MKAnnotation> annotation) {
+            return annotation.coordinate.latitude;
+        }],
+        [[KPAttributeReducer alloc] initWithName:@"heavy" operation:KPAttributeReducerOperationCountIf valueBlock:^double(id <MKAnnotation> annotation) {
+            return [(TestWeightedAnnotation *)annotation weight] > 50;
+        }],
+    ];
+}
@@ -9,6 +9,9 @@
 #import "TestHelpers.h"
 
 #import "KPAnnotation.h"
+#import "KPAnnotation_Private.h"
+#import "KPAnnotationTree.h"
+#import "KPAnnotationTree_Private.h"
 #import "TestAnnotation.h"
 
 #import <XCTest/XCTest.h>
@@ -71,4 +74,269 @@
     XCTAssertTrue(CLLocationCoordinates2DEqual(annotation.coordinate, annotationCentroidCoordinate));
 }
 
+- (void)testCalculateValuesForClusterAnnotationHavingWeightedAnnotations {
+    TestWeightedAnnotation *a1 = [[TestWeightedAnnotation alloc] init];
+    a1.coordinate = CLLocationCoordinate2DMake(10, 20);
+    a1.weight = 3;
+
+    TestWeightedAnnotation *a2 = [[TestWeightedAnnotation alloc] init];
+    a2.coordinate = CLLocationCoordinate2DMake(14, 24);
+    a2.weight = 1;
+
+    TestAnnotation *a3 = [[TestAnnotation alloc] init];
+    a3.coordinate = CLLocationCoordinate2DMake(10, 20);
+
+    KPAnnotation *annotation = [[KPAnnotation alloc] initWithAnnotations:@[ a1, a2, a3 ]];
+
+    XCTAssertEqual(annotation.weight, 5);
+    XCTAssertTrue(CLLocationCoordinates2DEqual(annotation.coordinate, CLLocationCoordinate2DMake((10 * 3 + 14 + 10) / 5., (20 * 3 + 24 + 20) / 5.)));
+}
+
+- (void)testClusterIdentifierDependsOnlyOnAnnotations {
+    NSMutableArray *annotations = [NSMutableArray array];
+
+    for (NSUInteger idx = 0; idx < 10; idx++) {
+        TestAnnotation *annotation = [[TestAnnotation alloc] init];
+        annotation.coordinate = CLLocationCoordinate2DMake(randomWithinRange(-90, 90), randomWithinRange(-180, 180));
+
+        [annotations addObject:annotation];
+    }
+
+    KPAnnotation *cluster = [[KPAnnotation alloc] initWithAnnotations:annotations];
+    KPAnnotation *sameCluster = [[KPAnnotation alloc] initWithAnnotations:annotations.reverseObjectEnumerator.allObjects];
+
+    XCTAssertEqual(cluster.clusterIdentifier, sameCluster.clusterIdentifier);
+
+    KPAnnotation *smallerCluster = [[KPAnnotation alloc] initWithAnnotations:[annotations subarrayWithRange:NSMakeRange(1, 9)]];
+
+    XCTAssertNotEqual(cluster.clusterIdentifier, smallerCluster.clusterIdentifier);
+}
+
+- (void)testClusterOfNodeIndexesIsSameAsClusterOfAnnotationSet {
+    NSMutableArray *annotations = [NSMutableArray array];
+
+    for (NSUInteger idx = 0; idx < 100; idx++) {
+        TestAnnotation *annotation = [[TestAnnotation alloc] init];
+        annotation.coordinate = CLLocationCoordinate2DMake(randomWithinRange(-80, 80), randomWithinRange(-170, 170));
+
+        [annotations addObject:annotation];
+    }
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+    kp_2dtree_t tree = annotationTree.tree;
+
+    NSUInteger count = 1 + arc4random_uniform((uint32_t)tree.size);
+
+    NSUInteger *nodeIndexes = malloc(count * sizeof(NSUInteger));
+    NSUInteger *reversedNodeIndexes = malloc(count * sizeof(NSUInteger));
+    NSMutableSet *members = [NSMutableSet set];
+
+    kp_annotation_statistics_t statistics = KPAnnotationStatisticsMake();
+
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        nodeIndexes[idx] = idx;
+        reversedNodeIndexes[count - 1 - idx] = idx;
+
+        KPAnnotationStatisticsAddCoordinate(&statistics, tree.coordinates[idx], tree.weights[idx]);
+
+        [members addObject:tree.root[idx].annotation];
+    }
+
+    KPAnnotation *cluster = [[KPAnnotation alloc] initWithAnnotationTree:annotationTree nodeIndexes:nodeIndexes statistics:statistics];
+    KPAnnotation *reversedCluster = [[KPAnnotation alloc] initWithAnnotationTree:annotationTree nodeIndexes:reversedNodeIndexes statistics:statistics];
+    KPAnnotation *setCluster = [[KPAnnotation alloc] initWithAnnotationSet:members];
+
+    free(nodeIndexes);
+    free(reversedNodeIndexes);
+
+    XCTAssertEqual(cluster.clusterIdentifier, setCluster.clusterIdentifier);
+    XCTAssertTrue([cluster hasSameAnnotationsAsAnnotation:reversedCluster]);
+    XCTAssertTrue([members containsObject:cluster.anyAnnotation]);
+
+    XCTAssertTrue([cluster.annotations isEqualToSet:members]);
+    XCTAssertTrue([cluster hasSameAnnotationsAsAnnotation:setCluster]);
+    XCTAssertEqual(cluster.isCluster, setCluster.isCluster);
+    XCTAssertEqualWithAccuracy(cluster.coordinate.latitude, setCluster.coordinate.latitude, 1e-9);
+    XCTAssertEqualWithAccuracy(cluster.coordinate.longitude, setCluster.coordinate.longitude, 1e-9);
+    XCTAssertEqualWithAccuracy(cluster.radius, setCluster.radius, 1e-6);
+}
+
+- (void)testStatisticsKernelKeepsCentroidOfLargeClusterPrecise {
+    NSUInteger count = 1000001;
+
+    CLLocationCoordinate2D *coordinates = malloc(count * sizeof(CLLocationCoordinate2D));
+    double *weights = malloc(count * sizeof(double));
+    NSUInteger *indexes = malloc(count * sizeof(NSUInteger));
+
+    // 0.1 is not representable exactly: a plain sum of a million of them drifts away from 100000 by ~1e-6
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        coordinates[idx] = CLLocationCoordinate2DMake(0.1, -0.1);
+        weights[idx] = 1;
+        indexes[idx] = count - 1 - idx;
+    }
+
+    kp_annotation_statistics_t statistics = KPAnnotationStatisticsMake();
+
+    KPAnnotationStatisticsAddCoordinatesAtIndexes(&statistics, coordinates, weights, indexes, count);
+
+    CLLocationCoordinate2D centroid = KPAnnotationStatisticsGetCentroid(&statistics);
+
+    XCTAssertEqual(statistics.count, count);
+    XCTAssertEqual(statistics.weight, count);
+    XCTAssertEqualWithAccuracy(centroid.latitude, 0.1, 1e-15);
+    XCTAssertEqualWithAccuracy(centroid.longitude, -0.1, 1e-15);
+
+    // Same statistics as accumulating one by one, and merging two halves
+    kp_annotation_statistics_t firstHalf = KPAnnotationStatisticsMake();
+    kp_annotation_statistics_t secondHalf = KPAnnotationStatisticsMake();
+
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        KPAnnotationStatisticsAddCoordinate(idx < count / 2 ? &firstHalf : &secondHalf, coordinates[idx], weights[idx]);
+    }
+
+    kp_annotation_statistics_t unionStatistics = KPAnnotationStatisticsUnion(&firstHalf, &secondHalf);
+    CLLocationCoordinate2D unionCentroid = KPAnnotationStatisticsGetCentroid(&unionStatistics);
+
+    XCTAssertEqual(unionStatistics.count, count);
+    XCTAssertEqualWithAccuracy(unionCentroid.latitude, 0.1, 1e-15);
+    XCTAssertEqualWithAccuracy(unionCentroid.longitude, -0.1, 1e-15);
+    XCTAssertTrue(CLLocationCoordinates2DEqual(KPAnnotationStatisticsGetMinCoordinate(&unionStatistics), KPAnnotationStatisticsGetMinCoordinate(&statistics)));
+    XCTAssertTrue(CLLocationCoordinates2DEqual(KPAnnotationStatisticsGetMaxCoordinate(&unionStatistics), KPAnnotationStatisticsGetMaxCoordinate(&statistics)));
+
+    free(coordinates);
+    free(weights);
+    free(indexes);
+}
+
+- (void)testPagesOfAnnotationsCoverAllAnnotationsInGivenOrder {
+    NSMutableArray *annotations = [NSMutableArray array];
+
+    for (NSUInteger idx = 0; idx < 1000; idx++) {
+        TestWeightedAnnotation *annotation = [[TestWeightedAnnotation alloc] init];
+        annotation.coordinate = CLLocationCoordinate2DMake(randomWithinRange(-10, 10), randomWithinRange(-10, 10));
+        annotation.weight = 1 + arc4random_uniform(100);
+
+        [annotations addObject:annotation];
+    }
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+    kp_2dtree_t tree = annotationTree.tree;
+
+    NSUInteger *nodeIndexes = malloc(tree.size * sizeof(NSUInteger));
+    kp_annotation_statistics_t statistics = KPAnnotationStatisticsMake();
+
+    for (NSUInteger idx = 0; idx < tree.size; idx++) {
+        nodeIndexes[idx] = idx;
+    }
+
+    KPAnnotationStatisticsAddCoordinatesAtIndexes(&statistics, tree.coordinates, tree.weights, nodeIndexes, tree.size);
+
+    KPAnnotation *treeCluster = [[KPAnnotation alloc] initWithAnnotationTree:annotationTree nodeIndexes:nodeIndexes statistics:statistics];
+    KPAnnotation *setCluster = [[KPAnnotation alloc] initWithAnnotations:annotations];
+
+    free(nodeIndexes);
+
+    for (KPAnnotation *cluster in @[ treeCluster, setCluster ]) {
+        XCTAssertEqual(cluster.annotationsCount, annotations.count);
+
+        MKMapPoint center = MKMapPointForCoordinate(cluster.coordinate);
+
+        for (NSNumber *order in @[ @(KPAnnotationOrderUnspecified), @(KPAnnotationOrderNearestFirst), @(KPAnnotationOrderHeaviestFirst) ]) {
+            NSMutableArray *pagedAnnotations = [NSMutableArray array];
+
+            for (NSUInteger location = 0; location < annotations.count + 100; location += 77) {
+                [pagedAnnotations addObjectsFromArray:[cluster annotationsInRange:NSMakeRange(location, 77) order:order.integerValue]];
+            }
+
+            XCTAssertEqual(pagedAnnotations.count, annotations.count);
+            XCTAssertTrue([[NSSet setWithArray:pagedAnnotations] isEqualToSet:[NSSet setWithArray:annotations]]);
+
+            for (NSUInteger idx = 1; idx < pagedAnnotations.count; idx++) {
+                TestWeightedAnnotation *previous = pagedAnnotations[idx - 1];
+                TestWeightedAnnotation *current = pagedAnnotations[idx];
+
+                if (order.integerValue == KPAnnotationOrderNearestFirst) {
+                    XCTAssertTrue(MKMapPointGetDistanceSquaredToMapPoint(MKMapPointForCoordinate(previous.coordinate), center) <=
+                                  MKMapPointGetDistanceSquaredToMapPoint(MKMapPointForCoordinate(current.coordinate), center));
+                } else if (order.integerValue == KPAnnotationOrderHeaviestFirst) {
+                    XCTAssertTrue(previous.weight >= current.weight);
+                }
+            }
+
+            __block NSUInteger enumeratedCount = 0;
+
+            [cluster enumerateAnnotationsWithOrder:order.integerValue usingBlock:^(id<MKAnnotation> annotation, NSUInteger idx, BOOL *stop) {
+                XCTAssertEqual(annotation, pagedAnnotations[idx]);
+
+                enumeratedCount++;
+            }];
+
+            XCTAssertEqual(enumeratedCount, annotations.count);
+        }
+    }
+}
+
+- (void)testRepresentativeAnnotationIsSameForTreeAndSetClusters {
+    for (NSNumber *prioritized in @[ @NO, @YES ]) {
+        NSMutableArray *annotations = [NSMutableArray array];
+
+        for (NSUInteger idx = 0; idx < 500; idx++) {
+            TestAnnotation *annotation = prioritized.boolValue ? [TestPrioritizedAnnotation new] : [TestAnnotation new];
+            annotation.coordinate = CLLocationCoordinate2DMake(randomWithinRange(-10, 10), randomWithinRange(-10, 10));
+
+            if (prioritized.boolValue) {
+                [(TestPrioritizedAnnotation *)annotation setClusteringPriority:idx];
+            }
+
+            [annotations addObject:annotation];
+        }
+
+        KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+        kp_2dtree_t tree = annotationTree.tree;
+
+        // Every other node, in reverse order
+        NSUInteger count = tree.size / 2;
+        NSUInteger *nodeIndexes = malloc(count * sizeof(NSUInteger));
+        NSMutableSet *members = [NSMutableSet set];
+
+        kp_annotation_statistics_t statistics = KPAnnotationStatisticsMake();
+
+        for (NSUInteger member = 0; member < count; member++) {
+            nodeIndexes[member] = tree.size - 1 - 2 * member;
+
+            [members addObject:tree.root[nodeIndexes[member]].annotation];
+        }
+
+        KPAnnotationStatisticsAddCoordinatesAtIndexes(&statistics, tree.coordinates, tree.weights, nodeIndexes, count);
+
+        KPAnnotation *treeCluster = [[KPAnnotation alloc] initWithAnnotationTree:annotationTree nodeIndexes:nodeIndexes statistics:statistics];
+        KPAnnotation *setCluster = [[KPAnnotation alloc] initWithAnnotationSet:members];
+
+        free(nodeIndexes);
+
+        id <MKAnnotation> expectedRepresentative = nil;
+
+        if (prioritized.boolValue) {
+            for (TestPrioritizedAnnotation *annotation in members) {
+                if (expectedRepresentative == nil || annotation.clusteringPriority > [(TestPrioritizedAnnotation *)expectedRepresentative clusteringPriority]) {
+                    expectedRepresentative = annotation;
+                }
+            }
+        } else {
+            MKMapPoint centroid = MKMapPointForCoordinate(treeCluster.coordinate);
+
+            for (id <MKAnnotation> annotation in members) {
+                if (expectedRepresentative == nil ||
+                    MKMapPointGetDistanceSquaredToMapPoint(MKMapPointForCoordinate(annotation.coordinate), centroid) <
+                    MKMapPointGetDistanceSquaredToMapPoint(MKMapPointForCoordinate(expectedRepresentative.coordinate), centroid)) {
+                    expectedRepresentative = annotation;
+                }
+            }
+        }
+
+        XCTAssertEqual(treeCluster.representativeAnnotation, expectedRepresentative);
+        XCTAssertEqual(setCluster.representativeAnnotation, expectedRepresentative);
+    }
+}
+
 @end
@@ -319,5 +319,36 @@ typedef struct {
     }
 }
 
-@end
+- (void)testConcurrentSearchesGiveSameResultsAsSerialSearches {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:10000];
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    NSUInteger rectsCount = 64;
+
+    MKMapRect *rects = malloc(rectsCount * sizeof(MKMapRect));
+    NSMutableArray *serialResults = [NSMutableArray array];
+
+    for (NSUInteger idx = 0; idx < rectsCount; idx++) {
+        rects[idx] = MKMapRectRandom();
+
+        [serialResults addObject:[NSSet setWithArray:[annotationTree annotationsInMapRect:rects[idx]]]];
+    }
+
+    NSMutableArray *concurrentResults = [serialResults mutableCopy];
 
+    // Searches without a scratch of their own, as the ones of background clustering and of the main thread
+    dispatch_apply(rectsCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t idx) {
+        NSSet *result = [NSSet setWithArray:[annotationTree annotationsInMapRect:rects[idx]]];
+
+        @synchronized(concurrentResults) {
+            concurrentResults[idx] = result;
+        }
+    });
+
+    XCTAssertEqualObjects(concurrentResults, serialResults);
+
+    free(rects);
+}
+
+@end
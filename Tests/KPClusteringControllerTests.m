@@ -10,6 +10,11 @@
 
 #import "KPClusteringController.h"
 #import "KPGridClusteringAlgorithm.h"
+#import "KPAnnotationTree.h"
+#import "KPClusterCache.h"
+#import "KPAnnotation_Private.h"
+#import "MockMapView.h"
+#import "Datasets.h"
 
 @interface FakeDelegate : NSObject <KPClusteringControllerDelegate>
 @property (readonly, nonatomic) BOOL callReceived;
@@ -23,6 +28,76 @@
 
 @end
 
+// Counts the calls adding and removing annotations
+@interface CountingMapView : MockMapView
+@property (assign, nonatomic) NSUInteger addCallsCount;
+@property (assign, nonatomic) NSUInteger removeCallsCount;
+@property (strong, nonatomic) NSArray *firstAddedAnnotations;
+@end
+
+@implementation CountingMapView
+
+- (void)addAnnotations:(NSArray *)annotations {
+    self.addCallsCount++;
+
+    if (self.firstAddedAnnotations == nil) {
+        self.firstAddedAnnotations = annotations;
+    }
+
+    [super addAnnotations:annotations];
+}
+
+- (void)removeAnnotations:(NSArray *)annotations {
+    self.removeCallsCount++;
+
+    [super removeAnnotations:annotations];
+}
+
+@end
+
+// Counts the delegate calls announcing the updates of visible annotations
+@interface CountingDelegate : NSObject <KPClusteringControllerDelegate>
+@property (assign, atomic) NSUInteger willUpdateCallsCount;
+@property (assign, atomic) NSUInteger didUpdateCallsCount;
+@end
+
+@implementation CountingDelegate
+
+- (void)clusteringControllerWillUpdateVisibleAnnotations:(KPClusteringController *)clusteringController {
+    self.willUpdateCallsCount++;
+}
+
+- (void)clusteringControllerDidUpdateVisibleMapAnnotations:(KPClusteringController *)clusteringController {
+    self.didUpdateCallsCount++;
+}
+
+@end
+
+// Grid clustering which takes a while to finish when it runs in the background
+@interface SlowGridClusteringAlgorithm : KPGridClusteringAlgorithm
+@property (assign, atomic) NSUInteger backgroundClusteringCallsCount;
+@end
+
+@implementation SlowGridClusteringAlgorithm
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect visibleMapRect:(MKMapRect)visibleMapRect mapViewSize:(CGSize)mapViewSize annotationTree:(KPAnnotationTree *)annotationTree {
+    self.backgroundClusteringCallsCount++;
+
+    [NSThread sleepForTimeInterval:0.2];
+
+    return [super clusterAnnotationsInMapRect:mapRect visibleMapRect:visibleMapRect mapViewSize:mapViewSize annotationTree:annotationTree];
+}
+
+@end
+
+@interface KPClusteringController (Testing)
+- (void)matchClusters:(NSArray *)newClusters
+         withClusters:(NSArray *)oldClusters
+         splitSources:(NSUInteger *)splitSources
+   firstMergedSources:(NSUInteger *)firstMergedSources
+    nextMergedSources:(NSUInteger *)nextMergedSources;
+@end
+
 @interface KPClusteringControllerTests : XCTestCase
 @end
 
@@ -62,4 +137,480 @@
     XCTAssertFalse(fakeDelegate.callReceived, @"");
 }
 
+- (void)test_refreshWhichDoesNotChangeClustersDoesNotAddOrRemoveAnnotations {
+    NSArray *annotations = [KPTestDatasets dataset1];
+
+    CountingMapView *mapView = [CountingMapView new];
+    mapView.mockVisibleMapRect = MKMapRectMake(MKMapRectWorld.size.width / 4, MKMapRectWorld.size.height / 4, MKMapRectWorld.size.width / 2, MKMapRectWorld.size.height / 2);
+
+    KPClusteringController *clusteringController = [[KPClusteringController alloc] initWithMapView:mapView clusteringAlgorithm:[KPGridClusteringAlgorithm new]];
+
+    [clusteringController setAnnotations:annotations];
+
+    NSSet *displayedClusters = [NSSet setWithArray:mapView.annotations];
+
+    XCTAssertTrue(displayedClusters.count > 0);
+
+    mapView.addCallsCount = 0;
+    mapView.removeCallsCount = 0;
+
+    [clusteringController refresh:NO force:YES];
+
+    XCTAssertEqual(mapView.addCallsCount, 0);
+    XCTAssertEqual(mapView.removeCallsCount, 0);
+
+    // The same cluster objects stay on the map
+    XCTAssertEqualObjects([NSSet setWithArray:mapView.annotations], displayedClusters);
+}
+
+- (void)test_controllerAddsAndRemovesOnlyItsOwnClusters {
+    NSArray *annotations = [KPTestDatasets dataset1];
+
+    CountingMapView *mapView = [CountingMapView new];
+    mapView.mockVisibleMapRect = MKMapRectMake(MKMapRectWorld.size.width / 4, MKMapRectWorld.size.height / 4, MKMapRectWorld.size.width / 2, MKMapRectWorld.size.height / 2);
+
+    // A cluster put on the map by someone else
+    KPAnnotation *foreignCluster = [[KPAnnotation alloc] initWithAnnotations:@[ annotations.firstObject ]];
+    [mapView addAnnotation:foreignCluster];
+
+    KPClusteringController *clusteringController = [[KPClusteringController alloc] initWithMapView:mapView clusteringAlgorithm:[KPGridClusteringAlgorithm new]];
+
+    [clusteringController setAnnotations:annotations];
+
+    mapView.mockVisibleMapRect = MKMapRectMake(MKMapRectWorld.size.width / 8, MKMapRectWorld.size.height / 8, MKMapRectWorld.size.width / 4, MKMapRectWorld.size.height / 4);
+    [clusteringController refresh:NO force:YES];
+
+    XCTAssertTrue(mapView.annotations.count > 1);
+    XCTAssertTrue([mapView.annotations containsObject:foreignCluster]);
+
+    [clusteringController setAnnotations:@[]];
+
+    XCTAssertEqualObjects(mapView.annotations, @[ foreignCluster ]);
+}
+
+- (void)test_matchingClustersGivesSamePairsAsProbingEveryPairOfClusters {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:(1 + arc4random_uniform(5000))];
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    MockMapView *mapView = [MockMapView new];
+
+    KPGridClusteringAlgorithm *algorithm = [KPGridClusteringAlgorithm new];
+
+    KPClusteringController *clusteringController = [[KPClusteringController alloc] initWithMapView:mapView clusteringAlgorithm:algorithm];
+
+    // Zoom in: old clusters are split into new ones and the other way round
+    mapView.mockVisibleMapRect = MKMapRectWorld;
+    NSArray *oldClusters = [algorithm clusterAnnotationsInMapRect:MKMapRectWorld parentMapView:mapView annotationTree:annotationTree];
+
+    mapView.mockVisibleMapRect = MKMapRectMake(MKMapRectWorld.size.width / 4, MKMapRectWorld.size.height / 4, MKMapRectWorld.size.width / 4, MKMapRectWorld.size.height / 4);
+    NSArray *newClusters = [algorithm clusterAnnotationsInMapRect:MKMapRectWorld parentMapView:mapView annotationTree:annotationTree];
+
+    for (NSArray *pair in @[ @[ newClusters, oldClusters ], @[ oldClusters, newClusters ] ]) {
+        NSArray *toClusters = pair[0];
+        NSArray *fromClusters = pair[1];
+
+        NSUInteger *splitSources = malloc(MAX(toClusters.count, 1) * sizeof(NSUInteger));
+        NSUInteger *firstMergedSources = malloc(MAX(toClusters.count, 1) * sizeof(NSUInteger));
+        NSUInteger *nextMergedSources = malloc(MAX(fromClusters.count, 1) * sizeof(NSUInteger));
+
+        [clusteringController matchClusters:toClusters
+                               withClusters:fromClusters
+                               splitSources:splitSources
+                         firstMergedSources:firstMergedSources
+                          nextMergedSources:nextMergedSources];
+
+        for (NSUInteger toIndex = 0; toIndex < toClusters.count; toIndex++) {
+            KPAnnotation *toCluster = toClusters[toIndex];
+
+            NSUInteger expectedSplitSource = NSNotFound;
+            NSMutableArray *expectedMergedSources = [NSMutableArray array];
+
+            for (NSUInteger fromIndex = 0; fromIndex < fromClusters.count; fromIndex++) {
+                KPAnnotation *fromCluster = fromClusters[fromIndex];
+
+                if ([fromCluster.annotations member:[toCluster anyAnnotation]]) {
+                    expectedSplitSource = fromIndex;
+                } else if ([toCluster.annotations member:[fromCluster anyAnnotation]]) {
+                    [expectedMergedSources addObject:@(fromIndex)];
+                }
+            }
+
+            NSMutableArray *mergedSources = [NSMutableArray array];
+
+            for (NSUInteger fromIndex = firstMergedSources[toIndex]; fromIndex != NSNotFound; fromIndex = nextMergedSources[fromIndex]) {
+                [mergedSources addObject:@(fromIndex)];
+            }
+
+            XCTAssertEqual(splitSources[toIndex], expectedSplitSource);
+            XCTAssertEqualObjects(mergedSources, expectedMergedSources);
+        }
+
+        free(splitSources);
+        free(firstMergedSources);
+        free(nextMergedSources);
+    }
+}
+
+- (void)test_asynchronousClusteringAppliesOnlyLatestResult {
+    NSArray *annotations = [KPTestDatasets dataset1];
+
+    CountingMapView *mapView = [CountingMapView new];
+    mapView.mockVisibleMapRect = MKMapRectMake(MKMapRectWorld.size.width / 4, MKMapRectWorld.size.height / 4, MKMapRectWorld.size.width / 2, MKMapRectWorld.size.height / 2);
+
+    SlowGridClusteringAlgorithm *algorithm = [SlowGridClusteringAlgorithm new];
+
+    CountingDelegate *delegate = [CountingDelegate new];
+
+    KPClusteringController *clusteringController = [[KPClusteringController alloc] initWithMapView:mapView clusteringAlgorithm:algorithm];
+    clusteringController.delegate = delegate;
+    clusteringController.asynchronousClustering = YES;
+
+    [clusteringController setAnnotations:annotations];
+
+    // Nothing is applied until the clustering in the background is done
+    XCTAssertEqual(mapView.annotations.count, 0);
+
+    // The viewport changes twice while the first job is clustering
+    mapView.mockVisibleMapRect = MKMapRectMake(MKMapRectWorld.size.width / 8, MKMapRectWorld.size.height / 8, MKMapRectWorld.size.width / 4, MKMapRectWorld.size.height / 4);
+    [clusteringController refresh:NO force:YES];
+
+    mapView.mockVisibleMapRect = MKMapRectMake(MKMapRectWorld.size.width / 3, MKMapRectWorld.size.height / 3, MKMapRectWorld.size.width / 3, MKMapRectWorld.size.height / 3);
+    [clusteringController refresh:NO force:YES];
+
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"willUpdateCallsCount > 0"] evaluatedWithObject:delegate handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    // Let the jobs which were overtaken finish as well
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+
+    // The first job may have started before it was overtaken, the second one is skipped, only the last result is applied
+    XCTAssertTrue(algorithm.backgroundClusteringCallsCount <= 2);
+    XCTAssertEqual(delegate.willUpdateCallsCount, 1);
+    XCTAssertEqual(mapView.addCallsCount, 1);
+
+    NSArray *expectedClusters = [[KPGridClusteringAlgorithm new] clusterAnnotationsInMapRect:MKMapRectInset(mapView.mockVisibleMapRect, -mapView.mockVisibleMapRect.size.width, -mapView.mockVisibleMapRect.size.height)
+                                                                             parentMapView:mapView
+                                                                            annotationTree:[[KPAnnotationTree alloc] initWithAnnotations:annotations]];
+
+    XCTAssertEqual(mapView.annotations.count, expectedClusters.count);
+}
+
+- (void)test_incrementalUpdatesApplyVisibleClustersFirstAndCallDelegateWhenDone {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:10000];
+
+    CountingMapView *mapView = [CountingMapView new];
+    mapView.mockVisibleMapRect = MKMapRectMake(MKMapRectWorld.size.width / 4, MKMapRectWorld.size.height / 4, MKMapRectWorld.size.width / 2, MKMapRectWorld.size.height / 2);
+
+    CountingDelegate *delegate = [CountingDelegate new];
+
+    KPClusteringController *clusteringController = [[KPClusteringController alloc] initWithMapView:mapView clusteringAlgorithm:[KPGridClusteringAlgorithm new]];
+    clusteringController.delegate = delegate;
+    clusteringController.incrementalUpdates = YES;
+    clusteringController.incrementalUpdateFrameBudget = 0; // a single batch per run loop turn
+
+    [clusteringController setAnnotations:annotations];
+
+    // Only the first batch is applied right away: visible clusters closest to the center
+    XCTAssertEqual(mapView.addCallsCount, 1);
+    XCTAssertEqual(delegate.didUpdateCallsCount, 0);
+
+    MKMapPoint center = MKMapPointMake(MKMapRectGetMidX(mapView.mockVisibleMapRect), MKMapRectGetMidY(mapView.mockVisibleMapRect));
+    double previousDistance = 0;
+
+    for (KPAnnotation *cluster in mapView.firstAddedAnnotations) {
+        MKMapPoint mapPoint = MKMapPointForCoordinate(cluster.coordinate);
+        double distance = pow(mapPoint.x - center.x, 2) + pow(mapPoint.y - center.y, 2);
+
+        XCTAssertTrue(MKMapRectContainsPoint(mapView.mockVisibleMapRect, mapPoint));
+        XCTAssertTrue(distance >= previousDistance);
+
+        previousDistance = distance;
+    }
+
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"didUpdateCallsCount > 0"] evaluatedWithObject:delegate handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    NSArray *expectedClusters = [[KPGridClusteringAlgorithm new] clusterAnnotationsInMapRect:MKMapRectInset(mapView.mockVisibleMapRect, -mapView.mockVisibleMapRect.size.width, -mapView.mockVisibleMapRect.size.height)
+                                                                             parentMapView:mapView
+                                                                            annotationTree:[[KPAnnotationTree alloc] initWithAnnotations:annotations]];
+
+    XCTAssertTrue(mapView.addCallsCount > 1);
+    XCTAssertEqual(delegate.didUpdateCallsCount, 1);
+    XCTAssertEqual(mapView.annotations.count, expectedClusters.count);
+}
+
+- (void)test_refreshesArrivingBackToBackAreCoalesced {
+    NSArray *annotations = [KPTestDatasets dataset1];
+
+    CountingMapView *mapView = [CountingMapView new];
+    mapView.mockVisibleMapRect = MKMapRectMake(MKMapRectWorld.size.width / 4, MKMapRectWorld.size.height / 4, MKMapRectWorld.size.width / 2, MKMapRectWorld.size.height / 2);
+
+    CountingDelegate *delegate = [CountingDelegate new];
+
+    KPClusteringController *clusteringController = [[KPClusteringController alloc] initWithMapView:mapView clusteringAlgorithm:[KPGridClusteringAlgorithm new]];
+    clusteringController.delegate = delegate;
+    clusteringController.coalescesRefreshes = YES;
+
+    [clusteringController setAnnotations:annotations];
+
+    XCTAssertEqual(delegate.willUpdateCallsCount, 1);
+
+    for (NSUInteger i = 0; i < 5; i++) {
+        [clusteringController refresh:NO];
+        [clusteringController refresh:NO force:YES];
+    }
+
+    // Nothing happens until the coalesced refresh runs
+    XCTAssertEqual(delegate.willUpdateCallsCount, 1);
+
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"willUpdateCallsCount > 1"] evaluatedWithObject:delegate handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+
+    XCTAssertEqual(delegate.willUpdateCallsCount, 2);
+}
+
+- (void)test_zoomingToPrefetchedLevelUsesCachedClusters {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:5000];
+
+    double worldWidth = MKMapSizeWorld.width;
+
+    // Viewports of zoom levels 2 and 3 centered in the world: no quantization is needed for them (mock map view is 320 x 480)
+    CountingMapView *mapView = [CountingMapView new];
+    mapView.mockVisibleMapRect = MKMapRectMake(worldWidth / 2 - worldWidth / 8, worldWidth / 2 - 3 * worldWidth / 16, worldWidth / 4, 3 * worldWidth / 8);
+
+    KPGridClusteringAlgorithm *algorithm = [KPGridClusteringAlgorithm new];
+
+    KPClusteringController *clusteringController = [[KPClusteringController alloc] initWithMapView:mapView clusteringAlgorithm:algorithm];
+    clusteringController.prefetchesAdjacentZoomLevels = YES;
+
+    [clusteringController setAnnotations:annotations];
+
+    XCTAssertEqual(clusteringController.prefetchHitCount, 0);
+    XCTAssertEqual(clusteringController.prefetchMissCount, 1);
+
+    // Let the adjacent zoom levels be prefetched while the map is idle
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:1]];
+
+    mapView.mockVisibleMapRect = MKMapRectMake(worldWidth / 2 - worldWidth / 16, worldWidth / 2 - 3 * worldWidth / 32, worldWidth / 8, 3 * worldWidth / 16);
+
+    [clusteringController refresh:NO force:YES];
+
+    XCTAssertEqual(clusteringController.prefetchHitCount, 1);
+    XCTAssertEqual(clusteringController.prefetchMissCount, 1);
+    XCTAssertEqualWithAccuracy(clusteringController.prefetchHitRatio, 0.5, DBL_EPSILON);
+
+    NSArray *expectedClusters = [algorithm clusterAnnotationsInMapRect:MKMapRectInset(mapView.mockVisibleMapRect, -mapView.mockVisibleMapRect.size.width, -mapView.mockVisibleMapRect.size.height)
+                                                         parentMapView:mapView
+                                                        annotationTree:[[KPAnnotationTree alloc] initWithAnnotations:annotations]];
+
+    XCTAssertEqual(mapView.annotations.count, expectedClusters.count);
+}
+
+- (void)test_clustersTakenFromCacheAreNotMovedByEarlierUpdates {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:5000];
+
+    double worldWidth = MKMapSizeWorld.width;
+
+    MKMapRect visibleMapRect = MKMapRectMake(worldWidth / 2 - worldWidth / 8, worldWidth / 2 - 3 * worldWidth / 16, worldWidth / 4, 3 * worldWidth / 8);
+    MKMapRect zoomedVisibleMapRect = MKMapRectMake(worldWidth / 2 - worldWidth / 16, worldWidth / 2 - 3 * worldWidth / 32, worldWidth / 8, 3 * worldWidth / 16);
+
+    MockMapView *mapView = [MockMapView new];
+    mapView.mockVisibleMapRect = visibleMapRect;
+
+    KPClusteringController *clusteringController = [[KPClusteringController alloc] initWithMapView:mapView clusteringAlgorithm:[KPGridClusteringAlgorithm new]];
+    clusteringController.prefetchesAdjacentZoomLevels = YES;
+
+    [clusteringController setAnnotations:annotations];
+
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:1]];
+
+    // As if an animation or the delegate moved the clusters on the map
+    NSHashTable *movedClusters = [NSHashTable hashTableWithOptions:NSPointerFunctionsObjectPointerPersonality];
+
+    for (KPAnnotation *cluster in mapView.annotations) {
+        cluster.coordinate = CLLocationCoordinate2DMake(0, 0);
+
+        [movedClusters addObject:cluster];
+    }
+
+    mapView.mockVisibleMapRect = zoomedVisibleMapRect;
+    [clusteringController refresh:NO force:YES];
+
+    // Clusters of the same annotations at both zoom levels stay on the map
+    NSHashTable *keptClusters = [NSHashTable hashTableWithOptions:NSPointerFunctionsObjectPointerPersonality];
+
+    for (KPAnnotation *cluster in mapView.annotations) {
+        if ([movedClusters containsObject:cluster]) {
+            [keptClusters addObject:cluster];
+        }
+    }
+
+    XCTAssertTrue(keptClusters.count < movedClusters.count);
+
+    mapView.mockVisibleMapRect = visibleMapRect;
+    [clusteringController refresh:NO force:YES];
+
+    XCTAssertEqual(clusteringController.prefetchHitCount, 2);
+
+    for (KPAnnotation *cluster in mapView.annotations) {
+        if ([keptClusters containsObject:cluster]) {
+            continue;
+        }
+
+        kp_annotation_statistics_t statistics = cluster.statistics;
+
+        XCTAssertFalse([movedClusters containsObject:cluster]);
+        XCTAssertEqual(cluster.coordinate.latitude, KPAnnotationStatisticsGetCentroid(&statistics).latitude);
+        XCTAssertEqual(cluster.coordinate.longitude, KPAnnotationStatisticsGetCentroid(&statistics).longitude);
+    }
+}
+
+- (void)test_changingGridSizeDoesNotReuseClustersOfOldGridSize {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:5000];
+
+    double worldWidth = MKMapSizeWorld.width;
+
+    CountingMapView *mapView = [CountingMapView new];
+    mapView.mockVisibleMapRect = MKMapRectMake(worldWidth / 2 - worldWidth / 8, worldWidth / 2 - 3 * worldWidth / 16, worldWidth / 4, 3 * worldWidth / 8);
+
+    KPGridClusteringAlgorithm *algorithm = [KPGridClusteringAlgorithm new];
+
+    KPClusteringController *clusteringController = [[KPClusteringController alloc] initWithMapView:mapView clusteringAlgorithm:algorithm];
+    clusteringController.prefetchesAdjacentZoomLevels = YES;
+
+    [clusteringController setAnnotations:annotations];
+
+    [clusteringController refresh:NO force:YES];
+
+    XCTAssertEqual(clusteringController.prefetchHitCount, 1);
+    XCTAssertEqual(clusteringController.prefetchMissCount, 1);
+
+    algorithm.gridSize = CGSizeMake(120, 120);
+
+    [clusteringController refresh:NO force:YES];
+
+    XCTAssertEqual(clusteringController.prefetchHitCount, 1);
+    XCTAssertEqual(clusteringController.prefetchMissCount, 2);
+
+    NSArray *expectedClusters = [algorithm clusterAnnotationsInMapRect:MKMapRectInset(mapView.mockVisibleMapRect, -mapView.mockVisibleMapRect.size.width, -mapView.mockVisibleMapRect.size.height)
+                                                         parentMapView:mapView
+                                                        annotationTree:[[KPAnnotationTree alloc] initWithAnnotations:annotations]];
+
+    XCTAssertEqual(mapView.annotations.count, expectedClusters.count);
+}
+
+- (void)test_adaptiveClusteringMarginIsSmallWhenIdleAndGrowsInPanDirection {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:10000];
+
+    MKMapRect visibleMapRect = MKMapRectMake(MKMapRectWorld.size.width / 4, MKMapRectWorld.size.height / 4, MKMapRectWorld.size.width / 4, MKMapRectWorld.size.height / 4);
+
+    CountingMapView *mapView = [CountingMapView new];
+    mapView.mockVisibleMapRect = visibleMapRect;
+
+    KPClusteringController *clusteringController = [[KPClusteringController alloc] initWithMapView:mapView clusteringAlgorithm:[KPGridClusteringAlgorithm new]];
+    clusteringController.adaptiveClusteringMargin = YES;
+
+    [clusteringController setAnnotations:annotations];
+
+    MKMapRect idleClusteringRect = MKMapRectInset(visibleMapRect, -visibleMapRect.size.width / 4 - 1, -visibleMapRect.size.height / 4 - 1);
+
+    XCTAssertTrue(mapView.annotations.count > 0);
+
+    for (KPAnnotation *cluster in mapView.annotations) {
+        XCTAssertTrue(MKMapRectContainsPoint(idleClusteringRect, MKMapPointForCoordinate(cluster.coordinate)));
+    }
+
+    // A fast pan to the east by half of the visible width leaves the clustered area: the map is refreshed without forcing it
+    visibleMapRect.origin.x += visibleMapRect.size.width / 2;
+    mapView.mockVisibleMapRect = visibleMapRect;
+
+    mapView.addCallsCount = 0;
+
+    [clusteringController refresh:NO];
+
+    XCTAssertEqual(mapView.addCallsCount, 1);
+
+    // Margin is idle on the west, north and south sides and a full visible width on the east side
+    MKMapRect panClusteringRect = MKMapRectMake(visibleMapRect.origin.x - visibleMapRect.size.width / 4 - 1,
+                                                visibleMapRect.origin.y - visibleMapRect.size.height / 4 - 1,
+                                                visibleMapRect.size.width * 2.25 + 2,
+                                                visibleMapRect.size.height * 1.5 + 2);
+
+    BOOL hasClustersInLeadingMargin = NO;
+
+    for (KPAnnotation *cluster in mapView.annotations) {
+        MKMapPoint mapPoint = MKMapPointForCoordinate(cluster.coordinate);
+
+        XCTAssertTrue(MKMapRectContainsPoint(panClusteringRect, mapPoint));
+
+        hasClustersInLeadingMargin |= mapPoint.x > MKMapRectGetMaxX(visibleMapRect) + visibleMapRect.size.width / 2;
+    }
+
+    XCTAssertTrue(hasClustersInLeadingMargin);
+}
+
+- (void)test_controllersSharingTreeAndClusterCacheShareClusters {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:5000];
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+    KPClusterCache *clusterCache = [[KPClusterCache alloc] initWithCountLimit:8];
+    KPGridClusteringAlgorithm *algorithm = [KPGridClusteringAlgorithm new];
+
+    MKMapRect visibleMapRect = MKMapRectMake(MKMapRectWorld.size.width / 4, MKMapRectWorld.size.height / 4, MKMapRectWorld.size.width / 4, MKMapRectWorld.size.height / 4);
+
+    CountingMapView *mapView = [CountingMapView new];
+    mapView.mockVisibleMapRect = visibleMapRect;
+
+    CountingMapView *anotherMapView = [CountingMapView new];
+    anotherMapView.mockVisibleMapRect = visibleMapRect;
+
+    KPClusteringController *clusteringController = [[KPClusteringController alloc] initWithMapView:mapView clusteringAlgorithm:algorithm];
+    clusteringController.clusterCache = clusterCache;
+
+    KPClusteringController *anotherClusteringController = [[KPClusteringController alloc] initWithMapView:anotherMapView clusteringAlgorithm:algorithm];
+    anotherClusteringController.clusterCache = clusterCache;
+
+    clusteringController.annotationTree = annotationTree;
+    anotherClusteringController.annotationTree = annotationTree;
+
+    // The second controller gets the clusters of the first one
+    XCTAssertEqual(clusteringController.prefetchMissCount, 1);
+    XCTAssertEqual(anotherClusteringController.prefetchHitCount, 1);
+    XCTAssertEqual(anotherClusteringController.prefetchMissCount, 0);
+
+    XCTAssertEqualObjects([NSSet setWithArray:[anotherMapView.annotations valueForKey:@"annotations"]], [NSSet setWithArray:[mapView.annotations valueForKey:@"annotations"]]);
+
+    // ... but every map shows annotations of its own, so moving the clusters of one map leaves the other one alone
+    NSHashTable *clusters = [NSHashTable hashTableWithOptions:NSPointerFunctionsObjectPointerPersonality];
+
+    for (KPAnnotation *cluster in mapView.annotations) {
+        cluster.coordinate = CLLocationCoordinate2DMake(0, 0);
+
+        [clusters addObject:cluster];
+    }
+
+    for (KPAnnotation *cluster in anotherMapView.annotations) {
+        kp_annotation_statistics_t statistics = cluster.statistics;
+
+        XCTAssertFalse([clusters containsObject:cluster]);
+        XCTAssertEqual(cluster.coordinate.latitude, KPAnnotationStatisticsGetCentroid(&statistics).latitude);
+        XCTAssertEqual(cluster.coordinate.longitude, KPAnnotationStatisticsGetCentroid(&statistics).longitude);
+    }
+
+    // Clusters of a tree are dropped when the last controller showing it moves to another tree
+    // (-setAnnotations: builds a tree of each controller's own)
+    [clusteringController setAnnotations:annotations];
+    [anotherClusteringController setAnnotations:annotations];
+
+    XCTAssertEqual(clusteringController.prefetchMissCount, 2);
+    XCTAssertEqual(anotherClusteringController.prefetchMissCount, 1);
+
+    clusteringController.annotationTree = annotationTree;
+
+    XCTAssertEqual(clusteringController.prefetchMissCount, 3);
+}
+
 @end
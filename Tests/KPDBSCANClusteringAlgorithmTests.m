@@ -0,0 +1,178 @@
+//
+//  KPDBSCANClusteringAlgorithmTests.m
+//  kingpin-dev
+//
+
+#import "TestHelpers.h"
+
+#import "KPDBSCANClusteringAlgorithm.h"
+#import "KPAnnotation.h"
+#import "KPAnnotationTree.h"
+#import "MockMapView.h"
+#import "TestAnnotation.h"
+#import "Datasets.h"
+
+#import <XCTest/XCTest.h>
+
+@interface KPDBSCANClusteringAlgorithmTests : XCTestCase
+@end
+
+@implementation KPDBSCANClusteringAlgorithmTests
+
+- (void)test_everyAnnotationInsideMapRectBelongsToExactlyOneCluster {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:(1 + arc4random_uniform(10000))];
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectRandom();
+
+    KPDBSCANClusteringAlgorithm *algorithm = [KPDBSCANClusteringAlgorithm new];
+
+    NSArray *clusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                 parentMapView:mockMapView
+                                                annotationTree:annotationTree];
+
+    for (KPDBSCANAnnotation *cluster in clusters) {
+        if (cluster.pointType == KPDBSCANPointTypeNoise) {
+            XCTAssertEqual(cluster.annotations.count, 1);
+            XCTAssertEqual(cluster.densityClusterIdentifier, NSNotFound);
+        } else {
+            XCTAssertNotEqual(cluster.densityClusterIdentifier, NSNotFound);
+        }
+    }
+
+    AssertClustersPartitionAnnotationsInMapRect(clusters, annotationTree, mockMapView.mockVisibleMapRect);
+}
+
+- (void)test_coreBorderAndNoisePointsAreReportedSeparately {
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectMake(0, 0, 320 * 1000, 480 * 1000); // 1 point on screen = 1000 map points
+
+    /*
+     With epsilon = 10 and minimumNumberOfPoints = 3:
+     - the first three annotations lie within 10 points of each other and are core points,
+     - the fourth one has only one neighbour (the third annotation) and is a border point,
+     - the last one is far away from everything and is noise.
+     */
+    NSArray *mapPoints = @[ @[ @(101000), @(100000) ], @[ @(105000), @(100000) ], @[ @(110000), @(100000) ], @[ @(118000), @(100000) ], @[ @(250000), @(400000) ] ];
+    NSMutableArray *annotations = [NSMutableArray array];
+
+    for (NSArray *mapPoint in mapPoints) {
+        TestAnnotation *annotation = [TestAnnotation new];
+        annotation.coordinate = MKCoordinateForMapPoint(MKMapPointMake([mapPoint[0] doubleValue], [mapPoint[1] doubleValue]));
+
+        [annotations addObject:annotation];
+    }
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    KPDBSCANClusteringAlgorithm *algorithm = [KPDBSCANClusteringAlgorithm new];
+    algorithm.epsilon = 10;
+    algorithm.minimumNumberOfPoints = 3;
+
+    NSArray *clusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                 parentMapView:mockMapView
+                                                annotationTree:annotationTree];
+
+    XCTAssertEqual(clusters.count, 3);
+
+    NSMutableDictionary *clustersByPointType = [NSMutableDictionary dictionary];
+
+    for (KPDBSCANAnnotation *cluster in clusters) {
+        XCTAssertNil(clustersByPointType[@(cluster.pointType)]);
+
+        clustersByPointType[@(cluster.pointType)] = cluster;
+    }
+
+    KPDBSCANAnnotation *coreCluster = clustersByPointType[@(KPDBSCANPointTypeCore)];
+    KPDBSCANAnnotation *borderCluster = clustersByPointType[@(KPDBSCANPointTypeBorder)];
+    KPDBSCANAnnotation *noiseCluster = clustersByPointType[@(KPDBSCANPointTypeNoise)];
+
+    XCTAssertEqualObjects(coreCluster.annotations, ([NSSet setWithObjects:annotations[0], annotations[1], annotations[2], nil]));
+    XCTAssertEqualObjects(borderCluster.annotations, [NSSet setWithObject:annotations[3]]);
+    XCTAssertEqualObjects(noiseCluster.annotations, [NSSet setWithObject:annotations[4]]);
+
+    XCTAssertEqual(coreCluster.densityClusterIdentifier, borderCluster.densityClusterIdentifier);
+    XCTAssertEqual(noiseCluster.densityClusterIdentifier, NSNotFound);
+}
+
+- (void)test_densityClusterStraddlingDatelineHasSameCorePointsFromBothSides {
+    double worldWidth = MKMapSizeWorld.width;
+
+    /*
+     With epsilon = 10 and minimumNumberOfPoints = 3, 1 point on screen = 1000 map points:
+     the first four annotations are 4 points apart, two on each side of longitude 180, so every one of them has
+     at least three neighbours (itself included) and all of them are core points. The last one is noise.
+     */
+    NSArray *mapPoints = @[ @[ @(worldWidth - 6000), @(100000) ], @[ @(worldWidth - 2000), @(100000) ], @[ @(2000), @(100000) ], @[ @(6000), @(100000) ], @[ @(100000), @(400000) ] ];
+    NSMutableArray *annotations = [NSMutableArray array];
+
+    for (NSArray *mapPoint in mapPoints) {
+        TestAnnotation *annotation = [TestAnnotation new];
+        annotation.coordinate = MKCoordinateForMapPoint(MKMapPointMake([mapPoint[0] doubleValue], [mapPoint[1] doubleValue]));
+
+        [annotations addObject:annotation];
+    }
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    KPDBSCANClusteringAlgorithm *algorithm = [KPDBSCANClusteringAlgorithm new];
+    algorithm.epsilon = 10;
+    algorithm.minimumNumberOfPoints = 3;
+
+    // The same viewport seen from both sides of the dateline
+    MKMapRect visibleMapRects[] = {
+        MKMapRectMake(-160 * 1000, 0, 320 * 1000, 480 * 1000),
+        MKMapRectMake(worldWidth - 160 * 1000, 0, 320 * 1000, 480 * 1000)
+    };
+
+    for (NSUInteger idx = 0; idx < 2; idx++) {
+        MockMapView *mockMapView = [MockMapView new];
+        mockMapView.mockVisibleMapRect = visibleMapRects[idx];
+
+        NSArray *clusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                     parentMapView:mockMapView
+                                                    annotationTree:annotationTree];
+
+        XCTAssertEqual(clusters.count, 2);
+
+        for (KPDBSCANAnnotation *cluster in clusters) {
+            if (cluster.pointType == KPDBSCANPointTypeCore) {
+                XCTAssertEqualObjects(cluster.annotations, ([NSSet setWithObjects:annotations[0], annotations[1], annotations[2], annotations[3], nil]));
+            } else {
+                XCTAssertEqual(cluster.pointType, KPDBSCANPointTypeNoise);
+                XCTAssertEqualObjects(cluster.annotations, [NSSet setWithObject:annotations[4]]);
+            }
+        }
+    }
+}
+
+- (void)test_attributeReducersGiveSameValuesAsWalkingAnnotations {
+    NSArray *annotations = TestWeightedAnnotationsDataset(5000);
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations attributeReducers:TestAttributeReducers()];
+
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectBoundingAnnotations(annotations);
+
+    KPDBSCANClusteringAlgorithm *algorithm = [KPDBSCANClusteringAlgorithm new];
+
+    NSArray *clusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                 parentMapView:mockMapView
+                                                annotationTree:annotationTree];
+
+    XCTAssertTrue(clusters.count > 0);
+
+    AssertReducedValuesOfClustersMatchTheirAnnotations(clusters);
+
+    for (KPAnnotation *cluster in clusters) {
+        XCTAssertTrue([cluster.annotations containsObject:cluster.representativeAnnotation]);
+    }
+}
+
+- (void)test_benchmark_DBSCANClustering {
+    BenchmarkClusteringAlgorithms(@[ @"DBSCAN" ], @[ [KPDBSCANClusteringAlgorithm new] ]);
+}
+
+@end
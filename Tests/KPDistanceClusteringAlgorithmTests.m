@@ -0,0 +1,119 @@
+//
+//  KPDistanceClusteringAlgorithmTests.m
+//  kingpin-dev
+//
+
+#import "TestHelpers.h"
+
+#import "KPDistanceClusteringAlgorithm.h"
+#import "KPGridClusteringAlgorithm.h"
+#import "KPAnnotation.h"
+#import "KPAnnotationTree.h"
+#import "MockMapView.h"
+#import "TestAnnotation.h"
+#import "Datasets.h"
+
+#import <XCTest/XCTest.h>
+
+@interface KPDistanceClusteringAlgorithmTests : XCTestCase
+@end
+
+@implementation KPDistanceClusteringAlgorithmTests
+
+- (void)test_everyAnnotationInsideMapRectBelongsToExactlyOneCluster {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:(1 + arc4random_uniform(10000))];
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectRandom();
+
+    KPDistanceClusteringAlgorithm *algorithm = [KPDistanceClusteringAlgorithm new];
+
+    NSArray *clusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                 parentMapView:mockMapView
+                                                annotationTree:annotationTree];
+
+    AssertClustersPartitionAnnotationsInMapRect(clusters, annotationTree, mockMapView.mockVisibleMapRect);
+}
+
+- (void)test_annotationsAreClusteredByScreenDistance {
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectMake(0, 0, 320 * 1000, 480 * 1000); // 1 point on screen = 1000 map points
+
+    // Group straddling what would be a grid cell border + a lonely annotation far away
+    NSArray *mapPoints = @[ @[ @(59000), @(100000) ], @[ @(61000), @(100000) ], @[ @(60000), @(110000) ], @[ @(200000), @(300000) ] ];
+    NSMutableArray *annotations = [NSMutableArray array];
+
+    for (NSArray *mapPoint in mapPoints) {
+        TestAnnotation *annotation = [TestAnnotation new];
+        annotation.coordinate = MKCoordinateForMapPoint(MKMapPointMake([mapPoint[0] doubleValue], [mapPoint[1] doubleValue]));
+
+        [annotations addObject:annotation];
+    }
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    KPDistanceClusteringAlgorithm *algorithm = [KPDistanceClusteringAlgorithm new];
+    algorithm.clusterRadius = 20;
+
+    NSArray *clusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                 parentMapView:mockMapView
+                                                annotationTree:annotationTree];
+
+    XCTAssertEqual(clusters.count, 2);
+
+    NSArray *clusterSizes = [[clusters valueForKeyPath:@"annotations.@count"] sortedArrayUsingSelector:@selector(compare:)];
+
+    XCTAssertEqualObjects(clusterSizes, (@[ @1, @3 ]));
+}
+
+- (void)test_groupStraddlingDatelineIsOneCluster {
+    double worldWidth = MKMapSizeWorld.width;
+
+    // Group on both sides of longitude 180 (x close to 0 and x close to world width) + a lonely annotation far away
+    NSArray *mapPoints = @[ @[ @(worldWidth - 3000), @(100000) ], @[ @(worldWidth - 1000), @(100000) ], @[ @(1000), @(100000) ], @[ @(100000), @(400000) ] ];
+    NSMutableArray *annotations = [NSMutableArray array];
+
+    for (NSArray *mapPoint in mapPoints) {
+        TestAnnotation *annotation = [TestAnnotation new];
+        annotation.coordinate = MKCoordinateForMapPoint(MKMapPointMake([mapPoint[0] doubleValue], [mapPoint[1] doubleValue]));
+
+        [annotations addObject:annotation];
+    }
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    KPDistanceClusteringAlgorithm *algorithm = [KPDistanceClusteringAlgorithm new];
+    algorithm.clusterRadius = 20;
+
+    // The same viewport seen from both sides of the dateline: 1 point on screen = 1000 map points
+    MKMapRect visibleMapRects[] = {
+        MKMapRectMake(-160 * 1000, 0, 320 * 1000, 480 * 1000),
+        MKMapRectMake(worldWidth - 160 * 1000, 0, 320 * 1000, 480 * 1000)
+    };
+
+    for (NSUInteger idx = 0; idx < 2; idx++) {
+        MockMapView *mockMapView = [MockMapView new];
+        mockMapView.mockVisibleMapRect = visibleMapRects[idx];
+
+        NSArray *clusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                     parentMapView:mockMapView
+                                                    annotationTree:annotationTree];
+
+        NSArray *clusterSizes = [[clusters valueForKeyPath:@"annotations.@count"] sortedArrayUsingSelector:@selector(compare:)];
+
+        XCTAssertEqualObjects(clusterSizes, (@[ @1, @3 ]));
+    }
+}
+
+- (void)test_benchmark_distanceClusteringAgainstGridClustering {
+    KPGridClusteringAlgorithm *gridAlgorithm = [KPGridClusteringAlgorithm new];
+
+    KPDistanceClusteringAlgorithm *distanceAlgorithm = [KPDistanceClusteringAlgorithm new];
+    distanceAlgorithm.clusterRadius = gridAlgorithm.gridSize.width / 2;
+
+    BenchmarkClusteringAlgorithms(@[ @"Grid", @"Distance" ], @[ gridAlgorithm, distanceAlgorithm ]);
+}
+
+@end
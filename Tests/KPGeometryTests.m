@@ -11,6 +11,7 @@
 #import "KPGeometry.h"
 
 #import <XCTest/XCTest.h>
+#import <MapKit/MapKit.h>
 
 
 @interface KPGeometryTests : XCTestCase
@@ -26,4 +27,124 @@
     XCTAssertTrue(MKMapPointGetCoordinateForAxis(&mapPoint, 1) == mapPoint.y);
 }
 
+- (void)test_MKMapRectDivideAtDateline_rectsCrossingDatelineOnEitherSideAreDivided {
+    double worldWidth = MKMapRectWorld.size.width;
+
+    MKMapRect parts[2];
+
+    // Crossing it from the right side (beyond world width) and from the left side (negative origin) gives the same parts
+    MKMapRect mapRects[] = {
+        MKMapRectMake(worldWidth - 10, 20, 30, 40),
+        MKMapRectMake(-10, 20, 30, 40)
+    };
+
+    for (NSUInteger idx = 0; idx < 2; idx++) {
+        XCTAssertEqual(MKMapRectDivideAtDateline(mapRects[idx], parts), 2);
+
+        XCTAssertTrue(MKMapRectEqualToRect(parts[0], MKMapRectMake(worldWidth - 10, 20, 10, 40)));
+        XCTAssertTrue(MKMapRectEqualToRect(parts[1], MKMapRectMake(0, 20, 20, 40)));
+    }
+
+    // Rects lying entirely on one side of it are moved into the world
+    XCTAssertEqual(MKMapRectDivideAtDateline(MKMapRectMake(-30, 20, 10, 40), parts), 1);
+    XCTAssertTrue(MKMapRectEqualToRect(parts[0], MKMapRectMake(worldWidth - 30, 20, 10, 40)));
+
+    XCTAssertEqual(MKMapRectDivideAtDateline(MKMapRectMake(worldWidth + 10, 20, 10, 40), parts), 1);
+    XCTAssertTrue(MKMapRectEqualToRect(parts[0], MKMapRectMake(10, 20, 10, 40)));
+
+    XCTAssertEqual(MKMapRectDivideAtDateline(MKMapRectMake(-worldWidth, 20, 2 * worldWidth, 40), parts), 1);
+    XCTAssertTrue(MKMapRectEqualToRect(parts[0], MKMapRectMake(0, 20, worldWidth, 40)));
+}
+
+#pragma mark - kp_map_projection_t
+
+- (void)test_KPMapProjectionGetPointForMapPoint_givesSamePointsAsMapView {
+    MKMapView *mapView = [[MKMapView alloc] initWithFrame:CGRectMake(0, 0, 320, 480)];
+    mapView.visibleMapRect = MKMapRectMake(MKMapSizeWorld.width / 4, MKMapSizeWorld.height / 4, MKMapSizeWorld.width / 64, 3 * MKMapSizeWorld.width / 128);
+
+    // Map view fits the rect to its aspect ratio: the projection is made of the rect it actually shows
+    MKMapRect visibleMapRect = mapView.visibleMapRect;
+
+    kp_map_projection_t projection = KPMapProjectionMake(visibleMapRect, mapView.frame.size);
+
+    MKMapPoint mapPoints[] = {
+        MKMapPointMake(MKMapRectGetMidX(visibleMapRect), MKMapRectGetMidY(visibleMapRect)),
+        MKMapPointMake(MKMapRectGetMinX(visibleMapRect), MKMapRectGetMinY(visibleMapRect)),
+        MKMapPointMake(MKMapRectGetMaxX(visibleMapRect), MKMapRectGetMinY(visibleMapRect)),
+        MKMapPointMake(MKMapRectGetMinX(visibleMapRect), MKMapRectGetMaxY(visibleMapRect)),
+        MKMapPointMake(MKMapRectGetMaxX(visibleMapRect), MKMapRectGetMaxY(visibleMapRect)),
+    };
+
+    CGPoint expectedPoints[] = {
+        CGPointMake(160, 240),
+        CGPointMake(0, 0),
+        CGPointMake(320, 0),
+        CGPointMake(0, 480),
+        CGPointMake(320, 480),
+    };
+
+    for (NSUInteger idx = 0; idx < sizeof(mapPoints) / sizeof(MKMapPoint); idx++) {
+        CGPoint point = KPMapProjectionGetPointForMapPoint(&projection, mapPoints[idx]);
+        CGPoint mapViewPoint = [mapView convertCoordinate:MKCoordinateForMapPoint(mapPoints[idx]) toPointToView:mapView];
+
+        XCTAssertEqualWithAccuracy(point.x, expectedPoints[idx].x, 0.001);
+        XCTAssertEqualWithAccuracy(point.y, expectedPoints[idx].y, 0.001);
+
+        // Map view rounds to its pixel grid
+        XCTAssertEqualWithAccuracy(point.x, mapViewPoint.x, 1);
+        XCTAssertEqualWithAccuracy(point.y, mapViewPoint.y, 1);
+    }
+}
+
+- (void)test_KPMapProjectionGetPointForMapPoint_pointsOnBothSidesOfDatelineAreProjectedNextToEachOther {
+    double worldWidth = MKMapSizeWorld.width;
+
+    // 1 point on screen = 1000 map points, centered on the 180th meridian from either side of it
+    MKMapRect visibleMapRects[] = {
+        MKMapRectMake(worldWidth - 160 * 1000, 0, 320 * 1000, 480 * 1000),
+        MKMapRectMake(-160 * 1000, 0, 320 * 1000, 480 * 1000)
+    };
+
+    for (NSUInteger idx = 0; idx < 2; idx++) {
+        kp_map_projection_t projection = KPMapProjectionMake(visibleMapRects[idx], CGSizeMake(320, 480));
+
+        CGPoint westOfDateline = KPMapProjectionGetPointForMapPoint(&projection, MKMapPointMake(worldWidth - 10 * 1000, 100 * 1000));
+        CGPoint eastOfDateline = KPMapProjectionGetPointForMapPoint(&projection, MKMapPointMake(20 * 1000, 100 * 1000));
+
+        XCTAssertEqualWithAccuracy(westOfDateline.x, 150, 0.001);
+        XCTAssertEqualWithAccuracy(eastOfDateline.x, 180, 0.001);
+
+        XCTAssertEqualWithAccuracy(westOfDateline.y, 100, 0.001);
+        XCTAssertEqualWithAccuracy(eastOfDateline.y, 100, 0.001);
+
+        CLLocationCoordinate2D coordinate = MKCoordinateForMapPoint(MKMapPointMake(20 * 1000, 100 * 1000));
+        CGPoint eastOfDatelineByCoordinate = KPMapProjectionGetPointForCoordinate(&projection, coordinate);
+
+        XCTAssertEqualWithAccuracy(eastOfDatelineByCoordinate.x, 180, 0.01);
+    }
+}
+
+- (void)test_KPMapProjectionGetMapSizeForSize_agreesWithDistanceBetweenMapPoints {
+    kp_map_projection_t projection = KPMapProjectionMake(MKMapRectMake(MKMapSizeWorld.width / 4, MKMapSizeWorld.height / 4, 320 * 1000, 480 * 1000), CGSizeMake(320, 480));
+
+    MKMapSize mapSize = KPMapProjectionGetMapSizeForSize(&projection, CGSizeMake(30, 40));
+
+    XCTAssertEqual(mapSize.width, 30 * 1000);
+    XCTAssertEqual(mapSize.height, 40 * 1000);
+
+    // Diagonal of a 30 x 40 points box is 50 points long, whether the box crosses the 180th meridian or not
+    MKMapPoint origins[] = {
+        MKMapPointMake(MKMapSizeWorld.width / 4, MKMapSizeWorld.height / 4),
+        MKMapPointMake(MKMapSizeWorld.width - mapSize.width / 2, MKMapSizeWorld.height / 4)
+    };
+
+    for (NSUInteger idx = 0; idx < 2; idx++) {
+        MKMapPoint mapPoint = origins[idx];
+        MKMapPoint anotherMapPoint = MKMapPointMake(fmod(mapPoint.x + mapSize.width, MKMapSizeWorld.width), mapPoint.y + mapSize.height);
+
+        XCTAssertEqualWithAccuracy(KPMapProjectionGetDistanceSquaredBetweenMapPoints(&projection, mapPoint, anotherMapPoint), 50 * 50, 0.001);
+        XCTAssertEqualWithAccuracy(KPMapProjectionGetDistanceSquaredBetweenMapPoints(&projection, anotherMapPoint, mapPoint), 50 * 50, 0.001);
+    }
+}
+
 @end
@@ -15,6 +15,7 @@
 #import "KPGeometry.h"
 #import "MockMapView.h"
 #import "TestAnnotation.h"
+#import "Datasets.h"
 
 #define HC_SHORTHAND
 #import <OCHamcrestIOS/OCHamcrestIOS.h>
@@ -198,7 +199,7 @@
             NSArray *clusters = @[ clusterAnnotation11, clusterAnnotation12 ];
 
             clusters = [clusteringAlgorithm _mergeOverlappingClusters:clusters
-                                                            inMapView:[self configuredMockMapView]
+                                                           projection:[self configuredMapProjection]
                                                           clusterGrid:clusterGrid
                                                             gridSizeX:gridSizeX
                                                             gridSizeY:gridSizeY];
@@ -240,7 +241,7 @@
             NSArray *clusters = @[ clusterAnnotation11, clusterAnnotation12 ];
 
             clusters = [clusteringAlgorithm _mergeOverlappingClusters:clusters
-                                                            inMapView:[self configuredMockMapView]
+                                                           projection:[self configuredMapProjection]
                                                           clusterGrid:clusterGrid
                                                             gridSizeX:gridSizeX
                                                             gridSizeY:gridSizeY];
@@ -297,7 +298,7 @@
             NSArray *clusters = @[ clusterAnnotation11, clusterAnnotation12, clusterAnnotation21, clusterAnnotation22 ];
 
             clusters = [clusteringAlgorithm _mergeOverlappingClusters:clusters
-                                                            inMapView:[self configuredMockMapView]
+                                                           projection:[self configuredMapProjection]
                                                           clusterGrid:clusterGrid
                                                             gridSizeX:gridSizeX
                                                             gridSizeY:gridSizeY];
@@ -352,7 +353,7 @@
             NSArray *clusters = @[ clusterAnnotation11, clusterAnnotation12, clusterAnnotation21, clusterAnnotation22 ];
 
             NSArray *clustersAfterMerge = [clusteringAlgorithm _mergeOverlappingClusters:clusters
-                                                                               inMapView:[self configuredMockMapView]
+                                                                              projection:[self configuredMapProjection]
                                                                              clusterGrid:clusterGrid
                                                                                gridSizeX:gridSizeX
                                                                                gridSizeY:gridSizeY];
@@ -368,6 +369,362 @@
 
 }
 
+- (void)test_parallelClusteringProducesTheSameResultAsSerialClustering {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:(1 + arc4random_uniform(10000))];
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    MockMapView *mockMapView = [self configuredMockMapView];
+    MKMapRect clusteringRect = [self clusteringMapRectForVisibleMapRect:mockMapView.mockVisibleMapRect];
+
+    KPGridClusteringAlgorithm *serialAlgorithm = [[KPGridClusteringAlgorithm alloc] init];
+
+    NSArray *serialClusters = [serialAlgorithm clusterAnnotationsInMapRect:clusteringRect
+                                                             parentMapView:mockMapView
+                                                            annotationTree:annotationTree];
+
+    for (NSUInteger bandCount = 0; bandCount <= 8; bandCount++) {
+        KPGridClusteringAlgorithm *parallelAlgorithm = [[KPGridClusteringAlgorithm alloc] init];
+        parallelAlgorithm.parallelClustering = YES;
+        parallelAlgorithm.parallelClusteringBandCount = bandCount;
+
+        NSArray *parallelClusters = [parallelAlgorithm clusterAnnotationsInMapRect:clusteringRect
+                                                                     parentMapView:mockMapView
+                                                                    annotationTree:annotationTree];
+
+        XCTAssertEqual(parallelClusters.count, serialClusters.count);
+
+        [serialClusters enumerateObjectsUsingBlock:^(KPAnnotation *serialCluster, NSUInteger idx, BOOL *stop) {
+            KPAnnotation *parallelCluster = parallelClusters[idx];
+
+            XCTAssertTrue(CLLocationCoordinates2DEqual(serialCluster.coordinate, parallelCluster.coordinate));
+            XCTAssertTrue([serialCluster.annotations isEqualToSet:parallelCluster.annotations]);
+        }];
+    }
+}
+
+- (void)test_weightedAnnotationsGiveWeightedClusterCentroid {
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectMake(0, 0, 320 * 1000, 480 * 1000); // 1 point on screen = 1000 map points
+
+    // All three annotations lie inside the same 60 x 60 points grid cell
+    NSArray *mapPoints = @[ @[ @(70000), @(70000) ], @[ @(100000), @(90000) ], @[ @(110000), @(110000) ] ];
+    NSArray *weights = @[ @1, @2, @3 ];
+
+    NSMutableArray *annotations = [NSMutableArray array];
+
+    for (NSUInteger idx = 0; idx < mapPoints.count; idx++) {
+        TestWeightedAnnotation *annotation = [TestWeightedAnnotation new];
+        annotation.coordinate = MKCoordinateForMapPoint(MKMapPointMake([mapPoints[idx][0] doubleValue], [mapPoints[idx][1] doubleValue]));
+        annotation.weight = [weights[idx] doubleValue];
+
+        [annotations addObject:annotation];
+    }
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    KPGridClusteringAlgorithm *clusteringAlgorithm = [KPGridClusteringAlgorithm new];
+
+    NSArray *clusters = [clusteringAlgorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                           parentMapView:mockMapView
+                                                          annotationTree:annotationTree];
+
+    XCTAssertEqual(clusters.count, 1);
+
+    KPAnnotation *cluster = clusters.firstObject;
+    KPAnnotation *expectedCluster = [[KPAnnotation alloc] initWithAnnotations:annotations];
+
+    XCTAssertEqual(cluster.weight, 6);
+    XCTAssertTrue(CLLocationCoordinates2DEqual(cluster.coordinate, expectedCluster.coordinate));
+}
+
+- (void)test_attributeReducersGiveSameValuesAsWalkingAnnotations {
+    NSArray *annotations = TestWeightedAnnotationsDataset(5000);
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations attributeReducers:TestAttributeReducers()];
+
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectBoundingAnnotations(annotations);
+
+    KPGridClusteringAlgorithm *clusteringAlgorithm = [KPGridClusteringAlgorithm new];
+    clusteringAlgorithm.annotationSize = CGSizeMake(25, 50);
+
+    for (NSNumber *strategy in @[ @(KPGridClusteringAlgorithmStrategyBasic), @(KPGridClusteringAlgorithmStrategyTwoPhase), @(KPGridClusteringAlgorithmStrategyCollisionResolution) ]) {
+        clusteringAlgorithm.clusteringStrategy = strategy.integerValue;
+
+        NSArray *clusters = [clusteringAlgorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                               parentMapView:mockMapView
+                                                              annotationTree:annotationTree];
+
+        XCTAssertTrue(clusters.count > 0);
+
+        AssertReducedValuesOfClustersMatchTheirAnnotations(clusters);
+    }
+}
+
+- (void)test_clustersByCategoryGivesClusterPerCategoryInCell {
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectMake(0, 0, 320 * 1000, 480 * 1000); // 1 point on screen = 1000 map points
+
+    // All annotations lie inside the same 60 x 60 points grid cell, categories are 0, 1, 2, 0, 1, 2
+    NSMutableArray *annotations = [NSMutableArray array];
+
+    for (NSUInteger idx = 0; idx < 6; idx++) {
+        TestCategorizedAnnotation *annotation = [TestCategorizedAnnotation new];
+        annotation.coordinate = MKCoordinateForMapPoint(MKMapPointMake(70000 + idx * 5000, 70000 + idx * 5000));
+        annotation.clusteringCategory = idx % 3;
+
+        [annotations addObject:annotation];
+    }
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    KPGridClusteringAlgorithm *clusteringAlgorithm = [KPGridClusteringAlgorithm new];
+
+    NSArray *clusters = [clusteringAlgorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                           parentMapView:mockMapView
+                                                          annotationTree:annotationTree];
+
+    XCTAssertEqual(clusters.count, 1);
+
+    clusteringAlgorithm.clustersByCategory = YES;
+
+    for (NSNumber *strategy in @[ @(KPGridClusteringAlgorithmStrategyBasic), @(KPGridClusteringAlgorithmStrategyTwoPhase) ]) {
+        clusteringAlgorithm.clusteringStrategy = strategy.unsignedIntegerValue;
+
+        clusters = [clusteringAlgorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                      parentMapView:mockMapView
+                                                     annotationTree:annotationTree];
+
+        XCTAssertEqual(clusters.count, 3);
+
+        NSMutableIndexSet *clusteringCategories = [NSMutableIndexSet indexSet];
+
+        for (KPAnnotation *cluster in clusters) {
+            XCTAssertEqual(cluster.annotations.count, 2);
+
+            for (TestCategorizedAnnotation *annotation in cluster.annotations) {
+                XCTAssertEqual(annotation.clusteringCategory, cluster.clusteringCategory);
+            }
+
+            [clusteringCategories addIndex:cluster.clusteringCategory];
+        }
+
+        XCTAssertEqual(clusteringCategories.count, 3);
+    }
+}
+
+- (void)test_clustersByCategoryPartitionsAnnotations {
+    NSArray *annotations = [KPTestDatasets dataset1];
+
+    NSMutableArray *categorizedAnnotations = [NSMutableArray arrayWithCapacity:annotations.count];
+
+    [annotations enumerateObjectsUsingBlock:^(id <MKAnnotation> annotation, NSUInteger idx, BOOL *stop) {
+        TestCategorizedAnnotation *categorizedAnnotation = [TestCategorizedAnnotation new];
+        categorizedAnnotation.coordinate = annotation.coordinate;
+        categorizedAnnotation.clusteringCategory = idx % 4;
+
+        [categorizedAnnotations addObject:categorizedAnnotation];
+    }];
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:categorizedAnnotations];
+
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectBoundingAnnotations(categorizedAnnotations);
+
+    KPGridClusteringAlgorithm *clusteringAlgorithm = [KPGridClusteringAlgorithm new];
+    clusteringAlgorithm.clustersByCategory = YES;
+    clusteringAlgorithm.clusteringStrategy = KPGridClusteringAlgorithmStrategyTwoPhase;
+
+    NSArray *clusters = [clusteringAlgorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                           parentMapView:mockMapView
+                                                          annotationTree:annotationTree];
+
+    NSMutableArray *clusteredAnnotations = [NSMutableArray array];
+
+    for (KPAnnotation *cluster in clusters) {
+        for (TestCategorizedAnnotation *annotation in cluster.annotations) {
+            XCTAssertEqual(annotation.clusteringCategory, cluster.clusteringCategory);
+        }
+
+        [clusteredAnnotations addObjectsFromArray:cluster.annotations.allObjects];
+    }
+
+    XCTAssertFalse(NSArrayHasDuplicates(clusteredAnnotations));
+    XCTAssertEqual(clusteredAnnotations.count, categorizedAnnotations.count);
+}
+
+- (void)test_tileAlignedCellSideDoesNotChangeWithSmallZoomChanges {
+    kp_map_projection_t projection = KPMapProjectionMake(MKMapRectMake(0, 0, 320 * 1000, 480 * 1000), CGSizeMake(320, 480));
+    kp_map_projection_t slightlyZoomedProjection = KPMapProjectionMake(MKMapRectMake(0, 0, 320 * 1050, 480 * 1050), CGSizeMake(320, 480));
+
+    double cellSide = KPGridTileAlignedCellSide(&projection, CGSizeMake(60, 60));
+
+    XCTAssertEqual(cellSide, KPGridTileAlignedCellSide(&slightlyZoomedProjection, CGSizeMake(60, 60)));
+    XCTAssertEqual(cellSide, exp2(round(log2(cellSide))));
+    XCTAssertEqual(cellSide, 65536); // 60 points = 60000 map points
+}
+
+- (void)test_tileAlignedClusteringMemoizesTilesOfEveryTree {
+    NSArray *annotations = [KPTestDatasets dataset1];
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectBoundingAnnotations(annotations);
+
+    KPGridClusteringAlgorithm *clusteringAlgorithm = [KPGridClusteringAlgorithm new];
+    clusteringAlgorithm.tileAlignedClustering = YES;
+
+    NSArray *clusters = [clusteringAlgorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                           parentMapView:mockMapView
+                                                          annotationTree:annotationTree];
+
+    // Every annotation of mapRect is clustered exactly once, tiles may add annotations around mapRect
+    NSArray *clusteredAnnotations = NSArrayOfAnnotationsOfClusters(clusters);
+    NSArray *annotationsBySearch = [annotationTree annotationsInMapRect:mockMapView.mockVisibleMapRect];
+
+    XCTAssertFalse(NSArrayHasDuplicates(clusteredAnnotations));
+    XCTAssertTrue([[NSSet setWithArray:annotationsBySearch] isSubsetOfSet:[NSSet setWithArray:clusteredAnnotations]]);
+
+    NSArray *coordinates = [clusters valueForKey:@"coordinate"];
+
+    // Clusters put on the map get animated: moving them must not move the clusters of the next refresh
+    for (KPAnnotation *cluster in clusters) {
+        cluster.coordinate = CLLocationCoordinate2DMake(0, 0);
+    }
+
+    // Tiles of another tree do not evict the ones of the first tree, nor mix with them
+    KPAnnotationTree *anotherAnnotationTree = [[KPAnnotationTree alloc] initWithAnnotations:[KPTestDatasets datasetRandomWithNumberOfAnnotations:1000]];
+
+    NSArray *clustersOfAnotherTree = [clusteringAlgorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                                        parentMapView:mockMapView
+                                                                       annotationTree:anotherAnnotationTree];
+
+    for (KPAnnotation *cluster in clustersOfAnotherTree) {
+        XCTAssertTrue([anotherAnnotationTree.annotations containsObject:[cluster anyAnnotation]]);
+    }
+
+    // Second refresh takes all tiles from cache: clusters are new objects of the same annotations at the same coordinates
+    NSArray *memoizedClusters = [clusteringAlgorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                                   parentMapView:mockMapView
+                                                                  annotationTree:annotationTree];
+
+    XCTAssertEqual(memoizedClusters.count, clusters.count);
+
+    for (NSUInteger idx = 0; idx < clusters.count; idx++) {
+        XCTAssertTrue(memoizedClusters[idx] != clusters[idx]);
+        XCTAssertTrue([memoizedClusters[idx] hasSameAnnotationsAsAnnotation:clusters[idx]]);
+        XCTAssertTrue(CLLocationCoordinates2DEqual([memoizedClusters[idx] coordinate], [coordinates[idx] MKCoordinateValue]));
+    }
+}
+
+- (void)test_collisionResolutionMergesOverlappingClustersOfNonAdjacentCells {
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectMake(0, 0, 320 * 1000, 480 * 1000); // 1 point on screen = 1000 map points
+
+    // Cells 0 and 2 of the second row of 60 x 60 points grid: annotation views of 100 x 100 points overlap, cells are not adjacent
+    NSMutableArray *annotations = [NSMutableArray array];
+
+    for (NSNumber *x in @[ @(50000), @(130000) ]) {
+        TestAnnotation *annotation = [TestAnnotation new];
+        annotation.coordinate = MKCoordinateForMapPoint(MKMapPointMake(x.doubleValue, 100000));
+
+        [annotations addObject:annotation];
+    }
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    KPGridClusteringAlgorithm *clusteringAlgorithm = [KPGridClusteringAlgorithm new];
+    clusteringAlgorithm.annotationSize = CGSizeMake(100, 100);
+    clusteringAlgorithm.clusteringStrategy = KPGridClusteringAlgorithmStrategyTwoPhase;
+
+    NSArray *clusters = [clusteringAlgorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                           parentMapView:mockMapView
+                                                          annotationTree:annotationTree];
+
+    XCTAssertEqual(clusters.count, 2);
+
+    clusteringAlgorithm.clusteringStrategy = KPGridClusteringAlgorithmStrategyCollisionResolution;
+
+    clusters = [clusteringAlgorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                  parentMapView:mockMapView
+                                                 annotationTree:annotationTree];
+
+    XCTAssertEqual(clusters.count, 1);
+    XCTAssertEqual([clusters.firstObject annotations].count, 2);
+}
+
+- (void)test_collisionResolutionLeavesNoOverlappingClusters {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:(1 + arc4random_uniform(10000))];
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectRandom();
+
+    KPGridClusteringAlgorithm *clusteringAlgorithm = [KPGridClusteringAlgorithm new];
+    clusteringAlgorithm.annotationSize = CGSizeMake(100, 100); // larger than 60 x 60 cells
+    clusteringAlgorithm.clusteringStrategy = KPGridClusteringAlgorithmStrategyCollisionResolution;
+
+    NSArray *clusters = [clusteringAlgorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                           parentMapView:mockMapView
+                                                          annotationTree:annotationTree];
+
+    NSMutableArray *clusteredAnnotations = [NSMutableArray array];
+
+    for (KPAnnotation *cluster in clusters) {
+        [clusteredAnnotations addObjectsFromArray:cluster.annotations.allObjects];
+    }
+
+    XCTAssertFalse(NSArrayHasDuplicates(clusteredAnnotations));
+    XCTAssertEqual(clusteredAnnotations.count, [annotationTree annotationsInMapRect:mockMapView.mockVisibleMapRect].count);
+
+    kp_map_projection_t projection = KPMapProjectionMake(mockMapView.mockVisibleMapRect, mockMapView.frame.size);
+
+    for (NSUInteger i = 0; i < clusters.count; i++) {
+        for (NSUInteger j = i + 1; j < clusters.count; j++) {
+            CGPoint p1 = KPMapProjectionGetPointForCoordinate(&projection, [clusters[i] coordinate]);
+            CGPoint p2 = KPMapProjectionGetPointForCoordinate(&projection, [clusters[j] coordinate]);
+
+            XCTAssertFalse(KPClusterAnnotationViewsIntersect(p1, p2, clusteringAlgorithm.annotationSize, clusteringAlgorithm.annotationCenterOffset));
+        }
+    }
+}
+
+- (void)test_benchmark_parallelClusteringScalesWithNumberOfCores {
+    NSArray *annotations = [KPTestDatasets dataset1];
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    // Continental US: dataset1 consists of NYC and SF clusters
+    MKMapPoint northWest = MKMapPointForCoordinate(CLLocationCoordinate2DMake(49, -125));
+    MKMapPoint southEast = MKMapPointForCoordinate(CLLocationCoordinate2DMake(25, -66));
+
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectMake(northWest.x, northWest.y, southEast.x - northWest.x, southEast.y - northWest.y);
+
+    MKMapRect clusteringRect = [self clusteringMapRectForVisibleMapRect:mockMapView.mockVisibleMapRect];
+
+    NSUInteger processorCount = [[NSProcessInfo processInfo] activeProcessorCount];
+
+    printf("Grid clustering of 9x visible rect, %lu annotations, %lu active processors\n", (unsigned long)annotations.count, (unsigned long)processorCount);
+
+    for (NSUInteger bandCount = 1; bandCount <= MAX(processorCount, 4); bandCount *= 2) {
+        KPGridClusteringAlgorithm *algorithm = [[KPGridClusteringAlgorithm alloc] init];
+        algorithm.parallelClustering = (bandCount > 1);
+        algorithm.parallelClusteringBandCount = bandCount;
+
+        printf("Bands: %lu. ", (unsigned long)bandCount);
+
+        Benchmark(10, ^{
+            [algorithm clusterAnnotationsInMapRect:clusteringRect
+                                     parentMapView:mockMapView
+                                    annotationTree:annotationTree];
+        });
+    }
+}
+
 - (void)testGridSizeHasDefaultValue {
     KPGridClusteringAlgorithm *algorithm = [KPGridClusteringAlgorithm new];
     XCTAssert(!CGSizeEqualToSize(algorithm.gridSize, CGSizeZero), @"gridSize should have an initial value");
@@ -389,6 +746,14 @@
 
 #pragma mark - Private
 
+- (MKMapRect)clusteringMapRectForVisibleMapRect:(MKMapRect)visibleMapRect {
+    return MKMapRectInset(visibleMapRect, -visibleMapRect.size.width, -visibleMapRect.size.height);
+}
+
+- (kp_map_projection_t)configuredMapProjection {
+    return KPMapProjectionMake(MKMapRectRandom(), CGSizeMake(320, 480));
+}
+
 - (MockMapView *)configuredMockMapView {
     MockMapView *mockMapView = [MockMapView new];
     mockMapView.mockVisibleMapRect = MKMapRectRandom();
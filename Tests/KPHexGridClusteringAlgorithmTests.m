@@ -0,0 +1,137 @@
+//
+//  KPHexGridClusteringAlgorithmTests.m
+//  kingpin-dev
+//
+
+#import "TestHelpers.h"
+
+#import "KPHexGridClusteringAlgorithm.h"
+#import "KPHexGridClusteringAlgorithm_Private.h"
+#import "KPGridClusteringAlgorithm.h"
+#import "KPAnnotation.h"
+#import "KPAnnotationTree.h"
+#import "MockMapView.h"
+#import "TestAnnotation.h"
+#import "Datasets.h"
+
+#import <XCTest/XCTest.h>
+
+@interface KPHexGridClusteringAlgorithmTests : XCTestCase
+@end
+
+@implementation KPHexGridClusteringAlgorithmTests
+
+- (void)test_hexPositionForMapPointIsHexagonWithNearestCenter {
+    double hexagonRadius = 1000 + arc4random_uniform(100000);
+
+    for (NSUInteger i = 0; i < 10000; i++) {
+        MKMapPoint mapPoint = MKMapPointMake(arc4random_uniform(MKMapSizeWorld.width), arc4random_uniform(MKMapSizeWorld.height));
+
+        kp_hex_position_t position = KPHexPositionForMapPoint(mapPoint, hexagonRadius);
+        MKMapPoint center = KPHexCenterForPosition(position, hexagonRadius);
+
+        double distance = pow(center.x - mapPoint.x, 2) + pow(center.y - mapPoint.y, 2);
+
+        XCTAssertTrue(distance <= pow(hexagonRadius, 2) + 1e-6);
+
+        // Hexagons are Voronoi cells of their centers: no neighbour center is closer
+        for (NSUInteger direction = 0; direction < 6; direction++) {
+            kp_hex_position_t adjacentPosition;
+            adjacentPosition.col = position.col + KPHexAdjacentClusterPositionDeltas[KPHexRowParity(position.row)][direction][0];
+            adjacentPosition.row = position.row + KPHexAdjacentClusterPositionDeltas[KPHexRowParity(position.row)][direction][1];
+
+            MKMapPoint adjacentCenter = KPHexCenterForPosition(adjacentPosition, hexagonRadius);
+
+            // Neighbour centers are exactly sqrt(3) * hexagonRadius away
+            XCTAssertEqualWithAccuracy(sqrt(pow(adjacentCenter.x - center.x, 2) + pow(adjacentCenter.y - center.y, 2)), KPHexSqrt3 * hexagonRadius, 1e-6);
+
+            double adjacentDistance = pow(adjacentCenter.x - mapPoint.x, 2) + pow(adjacentCenter.y - mapPoint.y, 2);
+
+            XCTAssertTrue(distance <= adjacentDistance + 1e-6);
+        }
+    }
+}
+
+- (void)test_everyAnnotationInsideMapRectBelongsToExactlyOneCluster {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:(1 + arc4random_uniform(10000))];
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectRandom();
+
+    KPHexGridClusteringAlgorithm *algorithm = [KPHexGridClusteringAlgorithm new];
+    algorithm.annotationSize = CGSizeMake(25, 50);
+
+    for (NSNumber *strategy in @[ @(KPGridClusteringAlgorithmStrategyBasic), @(KPGridClusteringAlgorithmStrategyTwoPhase) ]) {
+        algorithm.clusteringStrategy = strategy.integerValue;
+
+        NSArray *clusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                     parentMapView:mockMapView
+                                                    annotationTree:annotationTree];
+
+        AssertClustersPartitionAnnotationsInMapRect(clusters, annotationTree, mockMapView.mockVisibleMapRect);
+    }
+}
+
+- (void)test_twoPhaseStrategyMergesOverlappingClustersOfAdjacentHexagons {
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectMake(0, 0, 320 * 1000, 480 * 1000); // 1 point on screen = 1000 map points
+
+    KPHexGridClusteringAlgorithm *algorithm = [KPHexGridClusteringAlgorithm new];
+    algorithm.annotationSize = CGSizeMake(25, 50);
+
+    // Hexagons (col 2, row 2) and (col 3, row 2) share the border at x = 35000 * sqrt(3) * 2.5 ~ 151554,
+    // two annotations are 3 points away from it on both sides
+    double hexagonRadius = algorithm.hexagonRadius * 1000;
+    double borderX = hexagonRadius * KPHexSqrt3 * 2.5;
+    double rowY = hexagonRadius * 1.5 * 2;
+
+    NSMutableArray *annotations = [NSMutableArray array];
+
+    for (NSNumber *x in @[ @(borderX - 3000), @(borderX + 3000) ]) {
+        TestAnnotation *annotation = [TestAnnotation new];
+        annotation.coordinate = MKCoordinateForMapPoint(MKMapPointMake(x.doubleValue, rowY));
+
+        [annotations addObject:annotation];
+    }
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    NSArray *clusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                 parentMapView:mockMapView
+                                                annotationTree:annotationTree];
+
+    XCTAssertEqual(clusters.count, 2);
+
+    algorithm.clusteringStrategy = KPGridClusteringAlgorithmStrategyTwoPhase;
+
+    clusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                        parentMapView:mockMapView
+                                       annotationTree:annotationTree];
+
+    XCTAssertEqual(clusters.count, 1);
+    XCTAssertEqual([clusters.firstObject annotations].count, 2);
+}
+
+- (void)test_benchmark_hexGridClusteringAgainstGridClustering {
+    KPGridClusteringAlgorithm *gridAlgorithm = [KPGridClusteringAlgorithm new];
+    gridAlgorithm.annotationSize = CGSizeMake(25, 50);
+
+    KPHexGridClusteringAlgorithm *hexGridAlgorithm = [KPHexGridClusteringAlgorithm new];
+    hexGridAlgorithm.annotationSize = CGSizeMake(25, 50);
+
+    for (NSNumber *strategy in @[ @(KPGridClusteringAlgorithmStrategyBasic), @(KPGridClusteringAlgorithmStrategyTwoPhase) ]) {
+        gridAlgorithm.clusteringStrategy = strategy.integerValue;
+        hexGridAlgorithm.clusteringStrategy = strategy.integerValue;
+
+        NSArray *times = BenchmarkClusteringAlgorithms(@[ [NSString stringWithFormat:@"Grid (strategy %ld)", (long)strategy.integerValue],
+                                                          [NSString stringWithFormat:@"Hexagonal grid (strategy %ld)", (long)strategy.integerValue] ],
+                                                       @[ gridAlgorithm, hexGridAlgorithm ]);
+
+        // Hexagonal grid must keep throughput within 10% of the square grid
+        XCTAssertLessThanOrEqual([times[1] doubleValue], 1.1 * [times[0] doubleValue]);
+    }
+}
+
+@end
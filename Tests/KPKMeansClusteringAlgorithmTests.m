@@ -0,0 +1,136 @@
+//
+//  KPKMeansClusteringAlgorithmTests.m
+//  kingpin-dev
+//
+
+#import "TestHelpers.h"
+
+#import "KPKMeansClusteringAlgorithm.h"
+#import "KPGridClusteringAlgorithm.h"
+#import "KPAnnotation.h"
+#import "KPAnnotationTree.h"
+#import "MockMapView.h"
+#import "TestAnnotation.h"
+#import "Datasets.h"
+
+#import <XCTest/XCTest.h>
+
+@interface KPKMeansClusteringAlgorithmTests : XCTestCase
+@end
+
+@implementation KPKMeansClusteringAlgorithmTests
+
+- (void)test_everyAnnotationInsideMapRectBelongsToExactlyOneCluster {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:(1 + arc4random_uniform(10000))];
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectRandom();
+
+    KPKMeansClusteringAlgorithm *algorithm = [KPKMeansClusteringAlgorithm new];
+
+    NSArray *clusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                 parentMapView:mockMapView
+                                                annotationTree:annotationTree];
+
+    XCTAssertTrue(clusters.count <= algorithm.numberOfClusters);
+
+    for (KPAnnotation *cluster in clusters) {
+        XCTAssertTrue(cluster.annotations.count > 0);
+    }
+
+    AssertClustersPartitionAnnotationsInMapRect(clusters, annotationTree, mockMapView.mockVisibleMapRect);
+}
+
+- (void)test_wellSeparatedGroupsEndUpInSeparateClusters {
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectMake(0, 0, 320 * 1000, 480 * 1000); // 1 point on screen = 1000 map points
+
+    NSArray *groupCenters = @[ @[ @(50000), @(50000) ], @[ @(270000), @(50000) ], @[ @(160000), @(430000) ] ];
+    NSArray *groupSizes = @[ @100, @200, @300 ];
+
+    NSMutableArray *annotations = [NSMutableArray array];
+
+    for (NSUInteger groupIdx = 0; groupIdx < groupCenters.count; groupIdx++) {
+        for (NSUInteger annotationIdx = 0; annotationIdx < [groupSizes[groupIdx] unsignedIntegerValue]; annotationIdx++) {
+            MKMapPoint mapPoint = MKMapPointMake([groupCenters[groupIdx][0] doubleValue] + arc4random_uniform(20000),
+                                                 [groupCenters[groupIdx][1] doubleValue] + arc4random_uniform(20000));
+
+            TestAnnotation *annotation = [TestAnnotation new];
+            annotation.coordinate = MKCoordinateForMapPoint(mapPoint);
+
+            [annotations addObject:annotation];
+        }
+    }
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    KPKMeansClusteringAlgorithm *algorithm = [KPKMeansClusteringAlgorithm new];
+    algorithm.numberOfClusters = 3;
+
+    NSArray *clusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                 parentMapView:mockMapView
+                                                annotationTree:annotationTree];
+
+    NSArray *clusterSizes = [[clusters valueForKeyPath:@"annotations.@count"] sortedArrayUsingSelector:@selector(compare:)];
+
+    XCTAssertEqualObjects(clusterSizes, groupSizes);
+}
+
+- (void)test_attributeReducersGiveSameValuesAsWalkingAnnotations {
+    NSArray *annotations = TestWeightedAnnotationsDataset(5000);
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations attributeReducers:TestAttributeReducers()];
+
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectBoundingAnnotations(annotations);
+
+    KPKMeansClusteringAlgorithm *algorithm = [KPKMeansClusteringAlgorithm new];
+
+    NSArray *clusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                 parentMapView:mockMapView
+                                                annotationTree:annotationTree];
+
+    XCTAssertTrue(clusters.count > 0);
+
+    AssertReducedValuesOfClustersMatchTheirAnnotations(clusters);
+
+    for (KPAnnotation *cluster in clusters) {
+        XCTAssertTrue([cluster.annotations containsObject:cluster.representativeAnnotation]);
+    }
+}
+
+- (void)test_sameAnnotationsInSameRectGiveSameClusters {
+    NSArray *annotations = [KPTestDatasets datasetRandomWithNumberOfAnnotations:10000];
+
+    KPAnnotationTree *annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+
+    MockMapView *mockMapView = [MockMapView new];
+    mockMapView.mockVisibleMapRect = MKMapRectRandom();
+
+    KPKMeansClusteringAlgorithm *algorithm = [KPKMeansClusteringAlgorithm new];
+    algorithm.numberOfClusters = 50;
+
+    NSArray *clusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                 parentMapView:mockMapView
+                                                annotationTree:annotationTree];
+
+    NSArray *otherClusters = [algorithm clusterAnnotationsInMapRect:mockMapView.mockVisibleMapRect
+                                                      parentMapView:mockMapView
+                                                     annotationTree:annotationTree];
+
+    XCTAssertEqualObjects([NSSet setWithArray:[clusters valueForKey:@"annotations"]],
+                          [NSSet setWithArray:[otherClusters valueForKey:@"annotations"]]);
+}
+
+- (void)test_benchmark_kMeansClusteringAgainstGridClustering {
+    KPGridClusteringAlgorithm *gridAlgorithm = [KPGridClusteringAlgorithm new];
+
+    KPKMeansClusteringAlgorithm *kMeansAlgorithm = [KPKMeansClusteringAlgorithm new];
+    kMeansAlgorithm.numberOfClusters = 50;
+
+    BenchmarkClusteringAlgorithms(@[ @"Grid", @"k-means" ], @[ gridAlgorithm, kMeansAlgorithm ]);
+}
+
+@end
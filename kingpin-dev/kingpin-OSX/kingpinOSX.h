@@ -25,6 +25,12 @@ FOUNDATION_EXPORT const unsigned char kingpinOSXVersionString[];
 // In this header, you should import all the public headers of your framework using statements like #import <kingpin_OSX/PublicHeader.h>
 
 #import <kingpinOSX/KPAnnotation.h>
+#import <kingpinOSX/KPAttributeReducer.h>
+#import <kingpinOSX/KPClusterCache.h>
 #import <kingpinOSX/KPClusteringAlgorithm.h>
 #import <kingpinOSX/KPGridClusteringAlgorithm.h>
+#import <kingpinOSX/KPHexGridClusteringAlgorithm.h>
+#import <kingpinOSX/KPDistanceClusteringAlgorithm.h>
+#import <kingpinOSX/KPDBSCANClusteringAlgorithm.h>
+#import <kingpinOSX/KPKMeansClusteringAlgorithm.h>
 #import <kingpinOSX/KPClusteringController.h>
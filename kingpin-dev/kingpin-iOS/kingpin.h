@@ -25,6 +25,12 @@ FOUNDATION_EXPORT const unsigned char kingpinVersionString[];
 // In this header, you should import all the public headers of your framework using statements like #import <kingpin_iOS/PublicHeader.h>
 
 #import <kingpin/KPAnnotation.h>
+#import <kingpin/KPAttributeReducer.h>
+#import <kingpin/KPClusterCache.h>
 #import <kingpin/KPClusteringAlgorithm.h>
 #import <kingpin/KPGridClusteringAlgorithm.h>
+#import <kingpin/KPHexGridClusteringAlgorithm.h>
+#import <kingpin/KPDistanceClusteringAlgorithm.h>
+#import <kingpin/KPDBSCANClusteringAlgorithm.h>
+#import <kingpin/KPKMeansClusteringAlgorithm.h>
 #import <kingpin/KPClusteringController.h>
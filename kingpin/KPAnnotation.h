@@ -17,6 +17,49 @@
 #import <Foundation/Foundation.h>
 #import <MapKit/MKAnnotation.h>
 
+/**
+ Annotations conforming to this protocol are weighted when clustered, e.g. by the number of units at an address:
+ cluster coordinate is the weighted mean of member coordinates and cluster weight is the sum of member weights.
+ Annotations not conforming to it have weight of 1.
+ Weight is read once, when annotation tree is built, and must be positive.
+ */
+@protocol KPWeightedAnnotation <MKAnnotation>
+
+@property (assign, readonly, nonatomic) double weight;
+
+@end
+
+/**
+ Annotations conforming to this protocol are clustered separately per category when clustering algorithm supports it
+ (see KPGridClusteringAlgorithm.clustersByCategory): annotations of different categories never end up in the same cluster.
+ Categories are small integers, e.g. values of an enum. Annotations not conforming to this protocol belong to category 0.
+ Category is read once, when annotation tree is built.
+ */
+@protocol KPCategorizedAnnotation <MKAnnotation>
+
+@property (assign, readonly, nonatomic) NSUInteger clusteringCategory;
+
+@end
+
+typedef NS_ENUM(NSInteger, KPAnnotationOrder) {
+    // Order in which clustering algorithm found the annotations: a page costs only its own size
+    KPAnnotationOrderUnspecified = 0,
+    // Closest to the center of the cluster first
+    KPAnnotationOrderNearestFirst,
+    // Largest KPWeightedAnnotation weight first
+    KPAnnotationOrderHeaviestFirst,
+};
+
+/**
+ The member of highest priority represents a cluster (see KPAnnotation.representativeAnnotation) when annotations conform to this protocol.
+ Annotations not conforming to it have priority of 0. Priority is read once, when annotation tree is built.
+ */
+@protocol KPPrioritizedAnnotation <MKAnnotation>
+
+@property (assign, readonly, nonatomic) double clusteringPriority;
+
+@end
+
 @interface KPAnnotation : NSObject <MKAnnotation>
 
 @property (assign, nonatomic) CLLocationCoordinate2D coordinate;
@@ -27,13 +70,45 @@
 
 @property (strong, readonly, nonatomic) NSSet *annotations;
 
+// Same as annotations.count but does not build the annotations set
+@property (assign, readonly, nonatomic) NSUInteger annotationsCount;
+
+// Member representing the cluster, e.g. for its thumbnail: the member of highest clusteringPriority when annotations conform to KPPrioritizedAnnotation,
+// the member closest to the cluster's centroid otherwise. It depends only on the annotations of the cluster, so it stays the same across refreshes.
+@property (strong, readonly, nonatomic) id <MKAnnotation> representativeAnnotation;
+
+// sum of weights of the annotations, equals to their number unless they conform to KPWeightedAnnotation
+@property (assign, readonly, nonatomic) double weight;
+
+// category of the annotations when the cluster is produced by clustering by category, 0 otherwise
+@property (assign, readonly, nonatomic) NSUInteger clusteringCategory;
+
+// Deterministic identifier derived from the annotations of the cluster and its category only:
+// clusters of the same annotations produced by different refreshes have equal identifiers.
+@property (assign, readonly, nonatomic) NSUInteger clusterIdentifier;
+
 - (id)initWithAnnotations:(NSArray *)annotations;
 - (id)initWithAnnotationSet:(NSSet *)set;
 
 // returns NO if the KPAnnotation only contains one annotation
 - (BOOL)isCluster;
 
-// Private (used by the internal clustering algorithm)
-@property (strong, nonatomic) NSValue *_annotationPointInMapView;
+/**
+ Value of the KPAttributeReducer of given name reduced over the annotations of the cluster during clustering.
+ nil when the annotation tree has no reducer of this name. Every bundled clustering algorithm builds its clusters from the tree,
+ so only clusters built from a set of annotations (e.g. -initWithAnnotations:) return nil for every name.
+ */
+- (NSNumber *)reducedValueForAttributeNamed:(NSString *)name;
+
+/**
+ Page of the cluster's annotations in given order, for lists of clusters too large to build the annotations set at once.
+ Clusters produced by clustering algorithms read the page straight from the annotation tree. Ordered pages are sorted incrementally:
+ a page costs a linear selection among the annotations after the previous pages plus sorting the page itself.
+ Range is clamped to annotationsCount.
+ */
+- (NSArray *)annotationsInRange:(NSRange)range order:(KPAnnotationOrder)order;
+
+// Streams the cluster's annotations in given order page by page, without building the annotations set
+- (void)enumerateAnnotationsWithOrder:(KPAnnotationOrder)order usingBlock:(void (^)(id <MKAnnotation> annotation, NSUInteger idx, BOOL *stop))block;
 
 @end
@@ -15,16 +15,149 @@
 //
 
 #import "KPAnnotation.h"
+#import "KPAnnotation_Private.h"
+#import "KPAnnotationTree_Private.h"
+#import "KPAttributeReducer.h"
+#import "KPAttributeReducer_Private.h"
 
 #import "KPGeometry.h"
 
-@interface KPAnnotation ()
+/*
+ Member of a cluster (its position in nodeIndexes, or in memberArray for a cluster built from a set) with its sort key.
+ Members are never equal: equal keys are ordered by member.
+ */
+typedef struct {
+    double key;
+    NSUInteger member;
+} kp_member_key_t;
+
+@interface KPAnnotation () {
+    // Members in the order of memberKeysOrder, of which the first sortedMemberKeysCount are sorted
+    // and every one of them is not greater than any of the rest
+    kp_member_key_t *_memberKeys;
+    KPAnnotationOrder _memberKeysOrder;
+    NSUInteger _sortedMemberKeysCount;
+
+    // Representative member of a cluster built from node indexes
+    NSUInteger _representativeNodeIndex;
+}
 
 @property (strong, readwrite, nonatomic) NSSet *annotations;
+
+// Stable order of members of a cluster built from a set, indexed by member
+@property (strong, nonatomic) NSArray *memberArray;
+
+// Cached for a cluster built from a set
+@property (strong, readwrite, nonatomic) id <MKAnnotation> representativeAnnotation;
 @property (assign, readwrite, nonatomic) CLLocationDistance radius;
 
+@property (assign, nonatomic) NSUInteger cachedClusterIdentifier;
+@property (assign, nonatomic) BOOL clusterIdentifierIsCached;
+
 @end
 
+// Finalizer of splitmix64: spreads the bits of pointer-like hashes of annotations
+static inline uint64_t KPAnnotationMixHash(uint64_t hash) {
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+
+    return hash ^ (hash >> 31);
+}
+
+static inline BOOL KPMemberKeyLessThan(kp_member_key_t *memberKey, kp_member_key_t *anotherMemberKey) {
+    return memberKey->key < anotherMemberKey->key || (memberKey->key == anotherMemberKey->key && memberKey->member < anotherMemberKey->member);
+}
+
+static int KPMemberKeyCompare(const void *memberKey, const void *anotherMemberKey) {
+    kp_member_key_t *lhs = (kp_member_key_t *)memberKey;
+    kp_member_key_t *rhs = (kp_member_key_t *)anotherMemberKey;
+
+    return KPMemberKeyLessThan(lhs, rhs) ? -1 : (KPMemberKeyLessThan(rhs, lhs) ? 1 : 0);
+}
+
+/*
+ Quickselect: rearranges memberKeys so that the k smallest come first, in no particular order. Average O(count).
+ Pivot is the median of the first, middle and last keys of the current range, ranges are split by Hoare partition.
+ */
+static void KPMemberKeysSelect(kp_member_key_t *memberKeys, NSUInteger count, NSUInteger k) {
+    NSInteger left = 0;
+    NSInteger right = (NSInteger)count - 1;
+
+    while (left < right) {
+        kp_member_key_t *first = memberKeys + left;
+        kp_member_key_t *middle = memberKeys + left + (right - left) / 2;
+        kp_member_key_t *last = memberKeys + right;
+
+        kp_member_key_t pivot;
+
+        if (KPMemberKeyLessThan(first, middle)) {
+            pivot = KPMemberKeyLessThan(middle, last) ? *middle : (KPMemberKeyLessThan(first, last) ? *last : *first);
+        } else {
+            pivot = KPMemberKeyLessThan(first, last) ? *first : (KPMemberKeyLessThan(middle, last) ? *last : *middle);
+        }
+
+        NSInteger i = left;
+        NSInteger j = right;
+
+        while (i <= j) {
+            while (KPMemberKeyLessThan(memberKeys + i, &pivot)) {
+                i++;
+            }
+
+            while (KPMemberKeyLessThan(&pivot, memberKeys + j)) {
+                j--;
+            }
+
+            if (i <= j) {
+                kp_member_key_t swap = memberKeys[i];
+                memberKeys[i] = memberKeys[j];
+                memberKeys[j] = swap;
+
+                i++;
+                j--;
+            }
+        }
+
+        // [left, j] <= pivot <= [i, right], keys between j and i are the pivot itself
+        if ((NSInteger)k <= j + 1) {
+            right = j;
+        } else if ((NSInteger)k > i) {
+            left = i;
+        } else {
+            break;
+        }
+    }
+}
+
+/*
+ Representative member of a cluster given by node indexes: the one of highest priority when the tree is prioritized, the one closest to centroid otherwise.
+ Ties go to the smallest node index, so the result depends only on the set of members, not on their order.
+ */
+static NSUInteger KPAnnotationGetRepresentativeNodeIndex(kp_2dtree_t *tree, const NSUInteger *nodeIndexes, NSUInteger count, MKMapPoint centroid) {
+    NSUInteger representative = NSNotFound;
+    double representativeScore = 0;
+
+    for (NSUInteger member = 0; member < count; member++) {
+        NSUInteger idx = nodeIndexes[member];
+
+        double score = tree->prioritized ? -tree->priorities[idx] : MKMapPointGetDistanceSquaredToMapPoint(tree->root[idx].mk_map_point, centroid);
+
+        if (representative == NSNotFound || score < representativeScore || (score == representativeScore && idx < representative)) {
+            representative = idx;
+            representativeScore = score;
+        }
+    }
+
+    return representative;
+}
+
+static int KPAnnotationCompareNodeIndexes(const void *index, const void *anotherIndex) {
+    NSUInteger lhs = *(const NSUInteger *)index;
+    NSUInteger rhs = *(const NSUInteger *)anotherIndex;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
 @implementation KPAnnotation
 
 - (id)initWithAnnotations:(NSArray *)annotations {
@@ -32,124 +165,434 @@
 }
 
 - (id)initWithAnnotationSet:(NSSet *)set {
+    kp_annotation_statistics_t statistics = KPAnnotationStatisticsMake();
+
+    for (id <MKAnnotation> annotation in set) {
+        KPAnnotationStatisticsAddCoordinate(&statistics, annotation.coordinate, KPAnnotationGetWeight(annotation));
+    }
+
+    return [self initWithAnnotationSet:set statistics:statistics];
+}
+
+- (id)initWithAnnotationSet:(NSSet *)set statistics:(kp_annotation_statistics_t)statistics {
     self = [super init];
     
     if (self == nil) {
         return nil;
     }
 
+    NSCAssert(set.count == statistics.count, nil);
+
     self.annotations = set;
-    self.title = [NSString stringWithFormat:@"%lu things", (unsigned long)[self.annotations count]];;
+    self.title = [NSString stringWithFormat:@"%lu things", (unsigned long)[self.annotations count]];
+
+    _statistics = statistics;
+
     [self calculateValues];
     
     return self;
 }
 
-- (BOOL)isCluster {
-    return (self.annotations.count > 1);
+- (id)initWithAnnotationTree:(KPAnnotationTree *)annotationTree
+                 nodeIndexes:(const NSUInteger *)nodeIndexes
+                  statistics:(kp_annotation_statistics_t)statistics {
+    return [self initWithAnnotationTree:annotationTree nodeIndexes:nodeIndexes statistics:statistics reducedValues:NULL];
 }
 
-#pragma mark - Private
+- (id)initWithAnnotationTree:(KPAnnotationTree *)annotationTree
+                 nodeIndexes:(const NSUInteger *)nodeIndexes
+                  statistics:(kp_annotation_statistics_t)statistics
+               reducedValues:(const double *)reducedValues {
+    self = [super init];
 
-- (void)calculateValues {
-    NSUInteger count = self.annotations.count;
+    if (self == nil) {
+        return nil;
+    }
 
-    if (count == 0) {
-        return;
+    NSCAssert(annotationTree != nil && statistics.count > 0, nil);
+
+    NSUInteger *copiedNodeIndexes = malloc(statistics.count * sizeof(NSUInteger));
+    memcpy(copiedNodeIndexes, nodeIndexes, statistics.count * sizeof(NSUInteger));
+
+    _annotationTree = annotationTree;
+    _nodeIndexes = copiedNodeIndexes;
+
+    kp_2dtree_t tree = annotationTree.tree;
+
+    _representativeNodeIndex = KPAnnotationGetRepresentativeNodeIndex(&tree, nodeIndexes, statistics.count,
+                                                                      MKMapPointForCoordinate(KPAnnotationStatisticsGetCentroid(&statistics)));
+
+    NSArray *attributeReducers = annotationTree.attributeReducers;
+
+    if (attributeReducers.count > 0) {
+        double *values = malloc(attributeReducers.count * sizeof(double));
+
+        if (reducedValues != NULL) {
+            memcpy(values, reducedValues, attributeReducers.count * sizeof(double));
+        } else {
+            for (NSUInteger reducerIdx = 0; reducerIdx < attributeReducers.count; reducerIdx++) {
+                KPAttributeReducerOperation operation = [attributeReducers[reducerIdx] operation];
+                const double *column = [annotationTree attributeColumnAtIndex:reducerIdx];
+
+                double value = KPAttributeReducerOperationGetIdentity(operation);
+
+                for (NSUInteger idx = 0; idx < statistics.count; idx++) {
+                    value = KPAttributeReducerOperationReduce(operation, value, column[nodeIndexes[idx]]);
+                }
+
+                values[reducerIdx] = value;
+            }
+        }
+
+        _reducedValues = values;
     }
 
-    if (count == 1) {
-        self.radius = 0;
-        self.coordinate = [[[self annotations] anyObject] coordinate];
+    self.title = [NSString stringWithFormat:@"%lu things", (unsigned long)statistics.count];
 
-        return;
+    _statistics = statistics;
+
+    [self calculateValues];
+
+    return self;
+}
+
+- (void)dealloc {
+    free((void *)_nodeIndexes);
+    free((void *)_reducedValues);
+    free(_memberKeys);
+}
+
+- (NSSet *)annotations {
+    @synchronized (self) {
+        if (_annotations == nil && _nodeIndexes != NULL) {
+            NSUInteger count = _statistics.count;
+            kp_treenode_t *root = _annotationTree.tree.root;
+
+            __unsafe_unretained id *objects = (__unsafe_unretained id *)malloc(count * sizeof(id));
+
+            for (NSUInteger idx = 0; idx < count; idx++) {
+                objects[idx] = root[_nodeIndexes[idx]].annotation;
+            }
+
+            _annotations = [NSSet setWithObjects:objects count:count];
+
+            free(objects);
+        }
+
+        return _annotations;
+    }
+}
+
+- (id <MKAnnotation>)representativeAnnotation {
+    if (_nodeIndexes != NULL) {
+        return _annotationTree.tree.root[_representativeNodeIndex].annotation;
+    }
+
+    @synchronized (self) {
+        if (_representativeAnnotation == nil) {
+            _representativeAnnotation = [self _representativeOfAnnotationSet];
+        }
+
+        return _representativeAnnotation;
     }
+}
 
-    CLLocationDegrees minLat = NSIntegerMax;
-    CLLocationDegrees minLng = NSIntegerMax;
-    CLLocationDegrees maxLat = NSIntegerMin;
-    CLLocationDegrees maxLng = NSIntegerMin;
+- (id <MKAnnotation>)anyAnnotation {
+    if (_nodeIndexes != NULL) {
+        return _annotationTree.tree.root[_nodeIndexes[0]].annotation;
+    }
 
-    CLLocationDegrees totalLat = 0;
-    CLLocationDegrees totalLng = 0;
+    return [self.annotations anyObject];
+}
 
-    NSUInteger idx = 0;
-    CLLocationCoordinate2D coords[2];
+- (instancetype)clusterCopy {
+    KPAnnotation *cluster;
 
-    /* 
-     This algorithm is approx. 1.2-2x faster than naive one.
-     It is described here: https://github.com/EvgenyKarkan/EKAlgorithms/issues/30
-     */
-    for (id <MKAnnotation> ithAnnotation in self.annotations) {
-        // Machine way of doing odd/even check is better than mathematical count % 2
-        if (((idx++) & 1) == 0) {
-            coords[0] = ithAnnotation.coordinate;
+    if (_nodeIndexes != NULL) {
+        cluster = [[[self class] alloc] initWithAnnotationTree:_annotationTree nodeIndexes:_nodeIndexes statistics:_statistics reducedValues:_reducedValues];
+    } else {
+        cluster = [[[self class] alloc] initWithAnnotationSet:self.annotations statistics:_statistics];
+    }
 
-            continue;
-        } else {
-            coords[1] = ithAnnotation.coordinate;
+    cluster.clusteringCategory = self.clusteringCategory;
+
+    return cluster;
+}
+
+- (BOOL)hasSameAnnotationsAsAnnotation:(KPAnnotation *)annotation {
+    if (annotation == self) {
+        return YES;
+    }
+
+    if (_statistics.count != annotation.statistics.count) {
+        return NO;
+    }
+
+    if (_nodeIndexes == NULL || annotation.nodeIndexes == NULL || _annotationTree != annotation.annotationTree) {
+        return [self.annotations isEqualToSet:annotation.annotations];
+    }
+
+    NSUInteger count = _statistics.count;
+
+    NSUInteger *nodeIndexes = malloc(count * sizeof(NSUInteger));
+    NSUInteger *anotherNodeIndexes = malloc(count * sizeof(NSUInteger));
+
+    memcpy(nodeIndexes, _nodeIndexes, count * sizeof(NSUInteger));
+    memcpy(anotherNodeIndexes, annotation.nodeIndexes, count * sizeof(NSUInteger));
+
+    qsort(nodeIndexes, count, sizeof(NSUInteger), KPAnnotationCompareNodeIndexes);
+    qsort(anotherNodeIndexes, count, sizeof(NSUInteger), KPAnnotationCompareNodeIndexes);
+
+    BOOL same = memcmp(nodeIndexes, anotherNodeIndexes, count * sizeof(NSUInteger)) == 0;
+
+    free(nodeIndexes);
+    free(anotherNodeIndexes);
+
+    return same;
+}
+
+- (BOOL)isCluster {
+    return (_statistics.count > 1);
+}
+
+- (NSNumber *)reducedValueForAttributeNamed:(NSString *)name {
+    if (_reducedValues == NULL) {
+        return nil;
+    }
+
+    NSArray *attributeReducers = _annotationTree.attributeReducers;
+
+    for (NSUInteger reducerIdx = 0; reducerIdx < attributeReducers.count; reducerIdx++) {
+        if ([[attributeReducers[reducerIdx] name] isEqualToString:name]) {
+            return @(_reducedValues[reducerIdx]);
+        }
+    }
+
+    return nil;
+}
+
+- (NSUInteger)annotationsCount {
+    return _statistics.count;
+}
+
+- (NSArray *)annotationsInRange:(NSRange)range order:(KPAnnotationOrder)order {
+    NSUInteger count = _statistics.count;
+
+    NSUInteger location = MIN(range.location, count);
+    NSUInteger end = MIN(NSMaxRange(range), count);
+
+    if (location == end) {
+        return @[];
+    }
+
+    @synchronized (self) {
+        if (order != KPAnnotationOrderUnspecified) {
+            [self _sortMemberKeysInOrder:order upToCount:end];
+        }
+
+        __unsafe_unretained id *objects = (__unsafe_unretained id *)malloc((end - location) * sizeof(id));
+
+        for (NSUInteger idx = location; idx < end; idx++) {
+            NSUInteger member = order == KPAnnotationOrderUnspecified ? idx : _memberKeys[idx].member;
+
+            objects[idx - location] = [self _annotationOfMember:member];
         }
 
-        CLLocationDegrees ithLatitude      = coords[0].latitude;
-        CLLocationDegrees iplus1thLatitude = coords[1].latitude;
+        NSArray *page = [NSArray arrayWithObjects:objects count:(end - location)];
+
+        free(objects);
+
+        return page;
+    }
+}
+
+- (void)enumerateAnnotationsWithOrder:(KPAnnotationOrder)order usingBlock:(void (^)(id <MKAnnotation> annotation, NSUInteger idx, BOOL *stop))block {
+    NSUInteger count = _statistics.count;
+
+    NSUInteger location = 0;
+    NSUInteger pageSize = 64;
 
-        CLLocationDegrees ithLongitude      = coords[0].longitude;
-        CLLocationDegrees iplus1thLongitude = coords[1].longitude;
+    BOOL stop = NO;
 
-        if (ithLatitude < iplus1thLatitude) {
-            minLat = MIN(minLat, ithLatitude);
-            maxLat = MAX(maxLat, iplus1thLatitude);
+    // Pages grow geometrically: a block which stops early pays for a few small pages only, a full enumeration makes O(log(count)) selections
+    while (location < count && stop == NO) {
+        NSArray *page = [self annotationsInRange:NSMakeRange(location, pageSize) order:order];
+
+        for (id <MKAnnotation> annotation in page) {
+            block(annotation, location++, &stop);
+
+            if (stop) {
+                break;
+            }
         }
-        else if (ithLatitude > iplus1thLatitude) {
-            minLat = MIN(minLat, iplus1thLatitude);
-            maxLat = MAX(maxLat, ithLatitude);
+
+        pageSize *= 2;
+    }
+}
+
+- (double)weight {
+    return _statistics.weight;
+}
+
+- (NSUInteger)clusterIdentifier {
+    if (self.clusterIdentifierIsCached == NO) {
+        // Sum of mixed hashes does not depend on the order of annotations in the set
+        uint64_t identifier = KPAnnotationMixHash(_statistics.count) ^ KPAnnotationMixHash(~(uint64_t)self.clusteringCategory);
+
+        if (_nodeIndexes != NULL) {
+            // Members are read from the tree, so the identifier does not materialise the annotations set
+            kp_treenode_t *root = _annotationTree.tree.root;
+
+            for (NSUInteger idx = 0; idx < _statistics.count; idx++) {
+                identifier += KPAnnotationMixHash([root[_nodeIndexes[idx]].annotation hash]);
+            }
+        } else {
+            for (id annotation in self.annotations) {
+                identifier += KPAnnotationMixHash([annotation hash]);
+            }
         }
-        else {
-            minLat = MIN(minLat, ithLatitude);
-            maxLat = MAX(maxLat, ithLatitude);
+
+        self.cachedClusterIdentifier = (NSUInteger)identifier;
+        self.clusterIdentifierIsCached = YES;
+    }
+
+    return self.cachedClusterIdentifier;
+}
+
+#pragma mark - Private
+
+// Same rules as KPAnnotationGetRepresentativeNodeIndex() but reading members, ties go to the smallest hash
+- (id <MKAnnotation>)_representativeOfAnnotationSet {
+    BOOL prioritized = NO;
+
+    for (id <MKAnnotation> annotation in self.annotations) {
+        if (isnan(KPAnnotationGetPriority(annotation)) == NO) {
+            prioritized = YES;
+
+            break;
         }
+    }
+
+    MKMapPoint centroid = MKMapPointForCoordinate(KPAnnotationStatisticsGetCentroid(&_statistics));
+
+    id <MKAnnotation> representative = nil;
+    double representativeScore = 0;
 
-        if (ithLongitude < iplus1thLongitude) {
-            minLng = MIN(minLng, ithLongitude);
-            maxLng = MAX(maxLng, iplus1thLongitude);
+    for (id <MKAnnotation> annotation in self.annotations) {
+        double score;
+
+        if (prioritized) {
+            double priority = KPAnnotationGetPriority(annotation);
+
+            score = isnan(priority) ? 0 : -priority;
+        } else {
+            score = MKMapPointGetDistanceSquaredToMapPoint(MKMapPointForCoordinate(annotation.coordinate), centroid);
         }
-        else if (ithLongitude > iplus1thLongitude) {
-            minLng = MIN(minLng, iplus1thLongitude);
-            maxLng = MAX(maxLng, ithLongitude);
+
+        if (representative == nil || score < representativeScore || (score == representativeScore && annotation.hash < representative.hash)) {
+            representative = annotation;
+            representativeScore = score;
         }
-        else {
-            minLng = MIN(minLng, ithLongitude);
-            maxLng = MAX(maxLng, ithLongitude);
+    }
+
+    return representative;
+}
+
+- (id <MKAnnotation>)_annotationOfMember:(NSUInteger)member {
+    if (_nodeIndexes != NULL) {
+        return _annotationTree.tree.root[_nodeIndexes[member]].annotation;
+    }
+
+    if (self.memberArray == nil) {
+        self.memberArray = self.annotations.allObjects;
+    }
+
+    return self.memberArray[member];
+}
+
+// Keys of clusters built from node indexes are read from the tree arrays, the others message their members once
+- (void)_makeMemberKeysInOrder:(KPAnnotationOrder)order {
+    NSUInteger count = _statistics.count;
+
+    if (_memberKeys == NULL) {
+        _memberKeys = malloc(count * sizeof(kp_member_key_t));
+    }
+
+    MKMapPoint centroid = MKMapPointForCoordinate(KPAnnotationStatisticsGetCentroid(&_statistics));
+
+    kp_2dtree_t tree = _annotationTree.tree;
+
+    for (NSUInteger member = 0; member < count; member++) {
+        double key;
+
+        if (_nodeIndexes != NULL) {
+            NSUInteger idx = _nodeIndexes[member];
+
+            if (order == KPAnnotationOrderNearestFirst) {
+                key = MKMapPointGetDistanceSquaredToMapPoint(tree.root[idx].mk_map_point, centroid);
+            } else {
+                key = -tree.weights[idx];
+            }
+        } else {
+            id <MKAnnotation> annotation = [self _annotationOfMember:member];
+
+            if (order == KPAnnotationOrderNearestFirst) {
+                key = MKMapPointGetDistanceSquaredToMapPoint(MKMapPointForCoordinate(annotation.coordinate), centroid);
+            } else {
+                key = -KPAnnotationGetWeight(annotation);
+            }
         }
 
-        totalLat += (ithLatitude + iplus1thLatitude);
-        totalLng += (ithLongitude + iplus1thLongitude);
+        _memberKeys[member].key = key;
+        _memberKeys[member].member = member;
+    }
+
+    _memberKeysOrder = order;
+    _sortedMemberKeysCount = 0;
+}
+
+/*
+ Incremental sort: the keys after the sorted prefix are selected so that the next smallest ones come first, and only those are sorted.
+ Pages asked in sequence cost O(rest + page * log(page)) each instead of sorting all members for the first page.
+ */
+- (void)_sortMemberKeysInOrder:(KPAnnotationOrder)order upToCount:(NSUInteger)count {
+    if (_memberKeys == NULL || _memberKeysOrder != order) {
+        [self _makeMemberKeysInOrder:order];
+    }
+
+    if (count <= _sortedMemberKeysCount) {
+        return;
     }
 
-    // If self.annotations has odd number elements we have unpaired last annotation coordinate values in coords[0]
-    BOOL isOdd = count & 1;
+    kp_member_key_t *unsortedMemberKeys = _memberKeys + _sortedMemberKeysCount;
+
+    KPMemberKeysSelect(unsortedMemberKeys, _statistics.count - _sortedMemberKeysCount, count - _sortedMemberKeysCount);
 
-    if (isOdd == 1) {
-        CLLocationDegrees lastElementLatitude  = coords[0].latitude;
-        CLLocationDegrees lastElementLongitude = coords[1].longitude;
+    qsort(unsortedMemberKeys, count - _sortedMemberKeysCount, sizeof(kp_member_key_t), KPMemberKeyCompare);
 
-        minLat = MIN(minLat, lastElementLatitude);
-        minLng = MIN(minLng, lastElementLongitude);
-        maxLat = MAX(maxLat, lastElementLatitude);
-        maxLng = MAX(maxLng, lastElementLongitude);
+    _sortedMemberKeysCount = count;
+}
 
-        totalLat += lastElementLatitude;
-        totalLng += lastElementLongitude;
+- (void)calculateValues {
+    NSUInteger count = _statistics.count;
+
+    if (count == 0) {
+        return;
     }
 
-    self.coordinate = CLLocationCoordinate2DMake(totalLat / self.annotations.count,
-                                                 totalLng / self.annotations.count);
+    self.coordinate = KPAnnotationStatisticsGetCentroid(&_statistics);
+
+    if (count == 1) {
+        self.radius = 0;
+
+        return;
+    }
 
     CLLocationDistance midPointToMax = MKMetersBetweenMapPoints(MKMapPointForCoordinate(self.coordinate),
-                                                                MKMapPointForCoordinate(CLLocationCoordinate2DMake(maxLat, maxLng)));
+                                                                MKMapPointForCoordinate(KPAnnotationStatisticsGetMaxCoordinate(&_statistics)));
     
     CLLocationDistance midPointToMin = MKMetersBetweenMapPoints(MKMapPointForCoordinate(self.coordinate),
-                                                                MKMapPointForCoordinate(CLLocationCoordinate2DMake(minLat, minLng)));
+                                                                MKMapPointForCoordinate(KPAnnotationStatisticsGetMinCoordinate(&_statistics)));
     
     self.radius = MAX(midPointToMax, midPointToMin);
 }
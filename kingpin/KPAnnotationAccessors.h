@@ -0,0 +1,52 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "KPAnnotation.h"
+
+/*
+ Values of the optional annotation protocols (KPWeightedAnnotation, KPCategorizedAnnotation, KPPrioritizedAnnotation)
+ with their defaults for annotations not conforming to them. The 2-d tree reads them once per annotation when it is built,
+ clusters built from a set of annotations read them from their members.
+ */
+
+static inline double KPAnnotationGetWeight(id <MKAnnotation> annotation) {
+    if ([annotation conformsToProtocol:@protocol(KPWeightedAnnotation)]) {
+        double weight = [(id <KPWeightedAnnotation>)annotation weight];
+
+        NSCAssert(weight > 0, @"Weight of annotation must be positive: %@", annotation);
+
+        return weight;
+    }
+
+    return 1;
+}
+
+static inline NSUInteger KPAnnotationGetCategory(id <MKAnnotation> annotation) {
+    if ([annotation conformsToProtocol:@protocol(KPCategorizedAnnotation)]) {
+        return [(id <KPCategorizedAnnotation>)annotation clusteringCategory];
+    }
+
+    return 0;
+}
+
+// NAN for annotations not conforming to KPPrioritizedAnnotation
+static inline double KPAnnotationGetPriority(id <MKAnnotation> annotation) {
+    if ([annotation conformsToProtocol:@protocol(KPPrioritizedAnnotation)]) {
+        return [(id <KPPrioritizedAnnotation>)annotation clusteringPriority];
+    }
+
+    return NAN;
+}
@@ -19,9 +19,14 @@
 
 @interface KPAnnotationTree : NSObject
 
-@property (strong, readonly, nonatomic) NSSet *annotations;
+// Built on every access: the tree keeps its annotations in an array and does not hash them
+@property (readonly, nonatomic) NSSet *annotations;
+
+// KPAttributeReducers whose columns are stored in the tree, in the order of registration
+@property (copy, readonly, nonatomic) NSArray *attributeReducers;
 
 - (id)initWithAnnotations:(NSArray *)annotations;
+- (id)initWithAnnotations:(NSArray *)annotations attributeReducers:(NSArray *)attributeReducers;
 - (NSArray *)annotationsInMapRect:(MKMapRect)rect;
 
 @end
@@ -18,17 +18,27 @@
 #import "KPAnnotationTree_Private.h"
 
 #import "KPAnnotation.h"
+#import "KPAttributeReducer.h"
+#import "KPAttributeReducer_Private.h"
 
 #import "KPGeometry.h"
 
 @implementation KPAnnotationTree
 
 - (id)initWithAnnotations:(NSArray *)annotations {
+    return [self initWithAnnotations:annotations attributeReducers:nil];
+}
+
+- (id)initWithAnnotations:(NSArray *)annotations attributeReducers:(NSArray *)attributeReducers {
     
     self = [super init];
     
     if (self) {
-        _annotations = [NSSet setWithArray:annotations];
+        _retainedAnnotations = [annotations copy];
+        _searchScratchLock = [[NSLock alloc] init];
+
+        _clusteringCache = [[NSCache alloc] init];
+        _clusteringCache.countLimit = 1024;
 
         // The following ifndef is to prevent Analyzer from producing incorrect warning:
         // "Function call argument is an uninitialized value (within a call to)"
@@ -37,6 +47,22 @@
 #ifndef __clang_analyzer__
         _tree = kp_2dtree_create(annotations);
 #endif
+
+        _attributeReducers = attributeReducers.count > 0 ? [attributeReducers copy] : @[];
+
+        // Values are read once here, in node order, so clustering reduces them without sending messages to annotations
+        if (_attributeReducers.count > 0 && _tree.size > 0) {
+            _attributeColumns = malloc(_attributeReducers.count * _tree.size * sizeof(double));
+
+            for (NSUInteger reducerIdx = 0; reducerIdx < _attributeReducers.count; reducerIdx++) {
+                KPAttributeReducer *reducer = _attributeReducers[reducerIdx];
+                double *column = _attributeColumns + reducerIdx * _tree.size;
+
+                for (NSUInteger idx = 0; idx < _tree.size; idx++) {
+                    column[idx] = [reducer columnValueForAnnotation:_tree.root[idx].annotation];
+                }
+            }
+        }
     }
 
     return self;
@@ -45,63 +71,98 @@
 - (void)dealloc {
     kp_2dtree_free(& _tree);
 
-    _annotations = nil;
+    free(_subtreeBounds);
+    free(_attributeColumns);
+
+    _retainedAnnotations = nil;
+}
+
+- (NSSet *)annotations {
+    return [NSSet setWithArray:_retainedAnnotations];
 }
 
 #pragma mark - Search
 
 - (NSArray *)annotationsInMapRect:(MKMapRect)rect {
-    MKMapRect normalizedRect = rect;
+    return [self annotationsInMapRect:rect searchScratch:NULL];
+}
+
+- (NSArray *)annotationsInMapRect:(MKMapRect)rect searchScratch:(kp_2dtree_search_scratch_t *)scratch {
+    NSMutableArray *result = [NSMutableArray array];
 
-    double rectMinX = fmod(MKMapRectGetMinX(rect), MKMapRectWorld.size.width);
-    double rectMaxX = fmod(MKMapRectGetMaxX(rect), MKMapRectWorld.size.width);
+    kp_2dtree_node_visitor_t block = ^(kp_treenode_t *node) {
+        [result addObject:node->annotation];
+    };
 
-    if (rectMinX > rectMaxX) {
-        MKMapRect rectLeft = MKMapRectMake(
-                                           rectMinX,
-                                           rect.origin.y,
-                                           MKMapRectWorld.size.width - rectMinX,
-                                           rect.size.height
-                                           );
+    if (scratch) {
+        [self enumerateNodesInMapRect:rect searchScratch:scratch usingBlock:block];
 
-        NSArray *annotationsLeft = [self _annotationsInMapRect:rectLeft];
+        return result;
+    }
 
-        MKMapRect rectRight = MKMapRectMake(
-                                            0,
-                                            rect.origin.y,
-                                            rectMaxX,
-                                            rect.size.height
-                                            );
+    // Clustering may run on a background queue while the main thread searches the tree as well: the tree's scratch serves
+    // one search at a time, concurrent searches get a scratch of their own
+    kp_2dtree_t tree = self.tree;
 
-        NSArray *annotationsRight = [self _annotationsInMapRect:rectRight];
+    if ([_searchScratchLock tryLock]) {
+        kp_2dtree_search_scratch_t treeScratch;
 
-        NSMutableArray *annotationsLeftMinusRight = [annotationsLeft mutableCopy];
-        [annotationsLeftMinusRight removeObjectsInArray:annotationsRight];
+        treeScratch.stack = tree.stack;
+        treeScratch.search_stack_info = tree.search_stack_info;
 
-        NSAssert([annotationsLeftMinusRight isEqualToArray:annotationsLeft], nil);
+        [self enumerateNodesInMapRect:rect searchScratch:&treeScratch usingBlock:block];
 
-        return [annotationsLeft arrayByAddingObjectsFromArray:annotationsRight];
+        [_searchScratchLock unlock];
     } else {
-        normalizedRect.origin.x = rectMinX;
+        kp_2dtree_search_scratch_t searchScratch = kp_2dtree_search_scratch_create(&tree);
+
+        [self enumerateNodesInMapRect:rect searchScratch:&searchScratch usingBlock:block];
+
+        kp_2dtree_search_scratch_free(&searchScratch);
+    }
+
+    return result;
+}
+
+- (void)enumerateNodesInMapRect:(MKMapRect)rect searchScratch:(kp_2dtree_search_scratch_t *)scratch usingBlock:(kp_2dtree_node_visitor_t)block {
+    NSParameterAssert(scratch != NULL);
 
-        NSArray *annotations = [self _annotationsInMapRect:normalizedRect];
-        
-        return annotations;
+    // Rects spanning over international dateline are split into two: left one and right one
+    MKMapRect parts[2];
+    NSUInteger partsCount = MKMapRectDivideAtDateline(rect, parts);
+
+    for (NSUInteger partIdx = 0; partIdx < partsCount; partIdx++) {
+        [self _enumerateNodesInMapRect:parts[partIdx] searchScratch:scratch usingBlock:block];
     }
 }
 
-#pragma mark - Private
+- (const double *)attributeColumnAtIndex:(NSUInteger)reducerIdx {
+    NSParameterAssert(reducerIdx < self.attributeReducers.count);
 
-- (NSArray *)_annotationsInMapRect:(MKMapRect)rect {
-    NSMutableArray *result = [NSMutableArray array];
+    return _attributeColumns + reducerIdx * _tree.size;
+}
 
+- (kp_subtree_bounds_t *)subtreeBounds {
+    @synchronized(self) {
+        if (_subtreeBounds == NULL) {
+            kp_2dtree_t tree = self.tree;
+
+            _subtreeBounds = kp_2dtree_subtree_bounds_create(&tree);
+        }
+
+        return _subtreeBounds;
+    }
+}
+
+#pragma mark - Private
+
+- (void)_enumerateNodesInMapRect:(MKMapRect)rect searchScratch:(kp_2dtree_search_scratch_t *)scratch usingBlock:(kp_2dtree_node_visitor_t)block {
     MKMapPoint minPoint = rect.origin;
     MKMapPoint maxPoint = MKMapPointMake(MKMapRectGetMaxX(rect), MKMapRectGetMaxY(rect));
 
     kp_2dtree_t tree = self.tree;
-    kp_2dtree_search(&tree, result, &minPoint, &maxPoint);
 
-    return result;
+    kp_2dtree_search_nodes_with_scratch(&tree, scratch, &minPoint, &maxPoint, block);
 }
 
 @end
@@ -18,10 +18,32 @@
 
 #import "kp_2dtree.h"
 
-@interface KPAnnotationTree ()
-
-@property (strong, nonatomic, readwrite) NSSet *annotations;
+@interface KPAnnotationTree () {
+    NSArray *_retainedAnnotations; // nodes of the tree do not retain their annotations
+    NSLock *_searchScratchLock;    // held while a search uses the scratch of the tree
+    kp_subtree_bounds_t *_subtreeBounds;
+    double *_attributeColumns;
+}
 
 @property (assign, nonatomic) kp_2dtree_t tree;
 
+// Results memoized by clustering algorithms, e.g. tiles of KPGridClusteringAlgorithm. They are valid for the annotations of this tree only,
+// so they go away with it. Keys are prefixed by the class which stores them; values must be immutable.
+@property (strong, readonly, nonatomic) NSCache *clusteringCache;
+
+// Same as -annotationsInMapRect: but uses given search scratch instead of the one owned by the tree,
+// so that it can be called concurrently from several threads each having its own scratch.
+// NULL scratch means the tree's own scratch, or a temporary one while the tree's scratch is used by another search.
+- (NSArray *)annotationsInMapRect:(MKMapRect)rect searchScratch:(kp_2dtree_search_scratch_t *)scratch;
+
+// Calls block for every tree node whose map point lies inside rect. Use kp_2dtree_node_index() to get the index of node's annotation.
+// Scratch must not be NULL: clustering algorithms create one per pass with kp_2dtree_search_scratch_create() and reuse it for every search.
+- (void)enumerateNodesInMapRect:(MKMapRect)rect searchScratch:(kp_2dtree_search_scratch_t *)scratch usingBlock:(kp_2dtree_node_visitor_t)block;
+
+// Column of values of attributeReducers[reducerIdx] indexed by node index, see -[KPAttributeReducer(Private) columnValueForAnnotation:]
+- (const double *)attributeColumnAtIndex:(NSUInteger)reducerIdx;
+
+// Bounds of every subtree indexed by node index, created on first call and owned by the tree. NULL for empty tree.
+- (kp_subtree_bounds_t *)subtreeBounds;
+
 @end
@@ -0,0 +1,216 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "KPAnnotation.h"
+#import "KPAnnotationAccessors.h"
+
+#import <float.h>
+#import <simd/simd.h>
+
+@class KPAnnotationTree;
+
+/*
+ Statistics of cluster members from which KPAnnotation derives its coordinate, radius and weight.
+ Clustering algorithms accumulate them from the tree arrays (coordinates and weights), so no message is sent to members,
+ and the statistics of two clusters are merged in O(1).
+ Coordinates are kept as {latitude, longitude} vectors, so both degrees are summed, compared and merged in the same SIMD lanes without branches.
+ Sums are compensated (Neumaier): the low-order bits lost by every addition are accumulated separately,
+ so the centroid of a cluster of millions of annotations is as precise as the one of a few.
+ */
+typedef struct {
+    NSUInteger count;
+    double weight;
+    simd_double2 coordinateSum;          // weighted
+    simd_double2 coordinateCompensation; // what coordinateSum has lost to rounding
+    simd_double2 minCoordinate;
+    simd_double2 maxCoordinate;
+} kp_annotation_statistics_t;
+
+static inline simd_double2 KPAnnotationStatisticsVectorForCoordinate(CLLocationCoordinate2D coordinate) {
+    return simd_make_double2(coordinate.latitude, coordinate.longitude);
+}
+
+static inline kp_annotation_statistics_t KPAnnotationStatisticsMake(void) {
+    kp_annotation_statistics_t statistics;
+
+    statistics.count                  = 0;
+    statistics.weight                 = 0;
+    statistics.coordinateSum          = simd_make_double2(0, 0);
+    statistics.coordinateCompensation = simd_make_double2(0, 0);
+    statistics.minCoordinate          = simd_make_double2(DBL_MAX, DBL_MAX);
+    statistics.maxCoordinate          = simd_make_double2(-DBL_MAX, -DBL_MAX);
+
+    return statistics;
+}
+
+// Neumaier step: sum += value, the rounding error of the larger of the two terms' sum goes to compensation
+static inline void KPAnnotationStatisticsCompensatedAdd(simd_double2 *sum, simd_double2 *compensation, simd_double2 value) {
+    simd_double2 newSum = *sum + value;
+
+    simd_long2 sumIsLarger = simd_abs(*sum) >= simd_abs(value);
+
+    simd_double2 larger  = simd_select(value, *sum, sumIsLarger);
+    simd_double2 smaller = simd_select(*sum, value, sumIsLarger);
+
+    *compensation += (larger - newSum) + smaller;
+    *sum = newSum;
+}
+
+static inline void KPAnnotationStatisticsAddCoordinate(kp_annotation_statistics_t *statistics, CLLocationCoordinate2D coordinate, double weight) {
+    simd_double2 vector = KPAnnotationStatisticsVectorForCoordinate(coordinate);
+
+    statistics->count++;
+    statistics->weight += weight;
+
+    KPAnnotationStatisticsCompensatedAdd(&statistics->coordinateSum, &statistics->coordinateCompensation, weight * vector);
+
+    statistics->minCoordinate = simd_min(statistics->minCoordinate, vector);
+    statistics->maxCoordinate = simd_max(statistics->maxCoordinate, vector);
+}
+
+/*
+ Statistics kernel: accumulates coordinates[indexes[i]] weighted by weights[indexes[i]] for i < count,
+ i.e. the members of a cluster given by node indexes, read from the tree arrays.
+ Two independent sets of accumulators are used for even and odd members, so consecutive iterations do not wait for each other,
+ they are merged once at the end.
+ */
+static inline void KPAnnotationStatisticsAddCoordinatesAtIndexes(kp_annotation_statistics_t *statistics,
+                                                                 const CLLocationCoordinate2D *coordinates,
+                                                                 const double *weights,
+                                                                 const NSUInteger *indexes,
+                                                                 NSUInteger count) {
+    simd_double2 sums[2]          = { statistics->coordinateSum, simd_make_double2(0, 0) };
+    simd_double2 compensations[2] = { statistics->coordinateCompensation, simd_make_double2(0, 0) };
+    simd_double2 minimums[2]      = { statistics->minCoordinate, statistics->minCoordinate };
+    simd_double2 maximums[2]      = { statistics->maxCoordinate, statistics->maxCoordinate };
+    double weightSums[2]          = { statistics->weight, 0 };
+
+    NSUInteger pairsEnd = count & ~(NSUInteger)1;
+
+    for (NSUInteger i = 0; i < pairsEnd; i += 2) {
+        for (NSUInteger lane = 0; lane < 2; lane++) {
+            NSUInteger idx = indexes[i + lane];
+
+            simd_double2 vector = KPAnnotationStatisticsVectorForCoordinate(coordinates[idx]);
+
+            weightSums[lane] += weights[idx];
+
+            KPAnnotationStatisticsCompensatedAdd(sums + lane, compensations + lane, weights[idx] * vector);
+
+            minimums[lane] = simd_min(minimums[lane], vector);
+            maximums[lane] = simd_max(maximums[lane], vector);
+        }
+    }
+
+    if (pairsEnd < count) {
+        NSUInteger idx = indexes[pairsEnd];
+
+        simd_double2 vector = KPAnnotationStatisticsVectorForCoordinate(coordinates[idx]);
+
+        weightSums[0] += weights[idx];
+
+        KPAnnotationStatisticsCompensatedAdd(sums, compensations, weights[idx] * vector);
+
+        minimums[0] = simd_min(minimums[0], vector);
+        maximums[0] = simd_max(maximums[0], vector);
+    }
+
+    KPAnnotationStatisticsCompensatedAdd(sums, compensations, sums[1]);
+
+    statistics->count                 += count;
+    statistics->weight                 = weightSums[0] + weightSums[1];
+    statistics->coordinateSum          = sums[0];
+    statistics->coordinateCompensation = compensations[0] + compensations[1];
+    statistics->minCoordinate          = simd_min(minimums[0], minimums[1]);
+    statistics->maxCoordinate          = simd_max(maximums[0], maximums[1]);
+}
+
+static inline kp_annotation_statistics_t KPAnnotationStatisticsUnion(kp_annotation_statistics_t *statistics, kp_annotation_statistics_t *anotherStatistics) {
+    kp_annotation_statistics_t unionStatistics;
+
+    unionStatistics.count                  = statistics->count  + anotherStatistics->count;
+    unionStatistics.weight                 = statistics->weight + anotherStatistics->weight;
+    unionStatistics.coordinateSum          = statistics->coordinateSum;
+    unionStatistics.coordinateCompensation = statistics->coordinateCompensation + anotherStatistics->coordinateCompensation;
+
+    KPAnnotationStatisticsCompensatedAdd(&unionStatistics.coordinateSum, &unionStatistics.coordinateCompensation, anotherStatistics->coordinateSum);
+
+    unionStatistics.minCoordinate = simd_min(statistics->minCoordinate, anotherStatistics->minCoordinate);
+    unionStatistics.maxCoordinate = simd_max(statistics->maxCoordinate, anotherStatistics->maxCoordinate);
+
+    return unionStatistics;
+}
+
+// Weighted mean of member coordinates
+static inline CLLocationCoordinate2D KPAnnotationStatisticsGetCentroid(kp_annotation_statistics_t *statistics) {
+    simd_double2 centroid = (statistics->coordinateSum + statistics->coordinateCompensation) / statistics->weight;
+
+    return CLLocationCoordinate2DMake(centroid.x, centroid.y);
+}
+
+static inline CLLocationCoordinate2D KPAnnotationStatisticsGetMinCoordinate(kp_annotation_statistics_t *statistics) {
+    return CLLocationCoordinate2DMake(statistics->minCoordinate.x, statistics->minCoordinate.y);
+}
+
+static inline CLLocationCoordinate2D KPAnnotationStatisticsGetMaxCoordinate(kp_annotation_statistics_t *statistics) {
+    return CLLocationCoordinate2DMake(statistics->maxCoordinate.x, statistics->maxCoordinate.y);
+}
+
+@interface KPAnnotation ()
+
+@property (assign, readonly, nonatomic) kp_annotation_statistics_t statistics;
+
+@property (assign, readwrite, nonatomic) NSUInteger clusteringCategory;
+
+// Tree whose annotations are the members of a cluster built from node indexes, nil for a cluster built from a set
+@property (strong, readonly, nonatomic) KPAnnotationTree *annotationTree;
+
+// Node indexes of the members in annotationTree, statistics.count of them; NULL for a cluster built from a set
+@property (assign, readonly, nonatomic) const NSUInteger *nodeIndexes;
+
+// Designated initializer used by clustering algorithms: statistics must be the ones of the annotations in set.
+- (id)initWithAnnotationSet:(NSSet *)set statistics:(kp_annotation_statistics_t)statistics;
+
+/*
+ Cluster whose members are given by node indexes into annotationTree, which the cluster retains: indexes are copied,
+ annotations are neither retained nor hashed until -annotations is first called, when the set is materialised once.
+ statistics must be the ones of the indexed annotations.
+ */
+- (id)initWithAnnotationTree:(KPAnnotationTree *)annotationTree
+                 nodeIndexes:(const NSUInteger *)nodeIndexes
+                  statistics:(kp_annotation_statistics_t)statistics;
+
+// Same as above with values of the attribute reducers of annotationTree already reduced, e.g. combined from merged clusters.
+// NULL reducedValues means they are reduced from the columns of the tree.
+- (id)initWithAnnotationTree:(KPAnnotationTree *)annotationTree
+                 nodeIndexes:(const NSUInteger *)nodeIndexes
+                  statistics:(kp_annotation_statistics_t)statistics
+               reducedValues:(const double *)reducedValues;
+
+// Values of annotationTree.attributeReducers in their order, NULL when the cluster is not built from node indexes
+@property (assign, readonly, nonatomic) const double *reducedValues;
+
+// Any member annotation, does not materialise the annotations set
+- (id <MKAnnotation>)anyAnnotation;
+
+// New cluster of the same class, members, statistics and reduced values, at the centroid of its members.
+// Clusters on the map are moved by animations and configured by delegates, so clusters kept for later refreshes are handed out as copies.
+- (instancetype)clusterCopy;
+
+// Same as [self.annotations isEqualToSet:annotation.annotations] but compares node indexes when both clusters index the same tree
+- (BOOL)hasSameAnnotationsAsAnnotation:(KPAnnotation *)annotation;
+
+@end
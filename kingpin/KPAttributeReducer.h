@@ -0,0 +1,45 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <MapKit/MKAnnotation.h>
+
+typedef NS_ENUM(NSInteger, KPAttributeReducerOperation) {
+    KPAttributeReducerOperationSum = 0,
+    KPAttributeReducerOperationMinimum,
+    KPAttributeReducerOperationMaximum,
+    // Number of annotations whose value is not 0, e.g. the value block returns a BOOL
+    KPAttributeReducerOperationCountIf,
+};
+
+typedef double (^KPAttributeReducerValueBlock)(id <MKAnnotation> annotation);
+
+/**
+ Numeric attribute of annotations reduced over the annotations of every cluster, e.g. the sum of available units or the maximum severity.
+ Reducers are registered on the annotation tree (see KPClusteringController.attributeReducers): value block is called once per annotation
+ when the tree is built and the values are stored in a column of the tree. Clustering algorithms reduce the column over the members
+ of every cluster they produce, and merged clusters combine the values of their parts, so reading a reduced value does not walk the annotations.
+ See -[KPAnnotation reducedValueForAttributeNamed:].
+ */
+@interface KPAttributeReducer : NSObject
+
+@property (copy, readonly, nonatomic) NSString *name;
+@property (assign, readonly, nonatomic) KPAttributeReducerOperation operation;
+@property (copy, readonly, nonatomic) KPAttributeReducerValueBlock valueBlock;
+
+- (id)initWithName:(NSString *)name operation:(KPAttributeReducerOperation)operation valueBlock:(KPAttributeReducerValueBlock)valueBlock;
+
+@end
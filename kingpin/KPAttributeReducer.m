@@ -0,0 +1,53 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "KPAttributeReducer.h"
+#import "KPAttributeReducer_Private.h"
+
+@implementation KPAttributeReducer
+
+- (id)initWithName:(NSString *)name operation:(KPAttributeReducerOperation)operation valueBlock:(KPAttributeReducerValueBlock)valueBlock {
+    self = [super init];
+
+    if (self == nil) {
+        return nil;
+    }
+
+    NSParameterAssert(name);
+    NSParameterAssert(valueBlock);
+
+    _name = [name copy];
+    _operation = operation;
+    _valueBlock = [valueBlock copy];
+
+    return self;
+}
+
+- (double)columnValueForAnnotation:(id <MKAnnotation>)annotation {
+    double value = self.valueBlock(annotation);
+
+    if (self.operation == KPAttributeReducerOperationCountIf) {
+        return value != 0 ? 1 : 0;
+    }
+
+    return value;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %p; name = %@; operation = %ld>", NSStringFromClass(self.class), self, self.name, (long)self.operation];
+}
+
+@end
@@ -0,0 +1,54 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "KPAttributeReducer.h"
+
+#import <float.h>
+
+// Value a reduction starts from: reducing it with any value gives that value
+static inline double KPAttributeReducerOperationGetIdentity(KPAttributeReducerOperation operation) {
+    switch (operation) {
+        case KPAttributeReducerOperationMinimum:
+            return DBL_MAX;
+
+        case KPAttributeReducerOperationMaximum:
+            return -DBL_MAX;
+
+        default:
+            return 0;
+    }
+}
+
+// Count-if columns hold 1 or 0, so they are reduced as sums
+static inline double KPAttributeReducerOperationReduce(KPAttributeReducerOperation operation, double value, double anotherValue) {
+    switch (operation) {
+        case KPAttributeReducerOperationMinimum:
+            return MIN(value, anotherValue);
+
+        case KPAttributeReducerOperationMaximum:
+            return MAX(value, anotherValue);
+
+        default:
+            return value + anotherValue;
+    }
+}
+
+@interface KPAttributeReducer (Private)
+
+// Value stored in the column of the tree: the value of valueBlock, or 1 / 0 for count-if
+- (double)columnValueForAnnotation:(id <MKAnnotation>)annotation;
+
+@end
@@ -0,0 +1,37 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ Clusters shared by clustering controllers showing the same annotations, e.g. the map, the mini-map and the split view of an app.
+ Controllers sharing an annotation tree (see KPClusteringController.annotationTree) and a cluster cache (see KPClusteringController.clusterCache)
+ share the clusters of the viewports they have in common. Clusters are cached per annotation tree, per clustering algorithm object,
+ per its settings (see -[KPClusteringAlgorithm clusteringConfigurationKey], e.g. cell size) and per quantized viewport
+ (zoom level, center and map view size): changing a setting of the algorithm does not bring back clusters of the old settings. Only the cluster data (members, statistics and reduced values) is shared:
+ every controller gets annotations of its own, which its animations and its delegate are free to change. The clusters of a tree are dropped when the last controller using the tree moves to another one.
+ The cache is safe to use from several threads.
+ */
+@interface KPClusterCache : NSObject
+
+/// Number of viewports cached per annotation tree and clustering algorithm, default is 16
+@property (assign, atomic) NSUInteger countLimit;
+
+- (id)initWithCountLimit:(NSUInteger)countLimit;
+
+- (void)removeAllClusters;
+
+@end
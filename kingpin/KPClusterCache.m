@@ -0,0 +1,164 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "KPClusterCache.h"
+#import "KPClusterCache_Private.h"
+
+#import "KPAnnotation_Private.h"
+#import "NSArray+KP.h"
+
+// Cached clusters are never handed out: controllers show and change copies of them
+static inline NSArray *KPClusterCacheCopyClusters(NSArray *clusters) {
+    return [clusters kp_map:^id(KPAnnotation *cluster) {
+        return [cluster clusterCopy];
+    }];
+}
+
+// Clusters of a single annotation tree and the number of controllers using the tree
+@interface KPClusterCacheTreeEntry : NSObject
+@property (assign, nonatomic) NSUInteger usersCount;
+@property (strong, nonatomic) NSMapTable *cachesByClusteringAlgorithm; // weak algorithm -> NSCache of viewport key -> cached clusters
+@end
+
+@implementation KPClusterCacheTreeEntry
+@end
+
+@interface KPClusterCache ()
+@property (strong, nonatomic) NSMapTable *entriesByAnnotationTree; // annotation tree (by pointer) -> KPClusterCacheTreeEntry
+@end
+
+@implementation KPClusterCache
+
+- (id)init {
+    return [self initWithCountLimit:16];
+}
+
+- (id)initWithCountLimit:(NSUInteger)countLimit {
+    self = [super init];
+
+    if (self == nil) {
+        return nil;
+    }
+
+    _countLimit = countLimit;
+    _entriesByAnnotationTree = [NSMapTable mapTableWithKeyOptions:(NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality)
+                                                     valueOptions:NSPointerFunctionsStrongMemory];
+
+    return self;
+}
+
+- (void)removeAllClusters {
+    @synchronized(self) {
+        for (KPAnnotationTree *annotationTree in self.entriesByAnnotationTree) {
+            [[self.entriesByAnnotationTree objectForKey:annotationTree].cachesByClusteringAlgorithm removeAllObjects];
+        }
+    }
+}
+
+- (void)retainAnnotationTree:(KPAnnotationTree *)annotationTree {
+    if (annotationTree == nil) {
+        return;
+    }
+
+    @synchronized(self) {
+        KPClusterCacheTreeEntry *entry = [self.entriesByAnnotationTree objectForKey:annotationTree];
+
+        if (entry == nil) {
+            entry = [KPClusterCacheTreeEntry new];
+            entry.cachesByClusteringAlgorithm = [NSMapTable mapTableWithKeyOptions:(NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality)
+                                                                      valueOptions:NSPointerFunctionsStrongMemory];
+
+            [self.entriesByAnnotationTree setObject:entry forKey:annotationTree];
+        }
+
+        entry.usersCount++;
+    }
+}
+
+- (void)releaseAnnotationTree:(KPAnnotationTree *)annotationTree {
+    if (annotationTree == nil) {
+        return;
+    }
+
+    @synchronized(self) {
+        KPClusterCacheTreeEntry *entry = [self.entriesByAnnotationTree objectForKey:annotationTree];
+
+        if (entry && --entry.usersCount == 0) {
+            [self.entriesByAnnotationTree removeObjectForKey:annotationTree];
+        }
+    }
+}
+
+- (NSArray *)_cachedClustersForAnnotationTree:(KPAnnotationTree *)annotationTree
+                           clusteringAlgorithm:(id <KPClusteringAlgorithm>)clusteringAlgorithm
+                                   viewportKey:(NSString *)viewportKey
+{
+    @synchronized(self) {
+        KPClusterCacheTreeEntry *entry = [self.entriesByAnnotationTree objectForKey:annotationTree];
+
+        return [[entry.cachesByClusteringAlgorithm objectForKey:clusteringAlgorithm] objectForKey:viewportKey];
+    }
+}
+
+- (NSArray *)clustersForAnnotationTree:(KPAnnotationTree *)annotationTree
+                   clusteringAlgorithm:(id <KPClusteringAlgorithm>)clusteringAlgorithm
+                           viewportKey:(NSString *)viewportKey
+{
+    NSArray *cachedClusters = [self _cachedClustersForAnnotationTree:annotationTree clusteringAlgorithm:clusteringAlgorithm viewportKey:viewportKey];
+
+    if (cachedClusters == nil) {
+        return nil;
+    }
+
+    return KPClusterCacheCopyClusters(cachedClusters);
+}
+
+- (BOOL)hasClustersForAnnotationTree:(KPAnnotationTree *)annotationTree
+                 clusteringAlgorithm:(id <KPClusteringAlgorithm>)clusteringAlgorithm
+                         viewportKey:(NSString *)viewportKey
+{
+    return [self _cachedClustersForAnnotationTree:annotationTree clusteringAlgorithm:clusteringAlgorithm viewportKey:viewportKey] != nil;
+}
+
+- (void)setClusters:(NSArray *)clusters
+  forAnnotationTree:(KPAnnotationTree *)annotationTree
+clusteringAlgorithm:(id <KPClusteringAlgorithm>)clusteringAlgorithm
+        viewportKey:(NSString *)viewportKey
+{
+    NSArray *cachedClusters = KPClusterCacheCopyClusters(clusters);
+
+    @synchronized(self) {
+        KPClusterCacheTreeEntry *entry = [self.entriesByAnnotationTree objectForKey:annotationTree];
+
+        if (entry == nil) {
+            return;
+        }
+
+        NSCache *cache = [entry.cachesByClusteringAlgorithm objectForKey:clusteringAlgorithm];
+
+        if (cache == nil) {
+            cache = [[NSCache alloc] init];
+
+            [entry.cachesByClusteringAlgorithm setObject:cache forKey:clusteringAlgorithm];
+        }
+
+        cache.countLimit = self.countLimit;
+
+        [cache setObject:cachedClusters forKey:viewportKey];
+    }
+}
+
+@end
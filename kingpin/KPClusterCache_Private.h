@@ -0,0 +1,45 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "KPClusterCache.h"
+
+#import "KPAnnotationTree.h"
+#import "KPClusteringAlgorithm.h"
+
+@interface KPClusterCache (Private)
+
+// Every controller retains the tree it shows and releases it when it moves to another one or goes away:
+// clusters of a tree are kept only while it is retained, so a cache does not keep trees nobody shows alive.
+- (void)retainAnnotationTree:(KPAnnotationTree *)annotationTree;
+- (void)releaseAnnotationTree:(KPAnnotationTree *)annotationTree;
+
+// New clusters built from the cached ones, nil if the viewport is not cached
+- (NSArray *)clustersForAnnotationTree:(KPAnnotationTree *)annotationTree
+                   clusteringAlgorithm:(id <KPClusteringAlgorithm>)clusteringAlgorithm
+                           viewportKey:(NSString *)viewportKey;
+
+- (BOOL)hasClustersForAnnotationTree:(KPAnnotationTree *)annotationTree
+                 clusteringAlgorithm:(id <KPClusteringAlgorithm>)clusteringAlgorithm
+                         viewportKey:(NSString *)viewportKey;
+
+// The cache keeps copies of the clusters, so callers may put them on the map and change them afterwards.
+// Ignored for trees which are not retained (anymore), e.g. when a background job finishes after annotations have changed
+- (void)setClusters:(NSArray *)clusters
+  forAnnotationTree:(KPAnnotationTree *)annotationTree
+clusteringAlgorithm:(id <KPClusteringAlgorithm>)clusteringAlgorithm
+        viewportKey:(NSString *)viewportKey;
+
+@end
@@ -25,4 +25,23 @@
                            parentMapView:(MKMapView *)mapView
                           annotationTree:(KPAnnotationTree *)annotationTree;
 
+@optional
+
+/**
+ Same as -clusterAnnotationsInMapRect:parentMapView:annotationTree: for a map view showing visibleMapRect in a view of mapViewSize.
+ It does not touch the map view, so it can be called off the main thread:
+ KPClusteringController clusters asynchronously (see asynchronousClustering) only with algorithms implementing it.
+ */
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                          visibleMapRect:(MKMapRect)visibleMapRect
+                             mapViewSize:(CGSize)mapViewSize
+                          annotationTree:(KPAnnotationTree *)annotationTree;
+
+/**
+ String identifying the settings clusters depend on, e.g. cell size and strategy: equal keys must give equal clusters for the same viewport.
+ KPClusteringController caches clusters per viewport and per this key, so clusters computed before a setting changed are not reused.
+ Algorithms which do not implement it must not change their settings once they cluster for a controller with quantizesViewports enabled.
+ */
+- (NSString *)clusteringConfigurationKey;
+
 @end
@@ -19,6 +19,8 @@
 #import "KPClusteringAlgorithm.h"
 
 @class KPAnnotation;
+@class KPAnnotationTree;
+@class KPClusterCache;
 
 @protocol KPClusteringControllerDelegate;
 
@@ -36,10 +38,71 @@
 
 @property (weak, nonatomic) id <KPClusteringControllerDelegate> delegate;
 
+/// Cluster on a background queue and only apply results on the main thread. Every refresh snapshots the viewport and gets a new generation:
+/// a refresh overtaken by a newer one before its clustering starts is skipped, and its result is dropped if it is overtaken while clustering,
+/// so only the latest viewport is applied and fast flicks do not queue up clustering work. Defaults to NO.
+/// Requires the clustering algorithm to implement -clusterAnnotationsInMapRect:visibleMapRect:mapViewSize:annotationTree:, other algorithms still cluster on the main thread.
+@property (assign, nonatomic) BOOL asynchronousClustering;
+
+/// Apply non-animated refreshes in batches across several run loop turns instead of a single -addAnnotations: call,
+/// spending at most incrementalUpdateFrameBudget per turn: clusters inside the visible rect go first, ordered outward from its center,
+/// the clusters of the margin follow. -clusteringControllerDidUpdateVisibleMapAnnotations: is called when the last batch lands. Defaults to NO.
+@property (assign, nonatomic) BOOL incrementalUpdates;
+
+/// Time spent adding and removing annotations per run loop turn when incrementalUpdates is enabled, default is 0.004 seconds
+@property (assign, nonatomic) NSTimeInterval incrementalUpdateFrameBudget;
+
+/// Coalesce calls to -refresh: and -refresh:force: arriving back to back (e.g. from both -mapView:regionWillChangeAnimated: and
+/// -mapView:regionDidChangeAnimated:) into a single refresh run on a later run loop turn, at most once per refreshCoalescingInterval.
+/// The coalesced refresh is animated or forced if any of the calls asked for it. Defaults to NO: every call refreshes right away.
+@property (assign, nonatomic) BOOL coalescesRefreshes;
+
+/// Minimal time between two coalesced refreshes, default is one display frame (1/60 s).
+/// Longer intervals fold more requests into one refresh at the cost of a later update.
+@property (assign, nonatomic) NSTimeInterval refreshCoalescingInterval;
+
+/// Cluster the viewports one zoom level in and out of the current one in the background once a refresh is applied, and cache them,
+/// so zooming to a prefetched level is applied without clustering. Viewports are quantized to make this possible: every refresh clusters
+/// the viewport of the nearest power-of-two zoom level with the center snapped to 1/8 of the visible width. Defaults to NO.
+/// Requires the clustering algorithm to implement -clusterAnnotationsInMapRect:visibleMapRect:mapViewSize:annotationTree:.
+@property (assign, nonatomic) BOOL prefetchesAdjacentZoomLevels;
+
+/// Also prefetch the viewport one more pan step in the direction of the last pan, default is NO
+@property (assign, nonatomic) BOOL prefetchesPanDirection;
+
+/// Number of cached viewports, default is 16. The cache is emptied when annotations change.
+@property (assign, nonatomic) NSUInteger prefetchCacheCountLimit;
+
+/// Cache of clustered viewports shared with other controllers, e.g. the ones of a mini-map showing the same annotationTree.
+/// When it is set, viewports are quantized and cached as with prefetching, even if prefetching is disabled.
+/// Defaults to nil: the controller uses a cache of its own for prefetching.
+@property (strong, nonatomic) KPClusterCache *clusterCache;
+
+/// Refreshes which found their viewport in the prefetch cache and the ones which had to cluster it, and the share of the former
+@property (readonly, nonatomic) NSUInteger prefetchHitCount;
+@property (readonly, nonatomic) NSUInteger prefetchMissCount;
+@property (readonly, nonatomic) double prefetchHitRatio;
+
+/// Cluster a margin around the visible rect which adapts to the pan instead of a fixed margin of a full visible width and height on every side
+/// (9 times the visible area): idleClusteringMargin on every side, growing up to a full visible size on the sides the map is panned to,
+/// with the pan velocity. The map is refreshed as soon as the visible rect leaves the clustered area. Ignored when prefetching. Defaults to NO.
+@property (assign, nonatomic) BOOL adaptiveClusteringMargin;
+
+/// Margin on every side of the visible rect when the map is not panned, a fraction of visible width and height from 0 to 1, default is 0.25
+@property (assign, nonatomic) CGFloat idleClusteringMargin;
+
+/// KPAttributeReducers registered on the annotation tree built by -setAnnotations:, set them before setting annotations.
+/// Clusters expose their values with -[KPAnnotation reducedValueForAttributeNamed:].
+@property (copy, nonatomic) NSArray *attributeReducers;
+
 - (id)initWithMapView:(MKMapView *)mapView;
 - (id)initWithMapView:(MKMapView *)mapView clusteringAlgorithm:(id<KPClusteringAlgorithm>)algorithm;
 - (void)setAnnotations:(NSArray *)annoations;
 
+/// Annotation tree built by -setAnnotations:. The tree is immutable, so a tree built once can be set on several controllers
+/// showing the same annotations instead of building one per controller; setting it refreshes the map the same way -setAnnotations: does.
+@property (strong, nonatomic) KPAnnotationTree *annotationTree;
+
 /**
  *  Refreshes the map annotations. This will check if the map is visible and if the viewport has changed
  *
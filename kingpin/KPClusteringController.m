@@ -19,8 +19,13 @@
 #import "KPClusteringController.h"
 
 #import "KPAnnotation.h"
+#import "KPAnnotation_Private.h"
 #import "KPAnnotationTree.h"
+#import "KPAnnotationTree_Private.h"
+#import "KPClusterCache.h"
+#import "KPClusterCache_Private.h"
 #import "KPGridClusteringAlgorithm.h"
+#import "KPGeometry.h"
 
 #import "NSArray+KP.h"
 
@@ -30,22 +35,94 @@ typedef NS_ENUM(NSInteger, KPClusteringControllerMapViewportChangeState) {
     KPClusteringControllerMapViewportZoom
 };
 
+// Prefetching viewports: center is snapped to 1/KPClusteringControllerPrefetchCenterSteps of visible width, zoom levels beyond the last are not prefetched
+static const double KPClusteringControllerPrefetchCenterSteps = 8;
+static const NSInteger KPClusteringControllerPrefetchMaximumZoomLevel = 21;
+
+// Adaptive clustering margin: seconds of pan covered by the leading margin, the shortest interval velocity is measured over,
+// and the zoom change (in zoom levels) up to which two viewports are compared as a pan
+static const double KPClusteringControllerMarginLookahead = 0.5;
+static const double KPClusteringControllerMarginMinimalInterval = 1.0 / 60;
+static const double KPClusteringControllerMarginZoomTolerance = 0.01;
+
+static inline MKMapRect KPClusteringMapRectForVisibleMapRect(MKMapRect visibleMapRect) {
+    return MKMapRectInset(visibleMapRect, -visibleMapRect.size.width, -visibleMapRect.size.height);
+}
+
+// Number of clusters added or removed by one call to the map view when changes are applied incrementally
+static const NSUInteger KPClusteringControllerIncrementalUpdateBatchSize = 16;
+
+// Addition or removal of a cluster, see -_updateVisibleMapAnnotationsIncrementallyAddingClusters:removingClusters:
+typedef struct {
+    BOOL outsideVisibleMapRect;
+    double distanceSquared; // to the center of visible rect
+    NSUInteger index;       // into removed clusters followed by added clusters
+} kp_cluster_change_t;
+
+static int KPClusterChangeCompare(const void *a, const void *b) {
+    const kp_cluster_change_t *changeA = a;
+    const kp_cluster_change_t *changeB = b;
+
+    if (changeA->outsideVisibleMapRect != changeB->outsideVisibleMapRect) {
+        return changeA->outsideVisibleMapRect ? 1 : -1;
+    }
+
+    if (changeA->distanceSquared != changeB->distanceSquared) {
+        return changeA->distanceSquared < changeB->distanceSquared ? -1 : 1;
+    }
+
+    return changeA->index < changeB->index ? -1 : (changeA->index > changeB->index ? 1 : 0);
+}
+
 
 @interface KPClusteringController()
 
 @property (strong, nonatomic) MKMapView *mapView;
-@property (strong, nonatomic) KPAnnotationTree *annotationTree;
 @property (strong, nonatomic) id <KPClusteringAlgorithm> clusteringAlgorithm;
 
-@property (readonly, nonatomic) NSArray *currentAnnotations;
+// Clusters this controller has put on the map, updated together with every addition and removal
+@property (strong, nonatomic) NSMutableSet *displayedClusters;
 
-@property (readonly, nonatomic) MKMapRect clusteringMapRectForVisibleMapRect;
+// Adaptive clustering margin: the last clustered viewport, when it was clustered and the clustering rect around it
+@property (assign, nonatomic) MKMapRect lastClusteringVisibleMapRect;
+@property (assign, nonatomic) CFAbsoluteTime lastClusteringTime;
+@property (assign, nonatomic) MKMapRect lastClusteringMapRect;
 @property (assign, nonatomic)   MKMapRect lastRefreshedMapRect;
 
 @property (assign, nonatomic) MKCoordinateRegion lastRefreshedMapRegion;
 @property (assign, readonly, nonatomic) KPClusteringControllerMapViewportChangeState mapViewportChangeState;
 
+// Asynchronous clustering: jobs run one by one on the serial queue, generation is bumped on the main thread by every update
+@property (strong, nonatomic) dispatch_queue_t clusteringQueue;
+@property (assign, atomic) NSUInteger clusteringGeneration;
+
+// Prefetching: clusters of quantized viewports, replaced when annotations change
+@property (strong, nonatomic) KPClusterCache *privateClusterCache; // used unless clusterCache is set
+@property (readonly, nonatomic) KPClusterCache *activeClusterCache;
+@property (readonly, nonatomic) BOOL quantizesViewports;
+@property (assign, nonatomic) NSUInteger prefetchHitCount;
+@property (assign, nonatomic) NSUInteger prefetchMissCount;
+@property (assign, nonatomic) NSInteger lastPrefetchZoomLevel;
+@property (assign, nonatomic) MKMapPoint lastPrefetchCenter;
+
+// Refresh coalescing: flags of the requests folded into the pending refresh
+@property (assign, nonatomic) BOOL refreshPending;
+@property (assign, nonatomic) BOOL pendingRefreshAnimated;
+@property (assign, nonatomic) BOOL pendingRefreshForced;
+@property (assign, nonatomic) CFAbsoluteTime lastCoalescedRefreshTime;
+
+- (void)scheduleRefresh:(BOOL)animated force:(BOOL)force;
+- (void)performRefresh:(BOOL)animated force:(BOOL)force;
 - (void)updateVisibleMapAnnotationsOnMapView:(BOOL)animated;
+- (void)diffClusters:(NSArray *)newClusters
+     againstClusters:(NSArray *)oldClusters
+       addedClusters:(NSArray **)addedClusters
+     removedClusters:(NSArray **)removedClusters;
+- (void)matchClusters:(NSArray *)newClusters
+         withClusters:(NSArray *)oldClusters
+         splitSources:(NSUInteger *)splitSources
+   firstMergedSources:(NSUInteger *)firstMergedSources
+    nextMergedSources:(NSUInteger *)nextMergedSources;
 - (void)animateCluster:(KPAnnotation *)cluster
          fromAnnotation:(KPAnnotation *)fromAnnotation
            toAnnotation:(KPAnnotation *)toAnnotation
@@ -79,6 +156,11 @@ typedef NS_ENUM(NSInteger, KPClusteringControllerMapViewportChangeState) {
 
     self.animationDuration = 0.5f;
     self.minimalZoomChange = 0.1f;
+    self.incrementalUpdateFrameBudget = 0.004;
+    self.refreshCoalescingInterval = 1.0 / 60;
+    self.idleClusteringMargin = 0.25;
+    self.lastClusteringVisibleMapRect = MKMapRectNull;
+    self.lastClusteringMapRect = MKMapRectNull;
 
 #if TARGET_OS_IPHONE
     self.animationOptions = UIViewAnimationOptionCurveEaseOut;
@@ -86,24 +168,64 @@ typedef NS_ENUM(NSInteger, KPClusteringControllerMapViewportChangeState) {
 
     self.clusteringAlgorithm = algorithm;
 
+    self.clusteringQueue = dispatch_queue_create("kingpin.clustering", DISPATCH_QUEUE_SERIAL);
+
+    self.displayedClusters = [NSMutableSet set];
+
+    self.privateClusterCache = [[KPClusterCache alloc] initWithCountLimit:16];
+    self.lastPrefetchZoomLevel = NSNotFound;
+
     return self;
 }
 
-- (NSArray *)currentAnnotations {
-    return [self.mapView.annotations kp_filter:^BOOL(id annotation) {
-        if ([annotation isKindOfClass:[KPAnnotation class]]) {
-            return ([self.annotationTree.annotations containsObject:[[(KPAnnotation*)annotation annotations] anyObject]]);
-        }
-        else {
-            return NO;
-        }
-    }];
+- (void)dealloc {
+    [self.activeClusterCache releaseAnnotationTree:_annotationTree];
+}
+
+- (BOOL)quantizesViewports {
+    return self.prefetchesAdjacentZoomLevels || self.clusterCache != nil;
+}
+
+- (KPClusterCache *)activeClusterCache {
+    return self.clusterCache ?: self.privateClusterCache;
+}
+
+- (void)setClusterCache:(KPClusterCache *)clusterCache {
+    [self.activeClusterCache releaseAnnotationTree:self.annotationTree];
+
+    _clusterCache = clusterCache;
+
+    [self.activeClusterCache retainAnnotationTree:self.annotationTree];
+}
+
+- (NSUInteger)prefetchCacheCountLimit {
+    return self.privateClusterCache.countLimit;
+}
+
+- (void)setPrefetchCacheCountLimit:(NSUInteger)prefetchCacheCountLimit {
+    self.privateClusterCache.countLimit = prefetchCacheCountLimit;
+}
+
+- (double)prefetchHitRatio {
+    NSUInteger lookupsCount = self.prefetchHitCount + self.prefetchMissCount;
+
+    return lookupsCount > 0 ? (double)self.prefetchHitCount / lookupsCount : 0;
 }
 
 - (void)setAnnotations:(NSArray *)annotations {
-    [self.mapView removeAnnotations:self.currentAnnotations];
+    self.annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations attributeReducers:self.attributeReducers];
+}
+
+- (void)setAnnotationTree:(KPAnnotationTree *)annotationTree {
+    [self.mapView removeAnnotations:self.displayedClusters.allObjects];
+    [self.displayedClusters removeAllObjects];
 
-    self.annotationTree = [[KPAnnotationTree alloc] initWithAnnotations:annotations];
+    [self.activeClusterCache releaseAnnotationTree:_annotationTree];
+    [self.activeClusterCache retainAnnotationTree:annotationTree];
+
+    _annotationTree = annotationTree;
+
+    self.lastPrefetchZoomLevel = NSNotFound;
 
     [self updateVisibleMapAnnotationsOnMapView:NO];
 }
@@ -114,6 +236,54 @@ typedef NS_ENUM(NSInteger, KPClusteringControllerMapViewportChangeState) {
 
 
 -(void)refresh:(BOOL)animated force:(BOOL)force {
+    if (self.coalescesRefreshes) {
+        [self scheduleRefresh:animated force:force];
+
+        return;
+    }
+
+    [self performRefresh:animated force:force];
+}
+
+/*
+ Coalesced refreshes: requests are folded into a single pending refresh (animated or forced if any of them asked for it)
+ which runs on a later run loop turn, at most once per refreshCoalescingInterval.
+ The visibility and viewport checks run once for the whole batch, when the refresh runs.
+ */
+- (void)scheduleRefresh:(BOOL)animated force:(BOOL)force {
+    self.pendingRefreshAnimated = self.pendingRefreshAnimated || animated;
+    self.pendingRefreshForced = self.pendingRefreshForced || force;
+
+    if (self.refreshPending) {
+        return;
+    }
+
+    self.refreshPending = YES;
+
+    CFAbsoluteTime delay = MAX(0, self.lastCoalescedRefreshTime + self.refreshCoalescingInterval - CFAbsoluteTimeGetCurrent());
+
+    __weak KPClusteringController *weakSelf = self;
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        KPClusteringController *strongSelf = weakSelf;
+
+        if (strongSelf == nil || strongSelf.refreshPending == NO) {
+            return;
+        }
+
+        BOOL animated = strongSelf.pendingRefreshAnimated;
+        BOOL force = strongSelf.pendingRefreshForced;
+
+        strongSelf.refreshPending = NO;
+        strongSelf.pendingRefreshAnimated = NO;
+        strongSelf.pendingRefreshForced = NO;
+        strongSelf.lastCoalescedRefreshTime = CFAbsoluteTimeGetCurrent();
+
+        [strongSelf performRefresh:animated force:force];
+    });
+}
+
+- (void)performRefresh:(BOOL)animated force:(BOOL)force {
     // Check if map is visible
     if (self.mapView.visibleMapRect.size.width  == 0 ||
         self.mapView.visibleMapRect.size.height == 0) {
@@ -155,6 +325,13 @@ typedef NS_ENUM(NSInteger, KPClusteringControllerMapViewportChangeState) {
         return KPClusteringControllerMapViewportZoom;
     }
 
+    // With adaptive margin, the map is refreshed as soon as the visible rect leaves the clustered area
+    if (self.adaptiveClusteringMargin && self.quantizesViewports == NO &&
+        MKMapRectIsNull(self.lastClusteringMapRect) == NO &&
+        MKMapRectContainsRect(self.lastClusteringMapRect, self.mapView.visibleMapRect) == NO) {
+        return KPClusteringControllerMapViewportPan;
+    }
+
     CGPoint lastPoint = [self.mapView convertCoordinate:self.lastRefreshedMapRegion.center
                                           toPointToView:self.mapView];
 
@@ -169,11 +346,62 @@ typedef NS_ENUM(NSInteger, KPClusteringControllerMapViewportChangeState) {
     return KPClusteringControllerMapViewportNoChange;
 }
 
-- (MKMapRect)clusteringMapRectForVisibleMapRect {
-    return MKMapRectInset(self.mapView.visibleMapRect,
-                         -self.mapView.visibleMapRect.size.width,
-                         -self.mapView.visibleMapRect.size.height);
+/*
+ Adaptive margin: idleClusteringMargin of visible size on every side, grown up to a full visible size on the sides the map is panned to,
+ in proportion to the pan velocity measured between the last two clusterings (the margin covers the next KPClusteringControllerMarginLookahead seconds of pan).
+ Zooming resets the velocity. Cached viewports keep the fixed margin, so cached results are valid for any refresh of their viewport.
+ */
+- (MKMapRect)clusteringMapRectForVisibleMapRect:(MKMapRect)visibleMapRect {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+
+    MKMapRect lastVisibleMapRect = self.lastClusteringVisibleMapRect;
+    CFAbsoluteTime elapsed = MAX(now - self.lastClusteringTime, KPClusteringControllerMarginMinimalInterval);
+
+    self.lastClusteringVisibleMapRect = visibleMapRect;
+    self.lastClusteringTime = now;
 
+    if (self.adaptiveClusteringMargin == NO || self.quantizesViewports) {
+        self.lastClusteringMapRect = KPClusteringMapRectForVisibleMapRect(visibleMapRect);
+
+        return self.lastClusteringMapRect;
+    }
+
+    double idleMargin = MIN(MAX(self.idleClusteringMargin, 0), 1);
+
+    double velocityX = 0; // visible sizes per second
+    double velocityY = 0;
+
+    BOOL zoomed = MKMapRectIsNull(lastVisibleMapRect) || fabs(log2(lastVisibleMapRect.size.width / visibleMapRect.size.width)) > KPClusteringControllerMarginZoomTolerance;
+
+    if (zoomed == NO) {
+        double dx = MKMapRectGetMidX(visibleMapRect) - MKMapRectGetMidX(lastVisibleMapRect);
+        double dy = MKMapRectGetMidY(visibleMapRect) - MKMapRectGetMidY(lastVisibleMapRect);
+
+        // The shortest way around the 180th meridian
+        if (dx > MKMapSizeWorld.width / 2) {
+            dx -= MKMapSizeWorld.width;
+        } else if (dx < -MKMapSizeWorld.width / 2) {
+            dx += MKMapSizeWorld.width;
+        }
+
+        velocityX = dx / visibleMapRect.size.width / elapsed;
+        velocityY = dy / visibleMapRect.size.height / elapsed;
+    }
+
+    double leadingMarginX = MIN(1, idleMargin + fabs(velocityX) * KPClusteringControllerMarginLookahead);
+    double leadingMarginY = MIN(1, idleMargin + fabs(velocityY) * KPClusteringControllerMarginLookahead);
+
+    double marginWest  = velocityX < 0 ? leadingMarginX : idleMargin;
+    double marginEast  = velocityX > 0 ? leadingMarginX : idleMargin;
+    double marginNorth = velocityY < 0 ? leadingMarginY : idleMargin;
+    double marginSouth = velocityY > 0 ? leadingMarginY : idleMargin;
+
+    self.lastClusteringMapRect = MKMapRectMake(visibleMapRect.origin.x - marginWest * visibleMapRect.size.width,
+                                               visibleMapRect.origin.y - marginNorth * visibleMapRect.size.height,
+                                               visibleMapRect.size.width * (1 + marginWest + marginEast),
+                                               visibleMapRect.size.height * (1 + marginNorth + marginSouth));
+
+    return self.lastClusteringMapRect;
 }
 
 #pragma mark
@@ -190,14 +418,13 @@ typedef NS_ENUM(NSInteger, KPClusteringControllerMapViewportChangeState) {
         return;
     }
 
-    if ([self.delegate respondsToSelector:@selector(clusteringControllerWillUpdateVisibleAnnotations:)]) {
-
-        [self.delegate clusteringControllerWillUpdateVisibleAnnotations:self];
-    }
+    // Every update overtakes the asynchronous ones in flight, synchronous updates included
+    NSUInteger generation = self.clusteringGeneration + 1;
 
-    MKMapRect clusteringMapRect = self.clusteringMapRectForVisibleMapRect;
+    self.clusteringGeneration = generation;
 
-    NSArray *newClusters;
+    MKMapRect visibleMapRect = self.mapView.visibleMapRect;
+    CGSize mapViewSize = self.mapView.frame.size;
 
     BOOL clusteringEnabled = YES;
 
@@ -205,17 +432,266 @@ typedef NS_ENUM(NSInteger, KPClusteringControllerMapViewportChangeState) {
         clusteringEnabled = [self.delegate clusteringControllerShouldClusterAnnotations:self];
     }
 
-    if (clusteringEnabled) {
+    BOOL clusteringCanRunInBackground = [self.clusteringAlgorithm respondsToSelector:@selector(clusterAnnotationsInMapRect:visibleMapRect:mapViewSize:annotationTree:)];
+
+    NSString *prefetchKey = nil;
+
+    if (self.quantizesViewports && clusteringEnabled && clusteringCanRunInBackground) {
+        prefetchKey = [self prefetchKeyForVisibleMapRect:visibleMapRect mapViewSize:mapViewSize quantizedVisibleMapRect:&visibleMapRect];
+
+        NSArray *prefetchedClusters = [self.activeClusterCache clustersForAnnotationTree:self.annotationTree
+                                                                     clusteringAlgorithm:self.clusteringAlgorithm
+                                                                             viewportKey:prefetchKey];
+
+        if (prefetchedClusters) {
+            self.prefetchHitCount++;
+
+            if ([self.delegate respondsToSelector:@selector(clusteringControllerWillUpdateVisibleAnnotations:)]) {
+                [self.delegate clusteringControllerWillUpdateVisibleAnnotations:self];
+            }
+
+            [self _updateVisibleMapAnnotationsWithClusters:prefetchedClusters animated:animated];
+
+            [self prefetchClustersAroundVisibleMapRect:visibleMapRect mapViewSize:mapViewSize generation:generation];
+
+            return;
+        }
+
+        self.prefetchMissCount++;
+    }
+
+    MKMapRect clusteringMapRect = [self clusteringMapRectForVisibleMapRect:visibleMapRect];
+
+    if (self.asynchronousClustering && (clusteringEnabled == NO || clusteringCanRunInBackground)) {
+        [self _clusterAnnotationsInMapRect:clusteringMapRect
+                            visibleMapRect:visibleMapRect
+                               mapViewSize:mapViewSize
+                         clusteringEnabled:clusteringEnabled
+                               prefetchKey:prefetchKey
+                                generation:generation
+                                  animated:animated];
+
+        return;
+    }
+
+    if ([self.delegate respondsToSelector:@selector(clusteringControllerWillUpdateVisibleAnnotations:)]) {
+
+        [self.delegate clusteringControllerWillUpdateVisibleAnnotations:self];
+    }
+
+    NSArray *newClusters;
+
+    if (prefetchKey) {
+        newClusters = [self.clusteringAlgorithm clusterAnnotationsInMapRect:clusteringMapRect
+                                                             visibleMapRect:visibleMapRect
+                                                                mapViewSize:mapViewSize
+                                                             annotationTree:self.annotationTree];
+    } else if (clusteringEnabled) {
         newClusters = [self.clusteringAlgorithm clusterAnnotationsInMapRect:clusteringMapRect
                                                               parentMapView:self.mapView
                                                              annotationTree:self.annotationTree];
     } else {
-        NSArray *newAnnotations = [self.annotationTree annotationsInMapRect:clusteringMapRect];
+        newClusters = [self _unclusteredAnnotationsInMapRect:clusteringMapRect annotationTree:self.annotationTree];
+    }
 
-        newClusters = [newAnnotations kp_map:^id(id annotation) {
-            return [[KPAnnotation alloc] initWithAnnotations:@[ annotation ]];
-        }];
+    // Clusters are cached before the update animates them
+    if (prefetchKey) {
+        [self.activeClusterCache setClusters:newClusters
+                           forAnnotationTree:self.annotationTree
+                         clusteringAlgorithm:self.clusteringAlgorithm
+                                 viewportKey:prefetchKey];
+    }
+
+    [self _updateVisibleMapAnnotationsWithClusters:newClusters animated:animated];
+
+    if (prefetchKey) {
+        [self prefetchClustersAroundVisibleMapRect:visibleMapRect mapViewSize:mapViewSize generation:generation];
+    }
+}
+
+/*
+ Asynchronous update: everything clustering needs from the map view is snapshotted on the main thread before it is called.
+ A job is skipped if a newer update was requested before it started, and its result is dropped
+ if a newer update was requested while it was clustering. Results are applied on the main thread.
+ */
+- (void)_clusterAnnotationsInMapRect:(MKMapRect)clusteringMapRect
+                      visibleMapRect:(MKMapRect)visibleMapRect
+                         mapViewSize:(CGSize)mapViewSize
+                   clusteringEnabled:(BOOL)clusteringEnabled
+                         prefetchKey:(NSString *)prefetchKey
+                          generation:(NSUInteger)generation
+                            animated:(BOOL)animated
+{
+    KPAnnotationTree *annotationTree = self.annotationTree;
+    id <KPClusteringAlgorithm> clusteringAlgorithm = self.clusteringAlgorithm;
+
+    __weak KPClusteringController *weakSelf = self;
+
+    dispatch_async(self.clusteringQueue, ^{
+        KPClusteringController *strongSelf = weakSelf;
+
+        if (strongSelf == nil || strongSelf.clusteringGeneration != generation) {
+            return;
+        }
+
+        NSArray *newClusters;
+
+        if (clusteringEnabled) {
+            newClusters = [clusteringAlgorithm clusterAnnotationsInMapRect:clusteringMapRect
+                                                            visibleMapRect:visibleMapRect
+                                                               mapViewSize:mapViewSize
+                                                            annotationTree:annotationTree];
+        } else {
+            newClusters = [strongSelf _unclusteredAnnotationsInMapRect:clusteringMapRect annotationTree:annotationTree];
+        }
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (prefetchKey) {
+                [strongSelf.activeClusterCache setClusters:newClusters
+                                         forAnnotationTree:annotationTree
+                                       clusteringAlgorithm:clusteringAlgorithm
+                                               viewportKey:prefetchKey];
+            }
+
+            if (strongSelf.clusteringGeneration != generation) {
+                return;
+            }
+
+            if ([strongSelf.delegate respondsToSelector:@selector(clusteringControllerWillUpdateVisibleAnnotations:)]) {
+                [strongSelf.delegate clusteringControllerWillUpdateVisibleAnnotations:strongSelf];
+            }
+
+            [strongSelf _updateVisibleMapAnnotationsWithClusters:newClusters animated:animated];
+
+            if (prefetchKey) {
+                [strongSelf prefetchClustersAroundVisibleMapRect:visibleMapRect mapViewSize:mapViewSize generation:generation];
+            }
+        });
+    });
+}
+
+/*
+ Prefetching and caching: with prefetchesAdjacentZoomLevels enabled or a shared clusterCache set, every refresh clusters a quantized viewport instead of the exact one:
+ zoom is rounded to a power of two (visible width is MKMapSizeWorld.width / 2^zoom) and the center is snapped to 1/8 of the visible width.
+ Any two refreshes of the same quantized viewport give the same clusters, so they are cached by it, and once a refresh is applied,
+ the viewports one zoom level in and out (and one pan step further when prefetchesPanDirection is enabled) are clustered
+ on the clustering queue while the map is idle. Prefetch jobs overtaken by a newer update before they start are skipped.
+ */
+- (NSString *)prefetchKeyForVisibleMapRect:(MKMapRect)visibleMapRect
+                               mapViewSize:(CGSize)mapViewSize
+                   quantizedVisibleMapRect:(MKMapRect *)quantizedVisibleMapRect
+{
+    NSInteger zoomLevel = (NSInteger)round(log2(MKMapSizeWorld.width / visibleMapRect.size.width));
+
+    return [self prefetchKeyForZoomLevel:zoomLevel
+                                  center:MKMapPointMake(MKMapRectGetMidX(visibleMapRect), MKMapRectGetMidY(visibleMapRect))
+                             mapViewSize:mapViewSize
+                 quantizedVisibleMapRect:quantizedVisibleMapRect];
+}
+
+- (NSString *)prefetchKeyForZoomLevel:(NSInteger)zoomLevel
+                               center:(MKMapPoint)center
+                          mapViewSize:(CGSize)mapViewSize
+              quantizedVisibleMapRect:(MKMapRect *)quantizedVisibleMapRect
+{
+    double width = MKMapSizeWorld.width / pow(2, zoomLevel);
+    double height = width * mapViewSize.height / mapViewSize.width;
+    double step = width / KPClusteringControllerPrefetchCenterSteps;
+
+    int64_t x = (int64_t)round(center.x / step);
+    int64_t y = (int64_t)round(center.y / step);
+
+    *quantizedVisibleMapRect = MKMapRectMake(x * step - width / 2, y * step - height / 2, width, height);
+
+    // Clusters depend on the settings of the algorithm as well, e.g. on its cell size
+    NSString *configurationKey = @"";
+
+    if ([self.clusteringAlgorithm respondsToSelector:@selector(clusteringConfigurationKey)]) {
+        configurationKey = [self.clusteringAlgorithm clusteringConfigurationKey];
+    }
+
+    return [NSString stringWithFormat:@"%@/%ld/%lld/%lld/%.0fx%.0f", configurationKey, (long)zoomLevel, x, y, mapViewSize.width, mapViewSize.height];
+}
+
+- (void)prefetchClustersAroundVisibleMapRect:(MKMapRect)visibleMapRect mapViewSize:(CGSize)mapViewSize generation:(NSUInteger)generation {
+    if (self.prefetchesAdjacentZoomLevels == NO) {
+        return;
+    }
+
+    NSInteger zoomLevel = (NSInteger)round(log2(MKMapSizeWorld.width / visibleMapRect.size.width));
+    MKMapPoint center = MKMapPointMake(MKMapRectGetMidX(visibleMapRect), MKMapRectGetMidY(visibleMapRect));
+
+    NSInteger zoomLevels[3] = { zoomLevel - 1, zoomLevel + 1, zoomLevel };
+    MKMapPoint centers[3] = { center, center, center };
+    NSUInteger viewportsCount = 2;
+
+    // Pan direction is the move from the previous prefetching viewport of the same zoom level
+    if (self.prefetchesPanDirection && self.lastPrefetchZoomLevel == zoomLevel) {
+        MKMapPoint nextCenter = MKMapPointMake(2 * center.x - self.lastPrefetchCenter.x, 2 * center.y - self.lastPrefetchCenter.y);
+
+        if (MKMapPointEqualToPoint(nextCenter, center) == NO) {
+            centers[viewportsCount++] = nextCenter;
+        }
+    }
+
+    self.lastPrefetchZoomLevel = zoomLevel;
+    self.lastPrefetchCenter = center;
+
+    KPAnnotationTree *annotationTree = self.annotationTree;
+    id <KPClusteringAlgorithm> clusteringAlgorithm = self.clusteringAlgorithm;
+    KPClusterCache *clusterCache = self.activeClusterCache;
+
+    __weak KPClusteringController *weakSelf = self;
+
+    for (NSUInteger idx = 0; idx < viewportsCount; idx++) {
+        NSInteger prefetchZoomLevel = zoomLevels[idx];
+
+        if (prefetchZoomLevel < 0 || prefetchZoomLevel > KPClusteringControllerPrefetchMaximumZoomLevel) {
+            continue;
+        }
+
+        MKMapRect prefetchVisibleMapRect;
+
+        NSString *prefetchKey = [self prefetchKeyForZoomLevel:prefetchZoomLevel
+                                                       center:centers[idx]
+                                                  mapViewSize:mapViewSize
+                                      quantizedVisibleMapRect:&prefetchVisibleMapRect];
+
+        if ([clusterCache hasClustersForAnnotationTree:annotationTree clusteringAlgorithm:clusteringAlgorithm viewportKey:prefetchKey]) {
+            continue;
+        }
+
+        dispatch_async(self.clusteringQueue, ^{
+            if (weakSelf == nil || weakSelf.clusteringGeneration != generation) {
+                return;
+            }
+
+            NSArray *clusters = [clusteringAlgorithm clusterAnnotationsInMapRect:KPClusteringMapRectForVisibleMapRect(prefetchVisibleMapRect)
+                                                                  visibleMapRect:prefetchVisibleMapRect
+                                                                     mapViewSize:mapViewSize
+                                                                  annotationTree:annotationTree];
+
+            // Clusters of a tree nobody shows anymore are not cached
+            [clusterCache setClusters:clusters forAnnotationTree:annotationTree clusteringAlgorithm:clusteringAlgorithm viewportKey:prefetchKey];
+        });
     }
+}
+
+- (NSArray *)_unclusteredAnnotationsInMapRect:(MKMapRect)mapRect annotationTree:(KPAnnotationTree *)annotationTree {
+    NSArray *newAnnotations = [annotationTree annotationsInMapRect:mapRect];
+
+    return [newAnnotations kp_map:^id(id annotation) {
+        return [[KPAnnotation alloc] initWithAnnotations:@[ annotation ]];
+    }];
+}
+
+- (void)_updateVisibleMapAnnotationsWithClusters:(NSArray *)newClusters animated:(BOOL)animated {
+    NSArray *oldClusters = self.displayedClusters.allObjects;
+
+    [self diffClusters:newClusters
+       againstClusters:oldClusters
+         addedClusters:&newClusters
+       removedClusters:&oldClusters];
 
     if ([self.delegate respondsToSelector:@selector(clusteringController:configureAnnotationForDisplay:)]) {
         for (KPAnnotation *annotation in newClusters) {
@@ -223,8 +699,6 @@ typedef NS_ENUM(NSInteger, KPClusteringControllerMapViewportChangeState) {
         }
     }
 
-    NSArray *oldClusters = self.currentAnnotations;
-
     if (animated) {
         
         NSMutableArray *removedAnnotations = [NSMutableArray arrayWithCapacity:[oldClusters count]];
@@ -234,61 +708,81 @@ typedef NS_ENUM(NSInteger, KPClusteringControllerMapViewportChangeState) {
 
         NSSet *visibleAnnotations = [self.mapView annotationsInMapRect:self.mapView.visibleMapRect];
 
-        for (KPAnnotation *newCluster in newClusters) {
+        NSUInteger *splitSources = malloc(MAX(newClusters.count, 1) * sizeof(NSUInteger));
+        NSUInteger *firstMergedSources = malloc(MAX(newClusters.count, 1) * sizeof(NSUInteger));
+        NSUInteger *nextMergedSources = malloc(MAX(oldClusters.count, 1) * sizeof(NSUInteger));
+
+        [self matchClusters:newClusters
+               withClusters:oldClusters
+               splitSources:splitSources
+         firstMergedSources:firstMergedSources
+          nextMergedSources:nextMergedSources];
+
+        for (NSUInteger newIndex = 0; newIndex < newClusters.count; newIndex++) {
+            KPAnnotation *newCluster = newClusters[newIndex];
 
             [self.mapView addAnnotation:newCluster];
+            [self.displayedClusters addObject:newCluster];
 
-            for (KPAnnotation *oldCluster in oldClusters) {
-                
-                // if was part of an old cluster, then we want to animate it from the old to the new (spreading animation)
-                if ([oldCluster.annotations member:[newCluster.annotations anyObject]]) {
-                    BOOL shouldAnimate = [oldCluster.annotations isEqualToSet:newCluster.annotations] == NO;
-
-                    if (shouldAnimate && [visibleAnnotations member:oldCluster]) {
-                        
-                        dispatch_group_enter(group);
-
-                        [self animateCluster:newCluster
-                                          fromAnnotation:oldCluster
-                                            toAnnotation:newCluster
-                                              completion:^(BOOL finished) {
-                                                  dispatch_group_leave(group);
-                                              }];
-                    }
+            // if was part of an old cluster, then we want to animate it from the old to the new (spreading animation)
+            if (splitSources[newIndex] != NSNotFound) {
+                KPAnnotation *oldCluster = oldClusters[splitSources[newIndex]];
 
-                    [removedAnnotations addObject:oldCluster];
+                BOOL shouldAnimate = [oldCluster hasSameAnnotationsAsAnnotation:newCluster] == NO;
+
+                if (shouldAnimate && [visibleAnnotations member:oldCluster]) {
+
+                    dispatch_group_enter(group);
+
+                    [self animateCluster:newCluster
+                                      fromAnnotation:oldCluster
+                                        toAnnotation:newCluster
+                                          completion:^(BOOL finished) {
+                                              dispatch_group_leave(group);
+                                          }];
                 }
 
-                // if the new cluster had old annotations, then animate the old annotations to the new one, and remove it
-                // (collapsing animation)
+                [removedAnnotations addObject:oldCluster];
+            }
 
-                else if ([newCluster.annotations member:[oldCluster.annotations anyObject]]) {
-                    
-                    BOOL shouldAnimate = [oldCluster.annotations isEqualToSet:newCluster.annotations] == NO;
+            // if the new cluster had old annotations, then animate the old annotations to the new one, and remove it
+            // (collapsing animation)
+            for (NSUInteger oldIndex = firstMergedSources[newIndex]; oldIndex != NSNotFound; oldIndex = nextMergedSources[oldIndex]) {
+                KPAnnotation *oldCluster = oldClusters[oldIndex];
 
-                    if (shouldAnimate && MKMapRectContainsPoint(self.mapView.visibleMapRect, MKMapPointForCoordinate(newCluster.coordinate))) {
+                BOOL shouldAnimate = [oldCluster hasSameAnnotationsAsAnnotation:newCluster] == NO;
 
-                        dispatch_group_enter(group);
+                if (shouldAnimate && MKMapRectContainsPoint(self.mapView.visibleMapRect, MKMapPointForCoordinate(newCluster.coordinate))) {
 
-                        [self animateCluster:oldCluster
-                                          fromAnnotation:oldCluster
-                                            toAnnotation:newCluster
-                                              completion:^(BOOL finished) {
-                                                  [self.mapView removeAnnotation:oldCluster];
+                    dispatch_group_enter(group);
 
-                                                  dispatch_group_leave(group);
-                                              }];
-                    }
+                    [self animateCluster:oldCluster
+                                      fromAnnotation:oldCluster
+                                        toAnnotation:newCluster
+                                          completion:^(BOOL finished) {
+                                              [self.mapView removeAnnotation:oldCluster];
+                                              [self.displayedClusters removeObject:oldCluster];
 
-                    else {
-                        [removedAnnotations addObject:oldCluster];
-                    }
+                                              dispatch_group_leave(group);
+                                          }];
+                }
+
+                else {
+                    [removedAnnotations addObject:oldCluster];
                 }
             }
         }
-        
+
+        free(splitSources);
+        free(firstMergedSources);
+        free(nextMergedSources);
+
         [self.mapView removeAnnotations:removedAnnotations];
 
+        for (KPAnnotation *oldCluster in removedAnnotations) {
+            [self.displayedClusters removeObject:oldCluster];
+        }
+
         dispatch_group_notify(group, dispatch_get_main_queue(), ^{
             if ([self.delegate respondsToSelector:@selector(clusteringControllerDidUpdateVisibleMapAnnotations:)]) {
                 [self.delegate clusteringControllerDidUpdateVisibleMapAnnotations:self];
@@ -296,9 +790,23 @@ typedef NS_ENUM(NSInteger, KPClusteringControllerMapViewportChangeState) {
         });
     }
 
+    else if (self.incrementalUpdates) {
+        [self _updateVisibleMapAnnotationsIncrementallyAddingClusters:newClusters removingClusters:oldClusters];
+    }
+
     else {
-        [self.mapView removeAnnotations:oldClusters];
-        [self.mapView addAnnotations:newClusters];
+        if (oldClusters.count > 0) {
+            [self.mapView removeAnnotations:oldClusters];
+
+            for (KPAnnotation *oldCluster in oldClusters) {
+                [self.displayedClusters removeObject:oldCluster];
+            }
+        }
+
+        if (newClusters.count > 0) {
+            [self.mapView addAnnotations:newClusters];
+            [self.displayedClusters addObjectsFromArray:newClusters];
+        }
 
         if ([self.delegate respondsToSelector:@selector(clusteringControllerDidUpdateVisibleMapAnnotations:)]) {
             [self.delegate clusteringControllerDidUpdateVisibleMapAnnotations:self];
@@ -306,6 +814,216 @@ typedef NS_ENUM(NSInteger, KPClusteringControllerMapViewportChangeState) {
     }
 }
 
+/*
+ Non-animated changes applied in batches across run loop turns (see incrementalUpdates): clusters inside visibleMapRect first,
+ then the ones in the margin of clustering rect, both ordered outward from the center of visible rect.
+ Removals are ordered the same way as additions and are interleaved with them, so stale clusters leave the screen
+ while their replacements arrive. displayedClusters always tells what has been applied so far, so an update which overtakes
+ an incremental one just diffs against it and the overtaken one stops at its next turn.
+ */
+- (void)_updateVisibleMapAnnotationsIncrementallyAddingClusters:(NSArray *)addedClusters removingClusters:(NSArray *)removedClusters {
+    MKMapRect visibleMapRect = self.mapView.visibleMapRect;
+    MKMapPoint center = MKMapPointMake(MKMapRectGetMidX(visibleMapRect), MKMapRectGetMidY(visibleMapRect));
+
+    NSUInteger changesCount = removedClusters.count + addedClusters.count;
+
+    NSMutableData *changesData = [NSMutableData dataWithLength:changesCount * sizeof(kp_cluster_change_t)];
+    kp_cluster_change_t *changes = changesData.mutableBytes;
+
+    for (NSUInteger idx = 0; idx < changesCount; idx++) {
+        KPAnnotation *cluster = idx < removedClusters.count ? removedClusters[idx] : addedClusters[idx - removedClusters.count];
+
+        MKMapPoint mapPoint = MKMapPointForCoordinate(cluster.coordinate);
+
+        changes[idx].outsideVisibleMapRect = MKMapRectContainsPoint(visibleMapRect, mapPoint) == NO;
+        changes[idx].distanceSquared = MKMapPointGetDistanceSquaredToMapPoint(mapPoint, center);
+        changes[idx].index = idx;
+    }
+
+    qsort(changes, changesCount, sizeof(kp_cluster_change_t), KPClusterChangeCompare);
+
+    [self _applyClusterChanges:changesData
+                     fromIndex:0
+               removedClusters:removedClusters
+                 addedClusters:addedClusters
+                    generation:self.clusteringGeneration];
+}
+
+- (void)_applyClusterChanges:(NSData *)changesData
+                   fromIndex:(NSUInteger)index
+             removedClusters:(NSArray *)removedClusters
+               addedClusters:(NSArray *)addedClusters
+                  generation:(NSUInteger)generation
+{
+    if (self.clusteringGeneration != generation) {
+        return;
+    }
+
+    const kp_cluster_change_t *changes = changesData.bytes;
+    NSUInteger changesCount = changesData.length / sizeof(kp_cluster_change_t);
+
+    CFAbsoluteTime deadline = CFAbsoluteTimeGetCurrent() + self.incrementalUpdateFrameBudget;
+
+    // At least one batch per turn, so the update always makes progress
+    do {
+        NSUInteger batchEnd = MIN(index + KPClusteringControllerIncrementalUpdateBatchSize, changesCount);
+
+        NSMutableArray *batchRemovedClusters = [NSMutableArray array];
+        NSMutableArray *batchAddedClusters = [NSMutableArray array];
+
+        for (; index < batchEnd; index++) {
+            NSUInteger idx = changes[index].index;
+
+            if (idx < removedClusters.count) {
+                [batchRemovedClusters addObject:removedClusters[idx]];
+            } else {
+                [batchAddedClusters addObject:addedClusters[idx - removedClusters.count]];
+            }
+        }
+
+        if (batchRemovedClusters.count > 0) {
+            [self.mapView removeAnnotations:batchRemovedClusters];
+
+            for (KPAnnotation *oldCluster in batchRemovedClusters) {
+                [self.displayedClusters removeObject:oldCluster];
+            }
+        }
+
+        if (batchAddedClusters.count > 0) {
+            [self.mapView addAnnotations:batchAddedClusters];
+            [self.displayedClusters addObjectsFromArray:batchAddedClusters];
+        }
+    } while (index < changesCount && CFAbsoluteTimeGetCurrent() < deadline);
+
+    if (index < changesCount) {
+        __weak KPClusteringController *weakSelf = self;
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [weakSelf _applyClusterChanges:changesData
+                                 fromIndex:index
+                           removedClusters:removedClusters
+                             addedClusters:addedClusters
+                                generation:generation];
+        });
+
+        return;
+    }
+
+    if ([self.delegate respondsToSelector:@selector(clusteringControllerDidUpdateVisibleMapAnnotations:)]) {
+        [self.delegate clusteringControllerDidUpdateVisibleMapAnnotations:self];
+    }
+}
+
+/*
+ Clusters of the same annotations as the ones already on the map are kept on the map as they are, so MapKit keeps their views:
+ only the new clusters which have no counterpart on the map are added and only the old ones which have no counterpart are removed.
+ Counterparts are found by clusterIdentifier, membership is compared only when identifiers are equal.
+ */
+- (void)diffClusters:(NSArray *)newClusters
+     againstClusters:(NSArray *)oldClusters
+       addedClusters:(NSArray **)addedClusters
+     removedClusters:(NSArray **)removedClusters
+{
+    NSMutableDictionary *oldClustersByIdentifier = [NSMutableDictionary dictionaryWithCapacity:oldClusters.count];
+
+    for (KPAnnotation *oldCluster in oldClusters) {
+        oldClustersByIdentifier[@(oldCluster.clusterIdentifier)] = oldCluster;
+    }
+
+    NSMutableArray *added = [NSMutableArray arrayWithCapacity:newClusters.count];
+    NSMutableSet *kept = [NSMutableSet setWithCapacity:oldClusters.count];
+
+    for (KPAnnotation *newCluster in newClusters) {
+        NSNumber *identifier = @(newCluster.clusterIdentifier);
+        KPAnnotation *oldCluster = oldClustersByIdentifier[identifier];
+
+        if (oldCluster &&
+            oldCluster.clusteringCategory == newCluster.clusteringCategory &&
+            [oldCluster hasSameAnnotationsAsAnnotation:newCluster]) {
+
+            [kept addObject:oldCluster];
+            [oldClustersByIdentifier removeObjectForKey:identifier];
+        } else {
+            [added addObject:newCluster];
+        }
+    }
+
+    *addedClusters = added;
+
+    *removedClusters = [oldClusters kp_filter:^BOOL(KPAnnotation *oldCluster) {
+        return [kept containsObject:oldCluster] == NO;
+    }];
+}
+
+/*
+ Pairs new clusters with the old ones for animations in O(number of annotations of both) instead of probing every pair of clusters:
+ every annotation is mapped once to the old and to the new cluster it belongs to, then every cluster is looked up by one of its annotations.
+ - splitSources[new]: index of the old cluster containing an annotation of the new cluster (it was split), or NSNotFound
+ - firstMergedSources[new] -> nextMergedSources[old] -> ... -> NSNotFound: other old clusters which have an annotation
+   in the new cluster (they were merged into it), in the order of oldClusters.
+ Clusters of the same annotations are paired as well, they are just not animated.
+ */
+- (void)matchClusters:(NSArray *)newClusters
+         withClusters:(NSArray *)oldClusters
+         splitSources:(NSUInteger *)splitSources
+   firstMergedSources:(NSUInteger *)firstMergedSources
+    nextMergedSources:(NSUInteger *)nextMergedSources
+{
+    NSMapTable *oldClusterIndexesByAnnotation = [NSMapTable strongToStrongObjectsMapTable];
+    NSMapTable *newClusterIndexesByAnnotation = [NSMapTable strongToStrongObjectsMapTable];
+
+    for (NSUInteger oldIndex = 0; oldIndex < oldClusters.count; oldIndex++) {
+        NSNumber *index = @(oldIndex);
+
+        [self enumerateAnnotationsOfCluster:oldClusters[oldIndex] usingBlock:^(id <MKAnnotation> annotation) {
+            [oldClusterIndexesByAnnotation setObject:index forKey:annotation];
+        }];
+    }
+
+    for (NSUInteger newIndex = 0; newIndex < newClusters.count; newIndex++) {
+        KPAnnotation *newCluster = newClusters[newIndex];
+        NSNumber *index = @(newIndex);
+
+        [self enumerateAnnotationsOfCluster:newCluster usingBlock:^(id <MKAnnotation> annotation) {
+            [newClusterIndexesByAnnotation setObject:index forKey:annotation];
+        }];
+
+        NSNumber *oldIndex = [oldClusterIndexesByAnnotation objectForKey:[newCluster anyAnnotation]];
+
+        splitSources[newIndex] = oldIndex ? oldIndex.unsignedIntegerValue : NSNotFound;
+        firstMergedSources[newIndex] = NSNotFound;
+    }
+
+    // Walked backwards, so prepending keeps the lists in the order of oldClusters
+    for (NSUInteger oldIndex = oldClusters.count; oldIndex-- > 0; ) {
+        NSNumber *newIndex = [newClusterIndexesByAnnotation objectForKey:[oldClusters[oldIndex] anyAnnotation]];
+
+        if (newIndex == nil || splitSources[newIndex.unsignedIntegerValue] == oldIndex) {
+            continue;
+        }
+
+        nextMergedSources[oldIndex] = firstMergedSources[newIndex.unsignedIntegerValue];
+        firstMergedSources[newIndex.unsignedIntegerValue] = oldIndex;
+    }
+}
+
+// Clusters built from tree indexes are walked by their indexes, so their annotations sets are not built
+- (void)enumerateAnnotationsOfCluster:(KPAnnotation *)cluster usingBlock:(void (^)(id <MKAnnotation> annotation))block {
+    const NSUInteger *nodeIndexes = cluster.nodeIndexes;
+
+    if (nodeIndexes != NULL) {
+        kp_2dtree_t tree = cluster.annotationTree.tree;
+
+        for (NSUInteger i = 0; i < cluster.annotationsCount; i++) {
+            block(tree.root[nodeIndexes[i]].annotation);
+        }
+    } else {
+        for (id <MKAnnotation> annotation in cluster.annotations) {
+            block(annotation);
+        }
+    }
+}
+
 - (void)animateCluster:(KPAnnotation *)cluster
          fromAnnotation:(KPAnnotation *)fromAnnotation
            toAnnotation:(KPAnnotation *)toAnnotation
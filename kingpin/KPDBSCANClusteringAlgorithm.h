@@ -0,0 +1,53 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "KPClusteringAlgorithm.h"
+#import "KPAnnotation.h"
+
+typedef NS_ENUM(NSInteger, KPDBSCANPointType) {
+    KPDBSCANPointTypeCore = 0,
+    KPDBSCANPointTypeBorder,
+    KPDBSCANPointTypeNoise,
+};
+
+/**
+ Annotation produced by KPDBSCANClusteringAlgorithm. Every density cluster is reported as one annotation holding its core points
+ and, if it has any, one more annotation holding its border points. Every noise point is reported as an annotation of its own.
+ */
+@interface KPDBSCANAnnotation : KPAnnotation
+
+@property (assign, readonly, nonatomic) KPDBSCANPointType pointType;
+
+/// Core and border annotations of the same density cluster share the same identifier, it is NSNotFound for noise.
+@property (assign, readonly, nonatomic) NSUInteger densityClusterIdentifier;
+
+@end
+
+/**
+ DBSCAN density-based clustering. Neighbourhood queries are done on 2-d tree, visitation state is kept in flat bitsets
+ and clusters are expanded with an explicit work queue, so memory use is a few bytes per annotation.
+ */
+@interface KPDBSCANClusteringAlgorithm : NSObject <KPClusteringAlgorithm>
+
+/// Neighbourhood radius in points on screen
+@property (assign, nonatomic) CGFloat epsilon;
+
+/// Minimal number of annotations in neighbourhood (including the annotation itself) for an annotation to be a core point
+@property (assign, nonatomic) NSUInteger minimumNumberOfPoints;
+
+@end
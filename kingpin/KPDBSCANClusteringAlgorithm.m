@@ -0,0 +1,288 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <MapKit/MapKit.h>
+
+#import "KPDBSCANClusteringAlgorithm.h"
+
+#import "KPAnnotationTree.h"
+#import "KPAnnotationTree_Private.h"
+#import "KPAnnotation_Private.h"
+
+#import "KPGeometry.h"
+
+#import "kp_bitset.h"
+#import "kp_index_list.h"
+
+@interface KPDBSCANAnnotation ()
+
+@property (assign, readwrite, nonatomic) KPDBSCANPointType pointType;
+@property (assign, readwrite, nonatomic) NSUInteger densityClusterIdentifier;
+
+@end
+
+@implementation KPDBSCANAnnotation
+
++ (instancetype)annotationWithAnnotationTree:(KPAnnotationTree *)annotationTree
+                                nodeIndexes:(kp_index_list_t *)nodeIndexes
+                                  pointType:(KPDBSCANPointType)pointType
+                   densityClusterIdentifier:(NSUInteger)densityClusterIdentifier {
+    kp_2dtree_t tree = annotationTree.tree;
+    kp_annotation_statistics_t statistics = KPAnnotationStatisticsMake();
+
+    KPAnnotationStatisticsAddCoordinatesAtIndexes(&statistics, tree.coordinates, tree.weights, nodeIndexes->indexes, nodeIndexes->count);
+
+    KPDBSCANAnnotation *annotation = [[self alloc] initWithAnnotationTree:annotationTree nodeIndexes:nodeIndexes->indexes statistics:statistics];
+
+    annotation.pointType = pointType;
+    annotation.densityClusterIdentifier = densityClusterIdentifier;
+
+    return annotation;
+}
+
+- (instancetype)clusterCopy {
+    KPDBSCANAnnotation *cluster = [super clusterCopy];
+
+    cluster.pointType = self.pointType;
+    cluster.densityClusterIdentifier = self.densityClusterIdentifier;
+
+    return cluster;
+}
+
+@end
+
+@implementation KPDBSCANClusteringAlgorithm
+
+- (id)init {
+
+    if ((self = [super init])) {
+        self.epsilon = 30.f;
+        self.minimumNumberOfPoints = 4;
+    }
+
+    return self;
+}
+
+#pragma mark - KPClusteringAlgorithm
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                           parentMapView:(MKMapView *)mapView
+                          annotationTree:(KPAnnotationTree *)annotationTree
+{
+    kp_map_projection_t projection = KPMapProjectionMake(mapView.visibleMapRect, mapView.frame.size);
+
+    return [self clusterAnnotationsInMapRect:mapRect
+                                  projection:projection
+                              annotationTree:annotationTree];
+}
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                          visibleMapRect:(MKMapRect)visibleMapRect
+                             mapViewSize:(CGSize)mapViewSize
+                          annotationTree:(KPAnnotationTree *)annotationTree
+{
+    return [self clusterAnnotationsInMapRect:mapRect
+                                  projection:KPMapProjectionMake(visibleMapRect, mapViewSize)
+                              annotationTree:annotationTree];
+}
+
+- (NSString *)clusteringConfigurationKey {
+    return [NSString stringWithFormat:@"DBSCAN/%g/%lu", self.epsilon, (unsigned long)self.minimumNumberOfPoints];
+}
+
+#pragma mark - Private
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                              projection:(kp_map_projection_t)projection
+                          annotationTree:(KPAnnotationTree *)annotationTree
+{
+    kp_2dtree_t tree = annotationTree.tree;
+
+    if (tree.size == 0) {
+        return @[];
+    }
+
+    kp_treenode_t *root = tree.root;
+
+    // One scratch serves every neighbourhood query of this pass
+    kp_2dtree_search_scratch_t searchScratch = kp_2dtree_search_scratch_create(&tree);
+    kp_2dtree_search_scratch_t *searchScratchRef = &searchScratch;
+
+    /*
+     All the per-annotation state is indexed by tree node index:
+     - inRect:   annotation lies inside mapRect, only these annotations are clustered
+     - visited:  neighbourhood of annotation has been queried
+     - assigned: annotation belongs to a density cluster (set when it is put to the work queue, so it is queued at most once)
+     */
+    kp_bitset_t inRect   = kp_bitset_create(tree.size);
+    kp_bitset_t visited  = kp_bitset_create(tree.size);
+    kp_bitset_t assigned = kp_bitset_create(tree.size);
+
+    kp_bitset_t *inRectRef = &inRect;
+
+    __block NSUInteger pointsCount = 0;
+    uint32_t *points = malloc(tree.size * sizeof(uint32_t));
+
+    [annotationTree enumerateNodesInMapRect:mapRect searchScratch:&searchScratch usingBlock:^(kp_treenode_t *node) {
+        uint32_t idx = (uint32_t)(node - root);
+
+        points[pointsCount++] = idx;
+
+        kp_bitset_set(inRectRef, idx);
+    }];
+
+    // Every annotation is queued at most once and every neighbourhood lies inside mapRect, so pointsCount is enough for both
+    uint32_t *queue = malloc(MAX(pointsCount, 1) * sizeof(uint32_t));
+    uint32_t *neighbours = malloc(MAX(pointsCount, 1) * sizeof(uint32_t));
+
+    double epsilon = self.epsilon;
+    double epsilonSquared = epsilon * epsilon;
+    NSUInteger minimumNumberOfPoints = self.minimumNumberOfPoints;
+
+    kp_map_projection_t *projectionRef = &projection;
+
+    // Writes indexes of annotations inside mapRect closer than epsilon to given annotation into neighbours, returns their number
+    NSUInteger (^queryNeighbourhood)(uint32_t) = ^NSUInteger(uint32_t idx) {
+        __block NSUInteger neighboursCount = 0;
+
+        MKMapPoint mapPoint = root[idx].mk_map_point;
+        MKMapRect neighbourhood = KPMapProjectionGetMapRectAroundMapPoint(projectionRef, mapPoint, epsilon);
+
+        [annotationTree enumerateNodesInMapRect:neighbourhood searchScratch:searchScratchRef usingBlock:^(kp_treenode_t *node) {
+            uint32_t neighbourIdx = (uint32_t)(node - root);
+
+            if (kp_bitset_test(inRectRef, neighbourIdx) &&
+                KPMapProjectionGetDistanceSquaredBetweenMapPoints(projectionRef, mapPoint, node->mk_map_point) <= epsilonSquared) {
+                neighbours[neighboursCount++] = neighbourIdx;
+            }
+        }];
+
+        return neighboursCount;
+    };
+
+    NSMutableArray *clusters = [NSMutableArray array];
+    NSUInteger densityClusterIdentifier = 0;
+
+    // Members are collected as node indexes: clusters index the tree instead of retaining their annotations
+    kp_index_list_t coreNodeIndexes = kp_index_list_create(64);
+    kp_index_list_t borderNodeIndexes = kp_index_list_create(64);
+
+    for (NSUInteger pointIdx = 0; pointIdx < pointsCount; pointIdx++) {
+        uint32_t idx = points[pointIdx];
+
+        if (kp_bitset_test(&visited, idx)) {
+            continue;
+        }
+
+        kp_bitset_set(&visited, idx);
+
+        NSUInteger neighboursCount = queryNeighbourhood(idx);
+
+        // Not a core point: noise unless it is reached later from a core point of some cluster
+        if (neighboursCount < minimumNumberOfPoints) {
+            continue;
+        }
+
+        kp_index_list_clear(&coreNodeIndexes);
+        kp_index_list_clear(&borderNodeIndexes);
+
+        kp_bitset_set(&assigned, idx);
+        kp_index_list_append(&coreNodeIndexes, idx);
+
+        NSUInteger queueHead = 0;
+        NSUInteger queueTail = 0;
+
+        for (NSUInteger neighbourIdx = 0; neighbourIdx < neighboursCount; neighbourIdx++) {
+            if (kp_bitset_test(&assigned, neighbours[neighbourIdx]) == NO) {
+                kp_bitset_set(&assigned, neighbours[neighbourIdx]);
+                queue[queueTail++] = neighbours[neighbourIdx];
+            }
+        }
+
+        while (queueHead < queueTail) {
+            uint32_t queuedIdx = queue[queueHead++];
+
+            // Already visited means that it was found not to be a core point before: it is a border point of this cluster
+            if (kp_bitset_test(&visited, queuedIdx)) {
+                kp_index_list_append(&borderNodeIndexes, queuedIdx);
+                continue;
+            }
+
+            kp_bitset_set(&visited, queuedIdx);
+
+            NSUInteger queuedNeighboursCount = queryNeighbourhood(queuedIdx);
+
+            if (queuedNeighboursCount < minimumNumberOfPoints) {
+                kp_index_list_append(&borderNodeIndexes, queuedIdx);
+                continue;
+            }
+
+            kp_index_list_append(&coreNodeIndexes, queuedIdx);
+
+            for (NSUInteger neighbourIdx = 0; neighbourIdx < queuedNeighboursCount; neighbourIdx++) {
+                if (kp_bitset_test(&assigned, neighbours[neighbourIdx]) == NO) {
+                    kp_bitset_set(&assigned, neighbours[neighbourIdx]);
+                    queue[queueTail++] = neighbours[neighbourIdx];
+                }
+            }
+        }
+
+        [clusters addObject:[KPDBSCANAnnotation annotationWithAnnotationTree:annotationTree
+                                                                 nodeIndexes:&coreNodeIndexes
+                                                                   pointType:KPDBSCANPointTypeCore
+                                                    densityClusterIdentifier:densityClusterIdentifier]];
+
+        if (borderNodeIndexes.count > 0) {
+            [clusters addObject:[KPDBSCANAnnotation annotationWithAnnotationTree:annotationTree
+                                                                     nodeIndexes:&borderNodeIndexes
+                                                                       pointType:KPDBSCANPointTypeBorder
+                                                        densityClusterIdentifier:densityClusterIdentifier]];
+        }
+
+        densityClusterIdentifier++;
+    }
+
+    for (NSUInteger pointIdx = 0; pointIdx < pointsCount; pointIdx++) {
+        uint32_t idx = points[pointIdx];
+
+        if (kp_bitset_test(&assigned, idx) == NO) {
+            kp_index_list_clear(&coreNodeIndexes);
+            kp_index_list_append(&coreNodeIndexes, idx);
+
+            [clusters addObject:[KPDBSCANAnnotation annotationWithAnnotationTree:annotationTree
+                                                                     nodeIndexes:&coreNodeIndexes
+                                                                       pointType:KPDBSCANPointTypeNoise
+                                                        densityClusterIdentifier:NSNotFound]];
+        }
+    }
+
+    kp_index_list_free(&borderNodeIndexes);
+    kp_index_list_free(&coreNodeIndexes);
+
+    kp_2dtree_search_scratch_free(&searchScratch);
+
+    free(neighbours);
+    free(queue);
+    free(points);
+
+    kp_bitset_free(&assigned);
+    kp_bitset_free(&visited);
+    kp_bitset_free(&inRect);
+
+    return clusters;
+}
+
+@end
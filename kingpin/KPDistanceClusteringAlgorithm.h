@@ -0,0 +1,30 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import "KPClusteringAlgorithm.h"
+
+/**
+ Greedy distance-based clustering: annotations are taken in spatial order and every annotation
+ that is not yet part of a cluster starts a new one, which claims all unclaimed annotations closer than clusterRadius on screen.
+ Unlike grid clustering, clusters are not aligned to a grid and dense groups straddling cell borders are not split.
+ */
+@interface KPDistanceClusteringAlgorithm : NSObject <KPClusteringAlgorithm>
+
+/// Radius of a cluster in points on screen
+@property (assign, nonatomic) CGFloat clusterRadius;
+
+@end
@@ -0,0 +1,160 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <MapKit/MapKit.h>
+
+#import "KPDistanceClusteringAlgorithm.h"
+
+#import "KPAnnotationTree.h"
+#import "KPAnnotationTree_Private.h"
+#import "KPAnnotation.h"
+#import "KPAnnotation_Private.h"
+
+#import "KPGeometry.h"
+
+#import "kp_bitset.h"
+#import "kp_index_list.h"
+
+@implementation KPDistanceClusteringAlgorithm
+
+- (id)init {
+
+    if ((self = [super init])) {
+        self.clusterRadius = 40.f;
+    }
+
+    return self;
+}
+
+#pragma mark - KPClusteringAlgorithm
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                           parentMapView:(MKMapView *)mapView
+                          annotationTree:(KPAnnotationTree *)annotationTree
+{
+    kp_map_projection_t projection = KPMapProjectionMake(mapView.visibleMapRect, mapView.frame.size);
+
+    return [self clusterAnnotationsInMapRect:mapRect
+                                  projection:projection
+                              annotationTree:annotationTree];
+}
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                          visibleMapRect:(MKMapRect)visibleMapRect
+                             mapViewSize:(CGSize)mapViewSize
+                          annotationTree:(KPAnnotationTree *)annotationTree
+{
+    return [self clusterAnnotationsInMapRect:mapRect
+                                  projection:KPMapProjectionMake(visibleMapRect, mapViewSize)
+                              annotationTree:annotationTree];
+}
+
+- (NSString *)clusteringConfigurationKey {
+    return [NSString stringWithFormat:@"Distance/%g", self.clusterRadius];
+}
+
+#pragma mark - Private
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                              projection:(kp_map_projection_t)projection
+                          annotationTree:(KPAnnotationTree *)annotationTree
+{
+    kp_2dtree_t tree = annotationTree.tree;
+
+    if (tree.size == 0) {
+        return @[];
+    }
+
+    kp_treenode_t *root = tree.root;
+
+    // One scratch serves every search of this pass, so concurrent passes over a shared tree do not contend for the tree's one
+    kp_2dtree_search_scratch_t searchScratch = kp_2dtree_search_scratch_create(&tree);
+    kp_2dtree_search_scratch_t *searchScratchRef = &searchScratch;
+
+    /*
+     Seeds are all the annotations inside mapRect in the order they are visited by the tree search:
+     it is deterministic and spatially coherent. Annotations outside mapRect are never claimed,
+     so every annotation inside mapRect ends up in exactly one cluster.
+     */
+    __block NSUInteger seedsCount = 0;
+    kp_treenode_t **seeds = malloc(tree.size * sizeof(kp_treenode_t *));
+
+    kp_bitset_t unclaimed = kp_bitset_create(tree.size);
+    kp_bitset_t *unclaimedRef = &unclaimed;
+
+    [annotationTree enumerateNodesInMapRect:mapRect searchScratch:&searchScratch usingBlock:^(kp_treenode_t *node) {
+        seeds[seedsCount++] = node;
+
+        kp_bitset_set(unclaimedRef, node - root);
+    }];
+
+    NSMutableArray *clusters = [NSMutableArray array];
+
+    kp_index_list_t members = kp_index_list_create(64);
+    kp_index_list_t *membersRef = &members;
+
+    double clusterRadius = self.clusterRadius;
+    double clusterRadiusSquared = clusterRadius * clusterRadius;
+
+    kp_map_projection_t *projectionRef = &projection;
+
+    for (NSUInteger seedIdx = 0; seedIdx < seedsCount; seedIdx++) {
+        kp_treenode_t *seed = seeds[seedIdx];
+
+        if (kp_bitset_test(&unclaimed, seed - root) == NO) {
+            continue;
+        }
+
+        MKMapPoint seedPoint = seed->mk_map_point;
+        MKMapRect neighbourhood = KPMapProjectionGetMapRectAroundMapPoint(projectionRef, seedPoint, clusterRadius);
+
+        kp_index_list_clear(&members);
+
+        // Radius query: the tree gives annotations in the bounding box of the circle, the rest is filtered by distance
+        [annotationTree enumerateNodesInMapRect:neighbourhood searchScratch:searchScratchRef usingBlock:^(kp_treenode_t *node) {
+            NSUInteger idx = node - root;
+
+            if (kp_bitset_test(unclaimedRef, idx) == NO) {
+                return;
+            }
+
+            if (KPMapProjectionGetDistanceSquaredBetweenMapPoints(projectionRef, seedPoint, node->mk_map_point) > clusterRadiusSquared) {
+                return;
+            }
+
+            kp_bitset_clear(unclaimedRef, idx);
+
+            kp_index_list_append(membersRef, idx);
+        }];
+
+        NSAssert(members.count > 0, @"Seed must always claim at least itself");
+
+        kp_annotation_statistics_t statistics = KPAnnotationStatisticsMake();
+
+        KPAnnotationStatisticsAddCoordinatesAtIndexes(&statistics, tree.coordinates, tree.weights, members.indexes, members.count);
+
+        [clusters addObject:[[KPAnnotation alloc] initWithAnnotationTree:annotationTree nodeIndexes:members.indexes statistics:statistics]];
+    }
+
+    kp_index_list_free(&members);
+    kp_bitset_free(&unclaimed);
+    kp_2dtree_search_scratch_free(&searchScratch);
+    free(seeds);
+
+    return clusters;
+}
+
+@end
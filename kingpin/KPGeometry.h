@@ -16,6 +16,7 @@
 
 #import <stddef.h>
 
+#import <CoreGraphics/CGGeometry.h>
 #import <MapKit/MKGeometry.h>
 
 static inline MKMapRect MKMapRectNormalizeToCellSize(MKMapRect mapRect, MKMapSize cellSize) {
@@ -34,6 +35,43 @@ static inline MKMapRect MKMapRectNormalizeToCellSize(MKMapRect mapRect, MKMapSiz
     return normalizedRect;
 }
 
+/*
+ Wraps map rect into the world: rect spanning over international dateline is divided into two rects, left one and right one.
+ This holds for rects crossing it on either side, e.g. a rect around a map point close to x = 0 has a negative origin.
+ Returns the number of rects written to parts (1 or 2).
+ */
+static inline NSUInteger MKMapRectDivideAtDateline(MKMapRect mapRect, MKMapRect parts[2]) {
+    // Rects as wide as the world cover all of it wherever they start
+    if (mapRect.size.width >= MKMapRectWorld.size.width) {
+        parts[0] = MKMapRectMake(0, mapRect.origin.y, MKMapRectWorld.size.width, mapRect.size.height);
+
+        return 1;
+    }
+
+    double rectMinX = fmod(MKMapRectGetMinX(mapRect), MKMapRectWorld.size.width);
+    double rectMaxX = fmod(MKMapRectGetMaxX(mapRect), MKMapRectWorld.size.width);
+
+    if (rectMinX < 0) {
+        rectMinX += MKMapRectWorld.size.width;
+    }
+
+    if (rectMaxX < 0) {
+        rectMaxX += MKMapRectWorld.size.width;
+    }
+
+    if (rectMinX > rectMaxX) {
+        parts[0] = MKMapRectMake(rectMinX, mapRect.origin.y, MKMapRectWorld.size.width - rectMinX, mapRect.size.height);
+        parts[1] = MKMapRectMake(0, mapRect.origin.y, rectMaxX, mapRect.size.height);
+
+        return 2;
+    }
+
+    parts[0] = mapRect;
+    parts[0].origin.x = rectMinX;
+
+    return 1;
+}
+
 static const size_t MKMapPointXOffset = offsetof(MKMapPoint, x);
 static const size_t MKMapPointYOffset = offsetof(MKMapPoint, y);
 static const size_t MKMapPointOffsets[] = { MKMapPointXOffset, MKMapPointYOffset };
@@ -43,3 +81,93 @@ static const size_t MKMapPointOffsets[] = { MKMapPointXOffset, MKMapPointYOffset
 static inline double MKMapPointGetCoordinateForAxis(MKMapPoint *point, int axis) {
     return *(double *)((uintptr_t)point + MKMapPointOffsets[axis]);
 }
+
+// Squared distance in map points between two map points, taking the shortest way around the 180th meridian.
+static inline double MKMapPointGetDistanceSquaredToMapPoint(MKMapPoint mapPoint, MKMapPoint anotherMapPoint) {
+    double dx = fabs(mapPoint.x - anotherMapPoint.x);
+    double dy = mapPoint.y - anotherMapPoint.y;
+
+    dx = MIN(dx, MKMapSizeWorld.width - dx);
+
+    return dx * dx + dy * dy;
+}
+
+/*
+ Linear map point -> view point projection derived once from map view's visibleMapRect and its size.
+ It gives the same result as -[MKMapView convertCoordinate:toPointToView:] for the map view itself,
+ but it is pure arithmetic: it can be used off the main thread and in tight loops.
+ */
+typedef struct {
+    MKMapRect visibleMapRect;
+    CGSize viewSize;
+    double scaleX; // view points per map point
+    double scaleY;
+} kp_map_projection_t;
+
+static inline kp_map_projection_t KPMapProjectionMake(MKMapRect visibleMapRect, CGSize viewSize) {
+    kp_map_projection_t projection;
+
+    projection.visibleMapRect = visibleMapRect;
+    projection.viewSize = viewSize;
+    projection.scaleX = viewSize.width  / visibleMapRect.size.width;
+    projection.scaleY = viewSize.height / visibleMapRect.size.height;
+
+    return projection;
+}
+
+static inline CGPoint KPMapProjectionGetPointForMapPoint(kp_map_projection_t *projection, MKMapPoint mapPoint) {
+    // Points are taken relative to the center of visible rect and wrapped around the world width,
+    // so that points on both sides of the 180th meridian are projected next to each other
+    double dx = mapPoint.x - MKMapRectGetMidX(projection->visibleMapRect);
+
+    if (dx > MKMapSizeWorld.width / 2) {
+        dx -= MKMapSizeWorld.width;
+    } else if (dx < -MKMapSizeWorld.width / 2) {
+        dx += MKMapSizeWorld.width;
+    }
+
+    return CGPointMake(
+                       (dx + projection->visibleMapRect.size.width / 2) * projection->scaleX,
+                       (mapPoint.y - projection->visibleMapRect.origin.y) * projection->scaleY
+                       );
+}
+
+static inline CGPoint KPMapProjectionGetPointForCoordinate(kp_map_projection_t *projection, CLLocationCoordinate2D coordinate) {
+    return KPMapProjectionGetPointForMapPoint(projection, MKMapPointForCoordinate(coordinate));
+}
+
+// Size in map points of a given size in view points, e.g. grid cell size.
+static inline MKMapSize KPMapProjectionGetMapSizeForSize(kp_map_projection_t *projection, CGSize size) {
+    double widthPercentage  = size.width  / projection->viewSize.width;
+    double heightPercentage = size.height / projection->viewSize.height;
+
+    return MKMapSizeMake(
+                         ceil(widthPercentage  * projection->visibleMapRect.size.width),
+                         ceil(heightPercentage * projection->visibleMapRect.size.height)
+                         );
+}
+
+// Squared distance in view points between two map points, taking the shortest way around the 180th meridian.
+static inline double KPMapProjectionGetDistanceSquaredBetweenMapPoints(kp_map_projection_t *projection, MKMapPoint mapPoint, MKMapPoint anotherMapPoint) {
+    double dx = mapPoint.x - anotherMapPoint.x;
+    double dy = mapPoint.y - anotherMapPoint.y;
+
+    if (dx > MKMapSizeWorld.width / 2) {
+        dx -= MKMapSizeWorld.width;
+    } else if (dx < -MKMapSizeWorld.width / 2) {
+        dx += MKMapSizeWorld.width;
+    }
+
+    dx *= projection->scaleX;
+    dy *= projection->scaleY;
+
+    return dx * dx + dy * dy;
+}
+
+// Map rect around map point which contains every map point closer than distance (in view points) to it.
+static inline MKMapRect KPMapProjectionGetMapRectAroundMapPoint(kp_map_projection_t *projection, MKMapPoint mapPoint, double distance) {
+    double halfWidth  = distance / projection->scaleX;
+    double halfHeight = distance / projection->scaleY;
+
+    return MKMapRectMake(mapPoint.x - halfWidth, mapPoint.y - halfHeight, 2 * halfWidth, 2 * halfHeight);
+}
@@ -20,6 +20,9 @@
 typedef NS_ENUM(NSInteger, KPGridClusteringAlgorithmStrategy) {
     KPGridClusteringAlgorithmStrategyBasic = 0,
     KPGridClusteringAlgorithmStrategyTwoPhase,
+    // Like two-phase, but the second phase merges any clusters whose annotation views overlap, not only the ones of adjacent cells.
+    // Use it when annotationSize is larger than gridSize.
+    KPGridClusteringAlgorithmStrategyCollisionResolution,
 };
 
 @interface KPGridClusteringAlgorithm : NSObject <KPClusteringAlgorithm>
@@ -27,7 +30,24 @@ typedef NS_ENUM(NSInteger, KPGridClusteringAlgorithmStrategy) {
 @property (assign, nonatomic) CGSize gridSize;
 @property (assign, nonatomic) KPGridClusteringAlgorithmStrategy clusteringStrategy;
 
-// only used when using KPGridClusteringAlgorithmStrategyTwoPhase
+// When enabled, the grid is split into bands of rows which are clustered concurrently.
+// The result is identical to the one of the serial pass.
+@property (assign, nonatomic) BOOL parallelClustering;
+
+// Number of bands used when parallelClustering is enabled. 0 (default) means one band per active processor.
+@property (assign, nonatomic) NSUInteger parallelClusteringBandCount;
+
+// When enabled, annotations of different categories (see KPCategorizedAnnotation) are clustered separately in one pass:
+// every grid cell gets a cluster per category present in it and two-phase strategy merges only clusters of the same category.
+@property (assign, nonatomic) BOOL clustersByCategory;
+
+// When enabled, cell size is snapped to a power-of-two tile pyramid: cells are aligned to tiles z/x/y and zoom level is quantized,
+// so cells do not shift with small zoom changes (cell size on screen is then between 0.7x and 1.4x of gridSize).
+// Clusters of every tile are memoized until annotations change, refreshes compute only the tiles which are missing.
+// Two-phase strategy merges clusters over the assembled tiles.
+@property (assign, nonatomic) BOOL tileAlignedClustering;
+
+// only used when using KPGridClusteringAlgorithmStrategyTwoPhase or KPGridClusteringAlgorithmStrategyCollisionResolution
 @property (assign, nonatomic) CGSize annotationSize;
 @property (assign, nonatomic) CGPoint annotationCenterOffset;
 
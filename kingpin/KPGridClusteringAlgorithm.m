@@ -20,35 +20,28 @@
 #import "KPGridClusteringAlgorithm_Private.h"
 
 #import "KPAnnotationTree.h"
+#import "KPAnnotationTree_Private.h"
 #import "KPAnnotation.h"
+#import "KPAnnotation_Private.h"
 
 #import "KPGeometry.h"
 
 #import "NSArray+KP.h"
 
-static NSValue *NSValueFromCGPoint(CGPoint point) {
-    NSValue *value;
+/*
+ Memoized clusters of a tile, see tileAlignedClustering. A tile holds plain data only: every refresh builds KPAnnotation objects of its own
+ from it, so the clusters a controller puts on the map (and animates) are never handed out again.
+ */
+@interface KPGridClusteringTile : NSObject
 
-#if TARGET_OS_IPHONE
-    value= [NSValue valueWithCGPoint: point];
-#else
-    value= [NSValue valueWithPoint: point];
-#endif
+@property (strong, nonatomic) NSData *cells;         // kp_grid_tile_cell_t of every cluster, in the order of clusters
+@property (strong, nonatomic) NSData *nodeIndexes;   // members of all clusters, see kp_grid_tile_cell_t
+@property (strong, nonatomic) NSData *reducedValues; // values of the attribute reducers of the tree, for every cluster in turn
 
-    return value;
-}
-
-static CGPoint CGPointFromNSValue(NSValue *value) {
-    CGPoint point;
-
-#if TARGET_OS_IPHONE
-    point = value.CGPointValue;
-#else
-    point = value.pointValue;
-#endif
+@end
 
-    return point;
-}
+@implementation KPGridClusteringTile
+@end
 
 @implementation KPGridClusteringAlgorithm
 
@@ -67,10 +60,46 @@ static CGPoint CGPointFromNSValue(NSValue *value) {
 - (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
                            parentMapView:(MKMapView *)mapView
                           annotationTree:(KPAnnotationTree *)annotationTree
+{
+    kp_map_projection_t projection = KPMapProjectionMake(mapView.visibleMapRect, mapView.frame.size);
+
+    return [self clusterAnnotationsInMapRect:mapRect
+                                  projection:projection
+                              annotationTree:annotationTree];
+}
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                          visibleMapRect:(MKMapRect)visibleMapRect
+                             mapViewSize:(CGSize)mapViewSize
+                          annotationTree:(KPAnnotationTree *)annotationTree
+{
+    return [self clusterAnnotationsInMapRect:mapRect
+                                  projection:KPMapProjectionMake(visibleMapRect, mapViewSize)
+                              annotationTree:annotationTree];
+}
+
+// Band count and parallel clustering do not change the clusters
+- (NSString *)clusteringConfigurationKey {
+    return [NSString stringWithFormat:@"Grid/%gx%g/%ld/%d/%d/%gx%g/%g,%g",
+            self.gridSize.width, self.gridSize.height, (long)self.clusteringStrategy, self.clustersByCategory, self.tileAlignedClustering,
+            self.annotationSize.width, self.annotationSize.height, self.annotationCenterOffset.x, self.annotationCenterOffset.y];
+}
+
+#pragma mark - Private
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                              projection:(kp_map_projection_t)projection
+                          annotationTree:(KPAnnotationTree *)annotationTree
 {
     [self _ensureStrategyIntegrity];
-    
-    MKMapSize mapCellSize = [self mapCellSizeForGridSize:self.gridSize inMapView:mapView];
+
+    if (self.tileAlignedClustering) {
+        return [self _clusterAnnotationsInTilesOfMapRect:mapRect
+                                              projection:projection
+                                          annotationTree:annotationTree];
+    }
+
+    MKMapSize mapCellSize = KPMapProjectionGetMapSizeForSize(&projection, self.gridSize);
 
     // Normalize grid to a cell size.
     mapRect = MKMapRectNormalizeToCellSize(mapRect, mapCellSize);
@@ -78,133 +107,560 @@ static CGPoint CGPointFromNSValue(NSValue *value) {
     NSUInteger gridSizeX = mapRect.size.width  / mapCellSize.width;
     NSUInteger gridSizeY = mapRect.size.height / mapCellSize.height;
 
-    __block NSMutableArray *newClusters = [[NSMutableArray alloc] initWithCapacity:(gridSizeX * gridSizeY)];
+    // One cluster grid per category: clusters of different categories share cells but are never merged
+    NSUInteger categoriesCount = self.clustersByCategory ? MAX(annotationTree.tree.categoriesCount, 1) : 1;
+
+    kp_cluster_t ***clusterGrids = malloc(categoriesCount * sizeof(kp_cluster_t **));
+
+    for (NSUInteger category = 0; category < categoriesCount; category++) {
+        clusterGrids[category] = KPClusterGridCreate(gridSizeX, gridSizeY);
+    }
+
+    __block NSMutableArray *newClusters;
+
+    NSUInteger bandCount = [self _parallelClusteringBandCountForGridSizeY:gridSizeY];
+
+    if (bandCount > 1) {
+        newClusters = [self _clusterAnnotationsInBands:bandCount
+                                             ofMapRect:mapRect
+                                           mapCellSize:mapCellSize
+                                        annotationTree:annotationTree
+                                          clusterGrids:clusterGrids
+                                       categoriesCount:categoriesCount
+                                             gridSizeX:gridSizeX
+                                             gridSizeY:gridSizeY];
+    } else {
+        newClusters = [[NSMutableArray alloc] initWithCapacity:(gridSizeX * gridSizeY)];
+
+        // One scratch serves the searches of every cell
+        kp_2dtree_t tree = annotationTree.tree;
+        kp_2dtree_search_scratch_t scratch = kp_2dtree_search_scratch_create(&tree);
+
+        [self _clusterAnnotationsInGridLines:NSMakeRange(1, gridSizeY)
+                                   ofMapRect:mapRect
+                                 mapCellSize:mapCellSize
+                              annotationTree:annotationTree
+                               searchScratch:&scratch
+                                clusterGrids:clusterGrids
+                             categoriesCount:categoriesCount
+                                   gridSizeX:gridSizeX
+                                   intoArray:newClusters];
+
+        kp_2dtree_search_scratch_free(&scratch);
+    }
+
+    if (self.clusteringStrategy == KPGridClusteringAlgorithmStrategyTwoPhase) {
+        
+        newClusters = (NSMutableArray *)[self _mergeOverlappingClusters:newClusters
+                                                             projection:projection
+                                                           clusterGrids:clusterGrids
+                                                        categoriesCount:categoriesCount
+                                                              gridSizeX:gridSizeX
+                                                              gridSizeY:gridSizeY];
+    } else if (self.clusteringStrategy == KPGridClusteringAlgorithmStrategyCollisionResolution) {
+        newClusters = (NSMutableArray *)KPClusterResolveCollisions(newClusters, &projection, self.annotationSize, self.annotationCenterOffset);
+    }
+
+    for (NSUInteger category = 0; category < categoriesCount; category++) {
+        KPClusterGridFree(clusterGrids[category], gridSizeX, gridSizeY);
+    }
+
+    free(clusterGrids);
+
+    return newClusters;
+}
+
+/*
+ Tile-aligned mode: mapRect is extended to whole tiles, clusters of every tile are taken from the clustering cache of the tree or computed and memoized,
+ and the tiles are assembled into a single cluster grid for the two-phase strategy.
+ */
+- (NSArray *)_clusterAnnotationsInTilesOfMapRect:(MKMapRect)mapRect
+                                      projection:(kp_map_projection_t)projection
+                                  annotationTree:(KPAnnotationTree *)annotationTree
+{
+    double cellMapSide = KPGridTileAlignedCellSide(&projection, self.gridSize);
+    double tileMapSide = cellMapSide * KPGridTileSizeInCells;
+
+    NSUInteger zoomLevel = (NSUInteger)round(log2(MKMapSizeWorld.width / tileMapSide));
+    NSInteger tilesPerSide = (NSInteger)1 << zoomLevel;
+
+    NSInteger firstTileX = (NSInteger)floor(MKMapRectGetMinX(mapRect) / tileMapSide);
+    NSInteger lastTileX  = (NSInteger)ceil(MKMapRectGetMaxX(mapRect) / tileMapSide) - 1;
+    NSInteger firstTileY = MAX(0, (NSInteger)floor(MKMapRectGetMinY(mapRect) / tileMapSide));
+    NSInteger lastTileY  = MIN(tilesPerSide - 1, (NSInteger)ceil(MKMapRectGetMaxY(mapRect) / tileMapSide) - 1);
+
+    if (lastTileX < firstTileX || lastTileY < firstTileY) {
+        return @[];
+    }
+
+    NSUInteger categoriesCount = self.clustersByCategory ? MAX(annotationTree.tree.categoriesCount, 1) : 1;
+
+    NSUInteger gridSizeX = (lastTileX - firstTileX + 1) * KPGridTileSizeInCells;
+    NSUInteger gridSizeY = (lastTileY - firstTileY + 1) * KPGridTileSizeInCells;
+
+    kp_cluster_t ***clusterGrids = malloc(categoriesCount * sizeof(kp_cluster_t **));
+
+    for (NSUInteger category = 0; category < categoriesCount; category++) {
+        clusterGrids[category] = KPClusterGridCreate(gridSizeX, gridSizeY);
+
+        // Only the cells having clusters are copied from tiles
+        for (NSUInteger col = 1; col < (gridSizeY + 1); col++) {
+            memset(clusterGrids[category][col] + 1, 0, gridSizeX * sizeof(kp_cluster_t));
+        }
+    }
+
+    NSMutableArray *clusters = [NSMutableArray array];
+
+    // Tiles which are not memoized yet share one scratch for the searches of their cells
+    kp_2dtree_t tree = annotationTree.tree;
+    kp_2dtree_search_scratch_t scratch = kp_2dtree_search_scratch_create(&tree);
 
-    kp_cluster_t **clusterGrid = KPClusterGridCreate(gridSizeX, gridSizeY);
+    for (NSInteger tileY = firstTileY; tileY <= lastTileY; tileY++) {
+        for (NSInteger tileX = firstTileX; tileX <= lastTileX; tileX++) {
+            // Tiles beyond the 180th meridian are the tiles of the world wrapped around
+            NSInteger wrappedTileX = ((tileX % tilesPerSide) + tilesPerSide) % tilesPerSide;
+
+            KPGridClusteringTile *tile = [self _tileAtZoomLevel:zoomLevel
+                                                              x:wrappedTileX
+                                                              y:tileY
+                                                    mapCellSize:MKMapSizeMake(cellMapSide, cellMapSide)
+                                                 annotationTree:annotationTree
+                                                  searchScratch:&scratch
+                                                categoriesCount:categoriesCount];
+
+            NSUInteger indexOffset = clusters.count;
+            NSUInteger colOffset = (tileY - firstTileY) * KPGridTileSizeInCells;
+            NSUInteger rowOffset = (tileX - firstTileX) * KPGridTileSizeInCells;
+
+            const kp_grid_tile_cell_t *cells = tile.cells.bytes;
+            const NSUInteger *nodeIndexes = tile.nodeIndexes.bytes;
+            const double *reducedValues = tile.reducedValues.bytes;
+
+            NSUInteger cellsCount = tile.cells.length / sizeof(kp_grid_tile_cell_t);
+            NSUInteger reducersCount = annotationTree.attributeReducers.count;
+
+            for (NSUInteger idx = 0; idx < cellsCount; idx++) {
+                kp_cluster_t *cluster = clusterGrids[cells[idx].category][colOffset + cells[idx].col] + rowOffset + cells[idx].row;
+
+                *cluster = cells[idx].cluster;
+                cluster->annotationIndex += indexOffset;
+
+                KPAnnotation *annotation = [[KPAnnotation alloc] initWithAnnotationTree:annotationTree
+                                                                            nodeIndexes:nodeIndexes + cells[idx].firstNodeIndex
+                                                                             statistics:cells[idx].statistics
+                                                                          reducedValues:(reducersCount > 0 ? reducedValues + idx * reducersCount : NULL)];
+                annotation.clusteringCategory = cells[idx].category;
+
+                [clusters addObject:annotation];
+            }
+        }
+    }
+
+    kp_2dtree_search_scratch_free(&scratch);
+
+    NSArray *newClusters = clusters;
+
+    if (self.clusteringStrategy == KPGridClusteringAlgorithmStrategyTwoPhase) {
+        newClusters = [self _mergeOverlappingClusters:clusters
+                                           projection:projection
+                                         clusterGrids:clusterGrids
+                                      categoriesCount:categoriesCount
+                                            gridSizeX:gridSizeX
+                                            gridSizeY:gridSizeY];
+    } else if (self.clusteringStrategy == KPGridClusteringAlgorithmStrategyCollisionResolution) {
+        newClusters = KPClusterResolveCollisions(clusters, &projection, self.annotationSize, self.annotationCenterOffset);
+    }
+
+    for (NSUInteger category = 0; category < categoriesCount; category++) {
+        KPClusterGridFree(clusterGrids[category], gridSizeX, gridSizeY);
+    }
+
+    free(clusterGrids);
+
+    return newClusters;
+}
+
+/*
+ Clusters of a tile depend only on the annotations inside of it, so once computed they do not change until annotation tree does.
+ Memoized tiles are kept by the tree and shared by all refreshes (and all algorithms) which cover them.
+ */
+- (KPGridClusteringTile *)_tileAtZoomLevel:(NSUInteger)zoomLevel
+                                         x:(NSInteger)x
+                                         y:(NSInteger)y
+                               mapCellSize:(MKMapSize)mapCellSize
+                            annotationTree:(KPAnnotationTree *)annotationTree
+                             searchScratch:(kp_2dtree_search_scratch_t *)searchScratch
+                           categoriesCount:(NSUInteger)categoriesCount
+{
+    NSString *key = [NSString stringWithFormat:@"KPGridClusteringTile/%lu/%ld/%ld/%lu", (unsigned long)zoomLevel, (long)x, (long)y, (unsigned long)categoriesCount];
+
+    KPGridClusteringTile *tile = [annotationTree.clusteringCache objectForKey:key];
+
+    if (tile) {
+        return tile;
+    }
+
+    double tileMapSide = mapCellSize.width * KPGridTileSizeInCells;
+
+    MKMapRect tileRect = MKMapRectMake(x * tileMapSide, y * tileMapSide, tileMapSide, tileMapSide);
+
+    kp_cluster_t ***tileGrids = malloc(categoriesCount * sizeof(kp_cluster_t **));
+
+    for (NSUInteger category = 0; category < categoriesCount; category++) {
+        tileGrids[category] = KPClusterGridCreate(KPGridTileSizeInCells, KPGridTileSizeInCells);
+    }
+
+    NSMutableArray *tileClusters = [NSMutableArray array];
+
+    [self _clusterAnnotationsInGridLines:NSMakeRange(1, KPGridTileSizeInCells)
+                               ofMapRect:tileRect
+                             mapCellSize:mapCellSize
+                          annotationTree:annotationTree
+                           searchScratch:searchScratch
+                            clusterGrids:tileGrids
+                         categoriesCount:categoriesCount
+                               gridSizeX:KPGridTileSizeInCells
+                               intoArray:tileClusters];
+
+    NSMutableData *cells = [NSMutableData dataWithLength:tileClusters.count * sizeof(kp_grid_tile_cell_t)];
+    kp_grid_tile_cell_t *tileCells = cells.mutableBytes;
+
+    NSUInteger reducersCount = annotationTree.attributeReducers.count;
+
+    NSMutableData *nodeIndexes = [NSMutableData data];
+    NSMutableData *reducedValues = [NSMutableData dataWithLength:tileClusters.count * reducersCount * sizeof(double)];
+
+    for (NSUInteger category = 0; category < categoriesCount; category++) {
+        for (uint16_t col = 1; col < (KPGridTileSizeInCells + 1); col++) {
+            for (uint16_t row = 1; row < (KPGridTileSizeInCells + 1); row++) {
+                kp_cluster_t *cluster = tileGrids[category][col] + row;
+
+                if (cluster->state != KPClusterStateHasData) {
+                    continue;
+                }
+
+                KPAnnotation *annotation = tileClusters[cluster->annotationIndex];
+                kp_grid_tile_cell_t *tileCell = tileCells + cluster->annotationIndex;
+
+                tileCell->cluster = *cluster;
+                tileCell->statistics = annotation.statistics;
+                tileCell->firstNodeIndex = nodeIndexes.length / sizeof(NSUInteger);
+                tileCell->col = col;
+                tileCell->row = row;
+                tileCell->category = category;
+
+                [nodeIndexes appendBytes:annotation.nodeIndexes length:(annotation.statistics.count * sizeof(NSUInteger))];
+
+                if (reducersCount > 0) {
+                    memcpy((double *)reducedValues.mutableBytes + cluster->annotationIndex * reducersCount,
+                           annotation.reducedValues,
+                           reducersCount * sizeof(double));
+                }
+            }
+        }
+
+        KPClusterGridFree(tileGrids[category], KPGridTileSizeInCells, KPGridTileSizeInCells);
+    }
+
+    free(tileGrids);
+
+    tile = [[KPGridClusteringTile alloc] init];
+    tile.cells = cells;
+    tile.nodeIndexes = nodeIndexes;
+    tile.reducedValues = reducedValues;
+
+    [annotationTree.clusteringCache setObject:tile forKey:key];
+
+    return tile;
+}
+
+/*
+ Clusters the cells of grid lines (the "col" index in terms of clusterGrid) from lines.location to NSMaxRange(lines) - 1.
+ Every cell is searched once, its annotations are accumulated per category and every category gets its own cluster in its own grid.
+ The annotationIndex of every filled cell is its index in clusters array.
+ */
+- (void)_clusterAnnotationsInGridLines:(NSRange)lines
+                             ofMapRect:(MKMapRect)mapRect
+                           mapCellSize:(MKMapSize)mapCellSize
+                        annotationTree:(KPAnnotationTree *)annotationTree
+                         searchScratch:(kp_2dtree_search_scratch_t *)searchScratch
+                          clusterGrids:(kp_cluster_t ***)clusterGrids
+                       categoriesCount:(NSUInteger)categoriesCount
+                             gridSizeX:(NSUInteger)gridSizeX
+                             intoArray:(NSMutableArray *)clusters
+{
+    kp_2dtree_t tree = annotationTree.tree;
 
-    NSUInteger clusterIndex = 0;
+    kp_treenode_t *root = tree.root;
+    CLLocationCoordinate2D *coordinates = tree.coordinates;
+    double *weights = tree.weights;
+    NSUInteger *categories = categoriesCount > 1 ? tree.categories : NULL;
 
-    for (NSUInteger col = 1; col < (gridSizeY + 1); col++) {
+    // Per-category members of the current cell, reset after every cell.
+    // Members are collected as node indexes: clusters index the tree instead of retaining their annotations.
+    kp_index_list_t *cellNodeIndexes = malloc(categoriesCount * sizeof(kp_index_list_t));
+
+    for (NSUInteger category = 0; category < categoriesCount; category++) {
+        cellNodeIndexes[category] = kp_index_list_create(64);
+    }
+
+    for (NSUInteger col = lines.location; col < NSMaxRange(lines); col++) {
         for (NSUInteger row = 1; row < (gridSizeX + 1); row++) {
             double x = mapRect.origin.x + (row - 1) * mapCellSize.width;
             double y = mapRect.origin.y + (col - 1) * mapCellSize.height;
 
             MKMapRect gridRect = MKMapRectMake(x, y, mapCellSize.width, mapCellSize.height);
 
-            NSArray *newAnnotations = [annotationTree annotationsInMapRect:gridRect];
+            // Coordinates, weights and categories come from the tree arrays: no message is sent to annotations
+            [annotationTree enumerateNodesInMapRect:gridRect searchScratch:searchScratch usingBlock:^(kp_treenode_t *node) {
+                NSUInteger idx = node - root;
+                NSUInteger category = categories ? categories[idx] : 0;
 
-            // cluster annotations in this grid piece, if there are annotations to be clustered
-            if (newAnnotations.count > 0) {
-                
-                id annotation = [[KPAnnotation alloc] initWithAnnotations:newAnnotations];
-                [newClusters addObject:annotation];
+                kp_index_list_append(cellNodeIndexes + category, idx);
+            }];
 
-                kp_cluster_t *cluster = clusterGrid[col] + row;
-                
-                cluster->mapRect = gridRect;
-                cluster->annotationIndex = clusterIndex;
-                cluster->state = KPClusterStateHasData;
+            for (NSUInteger category = 0; category < categoriesCount; category++) {
+                kp_index_list_t *nodeIndexes = cellNodeIndexes + category;
 
-                cluster->distributionQuadrant = KPClusterDistributionQuadrantForPointInsideMapRect(gridRect, MKMapPointForCoordinate([annotation coordinate]));
+                kp_cluster_t *cluster = clusterGrids[category][col] + row;
 
-                clusterIndex++;
-            } else {
-                clusterGrid[col][row].state = KPClusterStateEmpty;
+                // cluster annotations in this grid piece, if there are annotations to be clustered
+                if (nodeIndexes->count > 0) {
+                    kp_annotation_statistics_t statistics = KPAnnotationStatisticsMake();
+
+                    KPAnnotationStatisticsAddCoordinatesAtIndexes(&statistics, coordinates, weights, nodeIndexes->indexes, nodeIndexes->count);
+
+                    KPAnnotation *annotation = [[KPAnnotation alloc] initWithAnnotationTree:annotationTree
+                                                                                nodeIndexes:nodeIndexes->indexes
+                                                                                 statistics:statistics];
+                    annotation.clusteringCategory = category;
+
+                    cluster->mapRect = gridRect;
+                    cluster->annotationIndex = clusters.count;
+                    cluster->state = KPClusterStateHasData;
+
+                    cluster->distributionQuadrant = KPClusterDistributionQuadrantForPointInsideMapRect(gridRect, MKMapPointForCoordinate(annotation.coordinate));
+
+                    [clusters addObject:annotation];
+
+                    kp_index_list_clear(nodeIndexes);
+                } else {
+                    cluster->state = KPClusterStateEmpty;
+                }
             }
         }
     }
-    
-    if (self.clusteringStrategy == KPGridClusteringAlgorithmStrategyTwoPhase) {
-        
-        newClusters = (NSMutableArray *)[self _mergeOverlappingClusters:newClusters
-                                                              inMapView:mapView
-                                                            clusterGrid:clusterGrid
-                                                              gridSizeX:gridSizeX
-                                                              gridSizeY:gridSizeY];
+
+    for (NSUInteger category = 0; category < categoriesCount; category++) {
+        kp_index_list_free(cellNodeIndexes + category);
     }
 
-    KPClusterGridFree(clusterGrid, gridSizeX, gridSizeY);
-    return newClusters;
+    free(cellNodeIndexes);
 }
 
-#pragma mark - Private
+/*
+ Parallel version of the grid pass: every band of grid lines is clustered by its own worker
+ which has its own search scratch and its own output array, so workers share nothing but the read-only tree.
+ Band results are then concatenated in band order and annotation indexes are shifted accordingly,
+ which gives exactly the same output as the serial pass.
+ */
+- (NSMutableArray *)_clusterAnnotationsInBands:(NSUInteger)bandCount
+                                     ofMapRect:(MKMapRect)mapRect
+                                   mapCellSize:(MKMapSize)mapCellSize
+                                annotationTree:(KPAnnotationTree *)annotationTree
+                                  clusterGrids:(kp_cluster_t ***)clusterGrids
+                               categoriesCount:(NSUInteger)categoriesCount
+                                     gridSizeX:(NSUInteger)gridSizeX
+                                     gridSizeY:(NSUInteger)gridSizeY
+{
+    NSUInteger linesPerBand = (gridSizeY + bandCount - 1) / bandCount;
+
+    NSMutableArray *bands = [[NSMutableArray alloc] initWithCapacity:bandCount];
+
+    for (NSUInteger band = 0; band < bandCount; band++) {
+        [bands addObject:[[NSMutableArray alloc] initWithCapacity:(gridSizeX * linesPerBand)]];
+    }
+
+    kp_2dtree_t tree = annotationTree.tree;
+
+    dispatch_apply(bandCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t band) {
+        NSUInteger firstLine = 1 + band * linesPerBand;
+
+        if (firstLine > gridSizeY) {
+            return;
+        }
+
+        NSRange lines = NSMakeRange(firstLine, MIN(linesPerBand, gridSizeY + 1 - firstLine));
+
+        kp_2dtree_t bandTree = tree;
+        kp_2dtree_search_scratch_t scratch = kp_2dtree_search_scratch_create(&bandTree);
+
+        [self _clusterAnnotationsInGridLines:lines
+                                   ofMapRect:mapRect
+                                 mapCellSize:mapCellSize
+                              annotationTree:annotationTree
+                               searchScratch:&scratch
+                                clusterGrids:clusterGrids
+                             categoriesCount:categoriesCount
+                                   gridSizeX:gridSizeX
+                                   intoArray:bands[band]];
+
+        kp_2dtree_search_scratch_free(&scratch);
+    });
+
+    NSMutableArray *clusters = [[NSMutableArray alloc] initWithCapacity:(gridSizeX * gridSizeY)];
+
+    for (NSUInteger band = 0; band < bandCount; band++) {
+        NSUInteger firstLine = 1 + band * linesPerBand;
+        NSUInteger indexOffset = clusters.count;
+
+        if (indexOffset > 0) {
+            for (NSUInteger category = 0; category < categoriesCount; category++) {
+                kp_cluster_t **clusterGrid = clusterGrids[category];
+
+                for (NSUInteger col = firstLine; col < MIN(firstLine + linesPerBand, gridSizeY + 1); col++) {
+                    for (NSUInteger row = 1; row < (gridSizeX + 1); row++) {
+                        if (clusterGrid[col][row].state == KPClusterStateHasData) {
+                            clusterGrid[col][row].annotationIndex += indexOffset;
+                        }
+                    }
+                }
+            }
+        }
+
+        [clusters addObjectsFromArray:bands[band]];
+    }
+
+    return clusters;
+}
+
+- (NSUInteger)_parallelClusteringBandCountForGridSizeY:(NSUInteger)gridSizeY {
+    if (self.parallelClustering == NO) {
+        return 1;
+    }
+
+    NSUInteger bandCount = self.parallelClusteringBandCount;
+
+    if (bandCount == 0) {
+        bandCount = [[NSProcessInfo processInfo] activeProcessorCount];
+    }
+
+    return MAX(1, MIN(bandCount, gridSizeY));
+}
 
 - (MKMapSize)mapCellSizeForGridSize:(CGSize)gridSize inMapView:(MKMapView *)mapView {
     // Calculate the grid size in terms of MKMapPoints.
-    double widthPercentage =  gridSize.width / CGRectGetWidth(mapView.frame);
-    double heightPercentage = gridSize.height / CGRectGetHeight(mapView.frame);
+    kp_map_projection_t projection = KPMapProjectionMake(mapView.visibleMapRect, mapView.frame.size);
 
-    MKMapSize cellSize = MKMapSizeMake(
-                                       ceil(widthPercentage  * mapView.visibleMapRect.size.width),
-                                       ceil(heightPercentage * mapView.visibleMapRect.size.height)
-                                       );
-
-    return cellSize;
+    return KPMapProjectionGetMapSizeForSize(&projection, gridSize);
 }
 
 - (void)_ensureStrategyIntegrity {
-    if (self.clusteringStrategy == KPGridClusteringAlgorithmStrategyTwoPhase &&
+    if (self.clusteringStrategy != KPGridClusteringAlgorithmStrategyBasic &&
         CGSizeEqualToSize(self.annotationSize, CGSizeZero)) {
-        NSString *failureReason = @"annotationSize must be set when using two phase strategy";
+        NSString *failureReason = @"annotationSize must be set when using two phase or collision resolution strategy";
 
         @throw [NSException exceptionWithName:NSGenericException reason:failureReason userInfo:nil];
     }
 }
 
 - (NSArray *)_mergeOverlappingClusters:(NSArray *)clusters
-                             inMapView:(MKMapView *)mapView
+                            projection:(kp_map_projection_t)projection
                            clusterGrid:(kp_cluster_t **)clusterGrid
                              gridSizeX:(NSUInteger)gridSizeX
                              gridSizeY:(NSUInteger)gridSizeY
 
 {
-    
-    __block NSMutableArray *mutableClusters = [NSMutableArray arrayWithArray:clusters];
-    __block NSMutableIndexSet *indexesOfClustersToBeRemovedAsMerged = [NSMutableIndexSet indexSet];
-    
+    return [self _mergeOverlappingClusters:clusters
+                                projection:projection
+                              clusterGrids:&clusterGrid
+                           categoriesCount:1
+                                 gridSizeX:gridSizeX
+                                 gridSizeY:gridSizeY];
+}
+
+// Clusters are merged only with clusters of the same grid, i.e. of the same category
+- (NSArray *)_mergeOverlappingClusters:(NSArray *)clusters
+                            projection:(kp_map_projection_t)projection
+                          clusterGrids:(kp_cluster_t ***)clusterGrids
+                       categoriesCount:(NSUInteger)categoriesCount
+                             gridSizeX:(NSUInteger)gridSizeX
+                             gridSizeY:(NSUInteger)gridSizeY
+{
+    NSUInteger clustersCount = clusters.count;
+
+    /*
+     Merges are done on per-cluster statistics (weights and weighted coordinate sums) with a union-find over cluster indexes,
+     so that every merge is O(1). KPAnnotations of merged clusters are created only once, after merging is finished.
+     */
+    kp_annotation_statistics_t *aggregates = malloc(clustersCount * sizeof(kp_annotation_statistics_t));
+    NSUInteger *parents = malloc(clustersCount * sizeof(NSUInteger));
+
+    // Memoized coord -> view point projections, NAN means that the point must be (re)calculated
+    CGPoint *pointsInMapView = malloc(clustersCount * sizeof(CGPoint));
+
+    for (NSUInteger idx = 0; idx < clustersCount; idx++) {
+        KPAnnotation *cluster = clusters[idx];
+
+        aggregates[idx] = cluster.statistics;
+        parents[idx] = idx;
+        pointsInMapView[idx] = CGPointMake(NAN, NAN);
+    }
+
+    CGPoint (^pointInMapViewForClusterIndex)(NSUInteger) = ^CGPoint(NSUInteger idx) {
+        if (isnan(pointsInMapView[idx].x)) {
+            pointsInMapView[idx] = KPMapProjectionGetPointForCoordinate(&projection, KPAnnotationStatisticsGetCentroid(aggregates + idx));
+        }
+
+        return pointsInMapView[idx];
+    };
+
     kp_cluster_merge_block_t checkClustersAndMergeIfNeeded = ^(kp_cluster_t *cl1, kp_cluster_t *cl2) {
 
         NSCAssert(cl1 && cl1->state == KPClusterStateHasData, nil);
         NSCAssert(cl2 && cl2->state == KPClusterStateHasData, nil);
 
-        NSCAssert(cl1->annotationIndex >= 0 && cl1->annotationIndex < gridSizeX * gridSizeY, nil);
-        NSCAssert(cl2->annotationIndex >= 0 && cl2->annotationIndex < gridSizeX * gridSizeY, nil);
+        NSCAssert(cl1->annotationIndex >= 0 && cl1->annotationIndex < clustersCount, nil);
+        NSCAssert(cl2->annotationIndex >= 0 && cl2->annotationIndex < clustersCount, nil);
+
+        NSUInteger index1 = cl1->annotationIndex;
+        NSUInteger index2 = cl2->annotationIndex;
+
+        // Cells having data are always roots: the cell of absorbed cluster becomes KPClusterStateMerged
+        NSCAssert(parents[index1] == index1 && parents[index2] == index2, nil);
+
+        BOOL clustersIntersect = [self clusterAtPoint:pointInMapViewForClusterIndex(index1)
+                                intersectsClusterAtPoint:pointInMapViewForClusterIndex(index2)];
 
-        KPAnnotation *cluster1 = [mutableClusters objectAtIndex:cl1->annotationIndex];
-        KPAnnotation *cluster2 = [mutableClusters objectAtIndex:cl2->annotationIndex];
-        
-        BOOL clustersIntersect = [self clusterIntersects:cluster1 anotherCluster:cluster2 inMapView:mapView];
-        
         if (clustersIntersect) {
-            NSMutableSet *combinedSet = [NSMutableSet setWithSet:cluster1.annotations];
-            [combinedSet unionSet:cluster2.annotations];
-            
-            KPAnnotation *newAnnotation = [[KPAnnotation alloc] initWithAnnotationSet:combinedSet];
-            
-            MKMapPoint newClusterMapPoint = MKMapPointForCoordinate(newAnnotation.coordinate);
-            
-            if (MKMapRectContainsPoint(cl1->mapRect, newClusterMapPoint)) {
-                [indexesOfClustersToBeRemovedAsMerged addIndex:cl2->annotationIndex];
+            kp_annotation_statistics_t unionAggregate = KPAnnotationStatisticsUnion(aggregates + index1, aggregates + index2);
+
+            // Centroid of merged cluster is weighted, so the heavier cluster pulls the merged one towards itself
+            MKMapPoint newClusterMapPoint = MKMapPointForCoordinate(KPAnnotationStatisticsGetCentroid(&unionAggregate));
 
+            if (MKMapRectContainsPoint(cl1->mapRect, newClusterMapPoint)) {
                 cl2->state = KPClusterStateMerged;
 
-                mutableClusters[cl1->annotationIndex] = newAnnotation;
-                
+                parents[index2] = index1;
+                aggregates[index1] = unionAggregate;
+                pointsInMapView[index1].x = NAN;
+
                 cl1->distributionQuadrant = KPClusterDistributionQuadrantForPointInsideMapRect(cl1->mapRect, newClusterMapPoint);
-                
+
                 return KPClusterMergeResultCurrent;
             } else {
-                [indexesOfClustersToBeRemovedAsMerged addIndex:cl1->annotationIndex];
                 cl1->state = KPClusterStateMerged;
 
-                mutableClusters[cl2->annotationIndex] = newAnnotation;
-                
+                parents[index1] = index2;
+                aggregates[index2] = unionAggregate;
+                pointsInMapView[index2].x = NAN;
+
                 cl2->distributionQuadrant = KPClusterDistributionQuadrantForPointInsideMapRect(cl2->mapRect, newClusterMapPoint);
-                
+
                 return KPClusterMergeResultOther;
             }
         }
-        
+
         return KPClusterMergeResultNone;
     };
 
@@ -216,99 +672,73 @@ static CGPoint CGPointFromNSValue(NSValue *value) {
     
     KPClusterMergeResult mergeResult;
 
-    for (uint16_t col = 1; col < (gridSizeY + 2); col++) {
-        for (uint16_t row = 1; row < (gridSizeX + 2); row++) {
-        loop_with_explicit_col_and_row:
+    for (NSUInteger category = 0; category < categoriesCount; category++) {
+        kp_cluster_t **clusterGrid = clusterGrids[category];
+
+        for (uint16_t col = 1; col < (gridSizeY + 2); col++) {
+            for (uint16_t row = 1; row < (gridSizeX + 2); row++) {
+            loop_with_explicit_col_and_row:
             
-            NSCAssert(col > 0, nil);
-            NSCAssert(row > 0, nil);
+                NSCAssert(col > 0, nil);
+                NSCAssert(row > 0, nil);
             
-            currentClusterPosition.col = col;
-            currentClusterPosition.row = row;
+                currentClusterPosition.col = col;
+                currentClusterPosition.row = row;
 
-            currentCellCluster = clusterGrid[col] + row;
+                currentCellCluster = clusterGrid[col] + row;
 
-            if (currentCellCluster->state != KPClusterStateHasData) {
-                continue;
-            }
+                if (currentCellCluster->state != KPClusterStateHasData) {
+                    continue;
+                }
             
-            // we take log2f, because we need to transform KPClusterDistributionQuadrant which is one of the
-            // 1, 2, 4, 8 into array index: 0, 1, 2, 3, which we will use for lookups on the next step
-            int lookupIndexForCurrentCellQuadrant = log2f(currentCellCluster->distributionQuadrant);
+                // we take log2f, because we need to transform KPClusterDistributionQuadrant which is one of the
+                // 1, 2, 4, 8 into array index: 0, 1, 2, 3, which we will use for lookups on the next step
+                int lookupIndexForCurrentCellQuadrant = log2f(currentCellCluster->distributionQuadrant);
             
-            // Checking adjacent clusters
-            for (int adjacentClustersPositionIndex = 0; adjacentClustersPositionIndex < 3; adjacentClustersPositionIndex++) {
-                int adjacentClusterLocation = KPClusterAdjacentClusterLocationsTable[lookupIndexForCurrentCellQuadrant][adjacentClustersPositionIndex];
+                // Checking adjacent clusters
+                for (int adjacentClustersPositionIndex = 0; adjacentClustersPositionIndex < 3; adjacentClustersPositionIndex++) {
+                    int adjacentClusterLocation = KPClusterAdjacentClusterLocationsTable[lookupIndexForCurrentCellQuadrant][adjacentClustersPositionIndex];
                 
-                adjacentClusterPosition.col = currentClusterPosition.col + KPAdjacentClusterPositionDeltas[adjacentClusterLocation][0];
-                adjacentClusterPosition.row = currentClusterPosition.row + KPAdjacentClusterPositionDeltas[adjacentClusterLocation][1];
+                    adjacentClusterPosition.col = currentClusterPosition.col + KPAdjacentClusterPositionDeltas[adjacentClusterLocation][0];
+                    adjacentClusterPosition.row = currentClusterPosition.row + KPAdjacentClusterPositionDeltas[adjacentClusterLocation][1];
 
-                adjacentCellCluster = clusterGrid[adjacentClusterPosition.col] + adjacentClusterPosition.row;
+                    adjacentCellCluster = clusterGrid[adjacentClusterPosition.col] + adjacentClusterPosition.row;
 
-                // In third condition we use bitwise AND ('&') to check if adjacent cell has distribution of its cluster point which is _complementary_ to a one of the current cell. If it is so, than it worth to make a merge check.
-                if (adjacentCellCluster->state == KPClusterStateHasData && (KPClusterConformityTable[adjacentClusterLocation] & adjacentCellCluster->distributionQuadrant) != 0) {
-                    mergeResult = checkClustersAndMergeIfNeeded(currentCellCluster, adjacentCellCluster);
+                    // In third condition we use bitwise AND ('&') to check if adjacent cell has distribution of its cluster point which is _complementary_ to a one of the current cell. If it is so, than it worth to make a merge check.
+                    if (adjacentCellCluster->state == KPClusterStateHasData && (KPClusterConformityTable[adjacentClusterLocation] & adjacentCellCluster->distributionQuadrant) != 0) {
+                        mergeResult = checkClustersAndMergeIfNeeded(currentCellCluster, adjacentCellCluster);
                     
-                    // The case when other cluster did adsorb current cluster into itself. This means that we must not continue looking for adjacent clusters because we don't have a current cell now.
-                    if (mergeResult == KPClusterMergeResultOther) {
-                        // If this other cluster lies upstream (behind current i,j cell), we revert back to its [i,j] coordinate and continue looping
-                        if (KPClusterGridCellPositionCompareWithPosition(&currentClusterPosition, &adjacentClusterPosition) == NSOrderedDescending) {
+                        // The case when other cluster did adsorb current cluster into itself. This means that we must not continue looking for adjacent clusters because we don't have a current cell now.
+                        if (mergeResult == KPClusterMergeResultOther) {
+                            // If this other cluster lies upstream (behind current i,j cell), we revert back to its [i,j] coordinate and continue looping
+                            if (KPClusterGridCellPositionCompareWithPosition(&currentClusterPosition, &adjacentClusterPosition) == NSOrderedDescending) {
                             
-                            col = adjacentClusterPosition.col;
-                            row = adjacentClusterPosition.row;
+                                col = adjacentClusterPosition.col;
+                                row = adjacentClusterPosition.row;
                             
-                            goto loop_with_explicit_col_and_row;
-                        }
+                                goto loop_with_explicit_col_and_row;
+                            }
                         
-                        break; // This breaks from "Checking adjacent clusters"
+                            break; // This breaks from "Checking adjacent clusters"
+                        }
                     }
                 }
             }
         }
     }
-    
-    // We remove all the indexes of merged clusters that were accumulated by checkClustersAndMergeIfNeeded()
-    [mutableClusters removeObjectsAtIndexes:indexesOfClustersToBeRemovedAsMerged];
-    
-    return mutableClusters;
+
+    NSArray *mergedClusters = KPClusterUnionFindCollectClusters(clusters, parents, aggregates);
+
+    free(pointsInMapView);
+    free(parents);
+    free(aggregates);
+
+    return mergedClusters;
 }
 
-- (BOOL)clusterIntersects:(KPAnnotation *)clusterAnnotation
-           anotherCluster:(KPAnnotation *)anotherClusterAnnotation
-                inMapView:(MKMapView *)mapView
-{
-    
-    // calculate CGRects for each annotation, memoizing the coord -> point conversion as we go
-    // if the two views overlap, merge them
-    
-    if (clusterAnnotation._annotationPointInMapView == nil) {
-        clusterAnnotation._annotationPointInMapView = NSValueFromCGPoint([mapView convertCoordinate:clusterAnnotation.coordinate
-                                                                                             toPointToView:mapView]);
-    }
-    
-    if (anotherClusterAnnotation._annotationPointInMapView == nil) {
-        anotherClusterAnnotation._annotationPointInMapView = NSValueFromCGPoint([mapView convertCoordinate:anotherClusterAnnotation.coordinate
-                                                                                                    toPointToView:mapView]);
-    }
-    
-    CGPoint p1 = CGPointFromNSValue(clusterAnnotation._annotationPointInMapView);
-    CGPoint p2 = CGPointFromNSValue(anotherClusterAnnotation._annotationPointInMapView);
-    
-    CGRect r1 = CGRectMake(
-                           p1.x - self.annotationSize.width + self.annotationCenterOffset.x,
-                           p1.y - self.annotationSize.height + self.annotationCenterOffset.y,
-                           self.annotationSize.width,
-                           self.annotationSize.height
-                           );
-    
-    CGRect r2 = CGRectMake(
-                           p2.x - self.annotationSize.width + self.annotationCenterOffset.x,
-                           p2.y - self.annotationSize.height + self.annotationCenterOffset.y,
-                           self.annotationSize.width,
-                           self.annotationSize.height
-                           );
-    
-    return CGRectIntersectsRect(r1, r2);
+- (BOOL)clusterAtPoint:(CGPoint)p1 intersectsClusterAtPoint:(CGPoint)p2 {
+    // calculate CGRects for each annotation, if the two views overlap, merge them
+    return KPClusterAnnotationViewsIntersect(p1, p2, self.annotationSize, self.annotationCenterOffset);
 }
 
 @end
@@ -16,6 +16,14 @@
 
 #import "KPGridClusteringAlgorithm.h"
 
+#import "KPAnnotation_Private.h"
+#import "KPAnnotationTree.h"
+#import "KPAttributeReducer_Private.h"
+#import "KPGeometry.h"
+
+#import "kp_index_list.h"
+#import "kp_spatial_hash.h"
+
 /*
  Cell of cluster grid
  --------
@@ -192,14 +200,309 @@ typedef NS_ENUM(NSInteger, KPClusterMergeResult) {
 
 typedef KPClusterMergeResult(^kp_cluster_merge_block_t)(kp_cluster_t *, kp_cluster_t *);
 
+/*
+ Union-find over cluster indexes (kp_cluster_t.annotationIndex): parents[index] == index for a root.
+ A root is always the index of the cluster which did absorb the others, path halving keeps lookups near O(1).
+ */
+static inline NSUInteger KPClusterUnionFindRoot(NSUInteger *parents, NSUInteger index) {
+    while (parents[index] != index) {
+        parents[index] = parents[parents[index]];
+        index = parents[index];
+    }
+
+    return index;
+}
+
+/*
+ Clusters after union-find merging: every root gets a KPAnnotation of the annotations of all clusters merged into it, built once from its aggregate.
+ When all merged clusters index the same tree, their node indexes are concatenated and annotations sets are not materialised.
+ Merged clusters are dropped, every root keeps its position, so the order is the same as before merging.
+ */
+static inline NSArray *KPClusterUnionFindCollectClusters(NSArray *clusters, NSUInteger *parents, kp_annotation_statistics_t *aggregates) {
+    NSUInteger clustersCount = clusters.count;
+
+    // Build the member lists of every root: firstMembers[root] -> nextMembers[member] -> ... -> NSNotFound
+    NSUInteger *firstMembers = malloc(clustersCount * sizeof(NSUInteger));
+    NSUInteger *nextMembers = malloc(clustersCount * sizeof(NSUInteger));
+
+    for (NSUInteger idx = 0; idx < clustersCount; idx++) {
+        firstMembers[idx] = NSNotFound;
+    }
+
+    for (NSUInteger idx = clustersCount; idx > 0; idx--) {
+        NSUInteger member = idx - 1;
+        NSUInteger root = KPClusterUnionFindRoot(parents, member);
+
+        nextMembers[member] = firstMembers[root];
+        firstMembers[root] = member;
+    }
+
+    NSMutableArray *mergedClusters = [NSMutableArray arrayWithCapacity:clustersCount];
+
+    kp_index_list_t combinedNodeIndexes = kp_index_list_create(64);
+
+    for (NSUInteger idx = 0; idx < clustersCount; idx++) {
+        if (parents[idx] != idx) {
+            continue;
+        }
+
+        if (nextMembers[firstMembers[idx]] == NSNotFound) {
+            [mergedClusters addObject:clusters[idx]];
+
+            continue;
+        }
+
+        KPAnnotationTree *annotationTree = [clusters[idx] annotationTree];
+
+        for (NSUInteger member = firstMembers[idx]; member != NSNotFound && annotationTree; member = nextMembers[member]) {
+            KPAnnotation *cluster = clusters[member];
+
+            if (cluster.annotationTree != annotationTree) {
+                annotationTree = nil;
+            }
+        }
+
+        KPAnnotation *mergedCluster;
+
+        if (annotationTree) {
+            NSArray *attributeReducers = annotationTree.attributeReducers;
+            double *combinedValues = NULL;
+
+            // Values of attribute reducers are combined from the merged clusters, not reduced again over their members
+            if (attributeReducers.count > 0) {
+                combinedValues = malloc(attributeReducers.count * sizeof(double));
+
+                for (NSUInteger reducerIdx = 0; reducerIdx < attributeReducers.count; reducerIdx++) {
+                    combinedValues[reducerIdx] = KPAttributeReducerOperationGetIdentity([attributeReducers[reducerIdx] operation]);
+                }
+            }
+
+            kp_index_list_clear(&combinedNodeIndexes);
+
+            for (NSUInteger member = firstMembers[idx]; member != NSNotFound; member = nextMembers[member]) {
+                KPAnnotation *cluster = clusters[member];
+
+                kp_index_list_append_indexes(&combinedNodeIndexes, cluster.nodeIndexes, cluster.statistics.count);
+
+                for (NSUInteger reducerIdx = 0; reducerIdx < attributeReducers.count; reducerIdx++) {
+                    combinedValues[reducerIdx] = KPAttributeReducerOperationReduce([attributeReducers[reducerIdx] operation],
+                                                                                   combinedValues[reducerIdx],
+                                                                                   cluster.reducedValues[reducerIdx]);
+                }
+            }
+
+            mergedCluster = [[KPAnnotation alloc] initWithAnnotationTree:annotationTree
+                                                             nodeIndexes:combinedNodeIndexes.indexes
+                                                              statistics:aggregates[idx]
+                                                           reducedValues:combinedValues];
+
+            free(combinedValues);
+        } else {
+            NSMutableSet *combinedSet = [NSMutableSet setWithCapacity:aggregates[idx].count];
+
+            for (NSUInteger member = firstMembers[idx]; member != NSNotFound; member = nextMembers[member]) {
+                [combinedSet unionSet:[clusters[member] annotations]];
+            }
+
+            mergedCluster = [[KPAnnotation alloc] initWithAnnotationSet:combinedSet statistics:aggregates[idx]];
+        }
+
+        mergedCluster.clusteringCategory = [clusters[idx] clusteringCategory];
+
+        [mergedClusters addObject:mergedCluster];
+    }
+
+    kp_index_list_free(&combinedNodeIndexes);
+
+    free(firstMembers);
+    free(nextMembers);
+
+    return mergedClusters;
+}
+
+// Whether annotation views of annotationSize placed at two points on screen overlap
+static inline BOOL KPClusterAnnotationViewsIntersect(CGPoint p1, CGPoint p2, CGSize annotationSize, CGPoint annotationCenterOffset) {
+    CGRect r1 = CGRectMake(
+                           p1.x - annotationSize.width + annotationCenterOffset.x,
+                           p1.y - annotationSize.height + annotationCenterOffset.y,
+                           annotationSize.width,
+                           annotationSize.height
+                           );
+
+    CGRect r2 = CGRectMake(
+                           p2.x - annotationSize.width + annotationCenterOffset.x,
+                           p2.y - annotationSize.height + annotationCenterOffset.y,
+                           annotationSize.width,
+                           annotationSize.height
+                           );
+
+    return CGRectIntersectsRect(r1, r2);
+}
+
+// Collision resolution stops after this number of sweeps even if merged clusters still overlap
+static const NSUInteger KPClusterCollisionResolutionMaximumSweeps = 8;
+
+/*
+ Second phase of KPGridClusteringAlgorithmStrategyCollisionResolution: merges clusters of the same category whose annotation views overlap on screen,
+ wherever they are. Every sweep puts the points of remaining clusters into a spatial hash with buckets of annotationSize:
+ views of the same size can only overlap if their points are in the same or adjacent buckets, so every cluster is checked against 3 x 3 buckets.
+ Merges are done on aggregates with union-find as in -_mergeOverlappingClusters:. A merged cluster moves, so sweeps are repeated
+ while they merge anything: every sweep but the last one removes at least one cluster, so this terminates,
+ and sweeps are also bounded by KPClusterCollisionResolutionMaximumSweeps. Every sweep is linear in the number of clusters.
+ */
+static inline NSArray *KPClusterResolveCollisions(NSArray *clusters, kp_map_projection_t *projection, CGSize annotationSize, CGPoint annotationCenterOffset) {
+    NSUInteger clustersCount = clusters.count;
+
+    if (clustersCount < 2) {
+        return clusters;
+    }
+
+    kp_annotation_statistics_t *aggregates = malloc(clustersCount * sizeof(kp_annotation_statistics_t));
+    NSUInteger *parents = malloc(clustersCount * sizeof(NSUInteger));
+    NSUInteger *categories = malloc(clustersCount * sizeof(NSUInteger));
+    CGPoint *pointsInMapView = malloc(clustersCount * sizeof(CGPoint));
+
+    // Remaining clusters (roots), compacted after every sweep
+    NSUInteger *roots = malloc(clustersCount * sizeof(NSUInteger));
+    NSUInteger rootsCount = clustersCount;
+
+    // Buckets of roots as they were inserted into the hash in the current sweep
+    int64_t *bucketsX = malloc(clustersCount * sizeof(int64_t));
+    int64_t *bucketsY = malloc(clustersCount * sizeof(int64_t));
+
+    for (NSUInteger idx = 0; idx < clustersCount; idx++) {
+        KPAnnotation *cluster = clusters[idx];
+
+        aggregates[idx] = cluster.statistics;
+        parents[idx] = idx;
+        categories[idx] = cluster.clusteringCategory;
+        pointsInMapView[idx] = KPMapProjectionGetPointForCoordinate(projection, KPAnnotationStatisticsGetCentroid(aggregates + idx));
+        roots[idx] = idx;
+    }
+
+    kp_spatial_hash_t hash = kp_spatial_hash_create(clustersCount);
+
+    for (NSUInteger sweep = 0; sweep < KPClusterCollisionResolutionMaximumSweeps; sweep++) {
+        kp_spatial_hash_clear(&hash);
+
+        for (NSUInteger rootIdx = 0; rootIdx < rootsCount; rootIdx++) {
+            NSUInteger idx = roots[rootIdx];
+
+            bucketsX[idx] = (int64_t)floor(pointsInMapView[idx].x / annotationSize.width);
+            bucketsY[idx] = (int64_t)floor(pointsInMapView[idx].y / annotationSize.height);
+
+            kp_spatial_hash_insert(&hash, bucketsX[idx], bucketsY[idx], idx);
+        }
+
+        BOOL merged = NO;
+
+        for (NSUInteger rootIdx = 0; rootIdx < rootsCount; rootIdx++) {
+            NSUInteger idx = roots[rootIdx];
+
+            if (parents[idx] != idx) {
+                continue; // absorbed earlier in this sweep
+            }
+
+            for (int64_t dy = -1; dy <= 1; dy++) {
+                for (int64_t dx = -1; dx <= 1; dx++) {
+                    NSUInteger other = kp_spatial_hash_first(&hash, bucketsX[idx] + dx, bucketsY[idx] + dy);
+
+                    for (; other != NSNotFound; other = hash.next[other]) {
+                        if (other == idx || parents[other] != other || categories[other] != categories[idx]) {
+                            continue;
+                        }
+
+                        if (KPClusterAnnotationViewsIntersect(pointsInMapView[idx], pointsInMapView[other], annotationSize, annotationCenterOffset) == NO) {
+                            continue;
+                        }
+
+                        aggregates[idx] = KPAnnotationStatisticsUnion(aggregates + idx, aggregates + other);
+                        parents[other] = idx;
+                        pointsInMapView[idx] = KPMapProjectionGetPointForCoordinate(projection, KPAnnotationStatisticsGetCentroid(aggregates + idx));
+
+                        merged = YES;
+                    }
+                }
+            }
+        }
+
+        if (merged == NO) {
+            break;
+        }
+
+        NSUInteger remainingRootsCount = 0;
+
+        for (NSUInteger rootIdx = 0; rootIdx < rootsCount; rootIdx++) {
+            if (parents[roots[rootIdx]] == roots[rootIdx]) {
+                roots[remainingRootsCount++] = roots[rootIdx];
+            }
+        }
+
+        rootsCount = remainingRootsCount;
+    }
+
+    NSArray *mergedClusters = KPClusterUnionFindCollectClusters(clusters, parents, aggregates);
+
+    kp_spatial_hash_free(&hash);
+
+    free(bucketsX);
+    free(bucketsY);
+    free(roots);
+    free(pointsInMapView);
+    free(categories);
+    free(parents);
+    free(aggregates);
+
+    return mergedClusters;
+}
+
+/*
+ Tile-aligned clustering: a tile is a square of KPGridTileSizeInCells x KPGridTileSizeInCells cells.
+ Cell side is a power of two in map points, so tiles are the tiles z/x/y of a power-of-two pyramid:
+ zoom level z has 2^z x 2^z tiles covering MKMapRectWorld.
+ */
+static const NSUInteger KPGridTileSizeInCells = 8;
+
+// Power of two closest to the larger side of gridSize in map points at the current zoom, i.e. zoom level is quantized
+static inline double KPGridTileAlignedCellSide(kp_map_projection_t *projection, CGSize gridSize) {
+    double side = MAX(gridSize.width, gridSize.height) / projection->scaleX;
+
+    double exponent = round(log2(side));
+    double maximumExponent = log2(MKMapSizeWorld.width / KPGridTileSizeInCells);
+
+    return exp2(MAX(0, MIN(exponent, maximumExponent)));
+}
+
+// Cluster of a memoized tile together with its cell inside the tile
+typedef struct {
+    kp_cluster_t cluster; // annotationIndex is the index in the clusters of the tile
+    kp_annotation_statistics_t statistics;
+    NSUInteger firstNodeIndex; // members are statistics.count node indexes of the tile starting from this one
+    uint16_t col;
+    uint16_t row;
+    NSUInteger category;
+} kp_grid_tile_cell_t;
+
 @interface KPGridClusteringAlgorithm (Private)
 
+// Does not touch MKMapView: everything it needs from map view is captured by projection.
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                              projection:(kp_map_projection_t)projection
+                          annotationTree:(KPAnnotationTree *)annotationTree;
+
 - (MKMapSize)mapCellSizeForGridSize:(CGSize)gridSize inMapView:(MKMapView *)mapView;
 
 - (NSArray *)_mergeOverlappingClusters:(NSArray *)clusters
-                             inMapView:(MKMapView *)mapView
+                            projection:(kp_map_projection_t)projection
                            clusterGrid:(kp_cluster_t **)clusterGrid
                              gridSizeX:(NSUInteger)gridSizeX
                              gridSizeY:(NSUInteger)gridSizeY;
 
+- (NSArray *)_mergeOverlappingClusters:(NSArray *)clusters
+                            projection:(kp_map_projection_t)projection
+                          clusterGrids:(kp_cluster_t ***)clusterGrids
+                       categoriesCount:(NSUInteger)categoriesCount
+                             gridSizeX:(NSUInteger)gridSizeX
+                             gridSizeY:(NSUInteger)gridSizeY;
+
 @end
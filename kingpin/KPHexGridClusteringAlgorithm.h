@@ -0,0 +1,38 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import "KPClusteringAlgorithm.h"
+#import "KPGridClusteringAlgorithm.h"
+
+/**
+ Grid clustering on hexagonal cells. Every point of a hexagon is closer to its center than points of a square cell of the same area,
+ and all six neighbours of a hexagon are equally far, so clusters are not stretched along the diagonals of the grid.
+ Annotations are binned into hexagons in a single traversal of the 2-d tree.
+ */
+@interface KPHexGridClusteringAlgorithm : NSObject <KPClusteringAlgorithm>
+
+/// Distance in points on screen from the center of hexagonal cell to its corners, default is 35
+/// (a hexagon of about the same area as 60 x 60 cell of KPGridClusteringAlgorithm)
+@property (assign, nonatomic) CGFloat hexagonRadius;
+
+@property (assign, nonatomic) KPGridClusteringAlgorithmStrategy clusteringStrategy;
+
+// only used when using KPGridClusteringAlgorithmStrategyTwoPhase or KPGridClusteringAlgorithmStrategyCollisionResolution
+@property (assign, nonatomic) CGSize annotationSize;
+@property (assign, nonatomic) CGPoint annotationCenterOffset;
+
+@end
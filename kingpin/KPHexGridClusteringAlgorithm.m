@@ -0,0 +1,348 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <MapKit/MapKit.h>
+
+#import "KPHexGridClusteringAlgorithm.h"
+#import "KPHexGridClusteringAlgorithm_Private.h"
+
+#import "KPAnnotationTree.h"
+#import "KPAnnotationTree_Private.h"
+#import "KPAnnotation.h"
+#import "KPAnnotation_Private.h"
+
+#import "KPGeometry.h"
+
+@implementation KPHexGridClusteringAlgorithm
+
+- (id)init {
+
+    if ((self = [super init])) {
+        self.clusteringStrategy = KPGridClusteringAlgorithmStrategyBasic;
+        self.hexagonRadius = 35.f;
+    }
+
+    return self;
+}
+
+#pragma mark - KPClusteringAlgorithm
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                           parentMapView:(MKMapView *)mapView
+                          annotationTree:(KPAnnotationTree *)annotationTree
+{
+    kp_map_projection_t projection = KPMapProjectionMake(mapView.visibleMapRect, mapView.frame.size);
+
+    return [self clusterAnnotationsInMapRect:mapRect
+                                  projection:projection
+                              annotationTree:annotationTree];
+}
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                          visibleMapRect:(MKMapRect)visibleMapRect
+                             mapViewSize:(CGSize)mapViewSize
+                          annotationTree:(KPAnnotationTree *)annotationTree
+{
+    return [self clusterAnnotationsInMapRect:mapRect
+                                  projection:KPMapProjectionMake(visibleMapRect, mapViewSize)
+                              annotationTree:annotationTree];
+}
+
+- (NSString *)clusteringConfigurationKey {
+    return [NSString stringWithFormat:@"HexGrid/%g/%ld/%gx%g/%g,%g",
+            self.hexagonRadius, (long)self.clusteringStrategy,
+            self.annotationSize.width, self.annotationSize.height, self.annotationCenterOffset.x, self.annotationCenterOffset.y];
+}
+
+#pragma mark - Private
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                              projection:(kp_map_projection_t)projection
+                          annotationTree:(KPAnnotationTree *)annotationTree
+{
+    [self _ensureStrategyIntegrity];
+
+    kp_2dtree_t tree = annotationTree.tree;
+
+    if (tree.size == 0) {
+        return @[];
+    }
+
+    kp_treenode_t *root = tree.root;
+    CLLocationCoordinate2D *coordinates = tree.coordinates;
+    double *weights = tree.weights;
+
+    double hexagonRadius = self.hexagonRadius / projection.scaleX;
+
+    /*
+     Hexagons which may contain points of mapRect: a point is at most hexagonRadius away from the center of its hexagon vertically
+     and at most half of a hexagon's width horizontally. One more hexagon is added on every side,
+     so that the neighbours of every hexagon can be looked up without bounds checks.
+     */
+    double rowHeight = 1.5 * hexagonRadius;
+    double colWidth = KPHexSqrt3 * hexagonRadius;
+
+    NSInteger firstRow = (NSInteger)floor((MKMapRectGetMinY(mapRect) - hexagonRadius) / rowHeight) - 1;
+    NSInteger lastRow  = (NSInteger)ceil((MKMapRectGetMaxY(mapRect) + hexagonRadius) / rowHeight) + 1;
+    NSInteger firstCol = (NSInteger)floor(MKMapRectGetMinX(mapRect) / colWidth - 1) - 1;
+    NSInteger lastCol  = (NSInteger)ceil(MKMapRectGetMaxX(mapRect) / colWidth + 0.5) + 1;
+
+    NSUInteger rowsCount = lastRow - firstRow + 1;
+    NSUInteger colsCount = lastCol - firstCol + 1;
+    NSUInteger cellsCount = rowsCount * colsCount;
+
+    kp_hex_cell_t *cells = malloc(cellsCount * sizeof(kp_hex_cell_t));
+
+    for (NSUInteger cellIdx = 0; cellIdx < cellsCount; cellIdx++) {
+        cells[cellIdx].statistics = KPAnnotationStatisticsMake();
+        cells[cellIdx].firstNode = NSNotFound;
+        cells[cellIdx].state = KPClusterStateEmpty;
+    }
+
+    // Linked lists of annotations of every hexagon, see kp_hex_cell_t
+    NSUInteger *nextNodes = malloc(tree.size * sizeof(NSUInteger));
+
+    double mapRectMinX = MKMapRectGetMinX(mapRect);
+    double mapRectMaxX = MKMapRectGetMaxX(mapRect);
+
+    /*
+     Single traversal of the tree: every annotation inside mapRect is binned into its hexagon by arithmetic,
+     instead of searching the tree once per cell. Coordinates and weights come from the tree arrays: no message is sent to annotations.
+     */
+    kp_2dtree_search_scratch_t searchScratch = kp_2dtree_search_scratch_create(&tree);
+
+    [annotationTree enumerateNodesInMapRect:mapRect searchScratch:&searchScratch usingBlock:^(kp_treenode_t *node) {
+        NSUInteger idx = node - root;
+
+        MKMapPoint mapPoint = node->mk_map_point;
+
+        // Points found across the 180th meridian are moved back next to mapRect
+        if (mapPoint.x < mapRectMinX) {
+            mapPoint.x += MKMapSizeWorld.width;
+        } else if (mapPoint.x > mapRectMaxX) {
+            mapPoint.x -= MKMapSizeWorld.width;
+        }
+
+        kp_hex_position_t position = KPHexPositionForMapPoint(mapPoint, hexagonRadius);
+
+        NSCAssert(position.row > firstRow && position.row < lastRow, nil);
+        NSCAssert(position.col > firstCol && position.col < lastCol, nil);
+
+        kp_hex_cell_t *cell = cells + (position.row - firstRow) * colsCount + (position.col - firstCol);
+
+        nextNodes[idx] = cell->firstNode;
+        cell->firstNode = idx;
+    }];
+
+    kp_2dtree_search_scratch_free(&searchScratch);
+
+    NSMutableArray *clusters = [NSMutableArray array];
+
+    kp_index_list_t nodeIndexes = kp_index_list_create(64);
+
+    for (NSUInteger cellIdx = 0; cellIdx < cellsCount; cellIdx++) {
+        kp_hex_cell_t *cell = cells + cellIdx;
+
+        if (cell->firstNode == NSNotFound) {
+            continue;
+        }
+
+        kp_index_list_clear(&nodeIndexes);
+
+        for (NSUInteger idx = cell->firstNode; idx != NSNotFound; idx = nextNodes[idx]) {
+            kp_index_list_append(&nodeIndexes, idx);
+        }
+
+        KPAnnotationStatisticsAddCoordinatesAtIndexes(&cell->statistics, coordinates, weights, nodeIndexes.indexes, nodeIndexes.count);
+
+        KPAnnotation *annotation = [[KPAnnotation alloc] initWithAnnotationTree:annotationTree
+                                                                    nodeIndexes:nodeIndexes.indexes
+                                                                     statistics:cell->statistics];
+
+        kp_hex_position_t position;
+        position.row = firstRow + (NSInteger)(cellIdx / colsCount);
+        position.col = firstCol + (NSInteger)(cellIdx % colsCount);
+
+        cell->center = KPHexCenterForPosition(position, hexagonRadius);
+        cell->annotationIndex = clusters.count;
+        cell->state = KPClusterStateHasData;
+        cell->distributionSextant = KPHexClusterDistributionSextantForPointAroundCenter(cell->center, MKMapPointForCoordinate(annotation.coordinate));
+
+        [clusters addObject:annotation];
+    }
+
+    NSArray *result = clusters;
+
+    if (self.clusteringStrategy == KPGridClusteringAlgorithmStrategyTwoPhase) {
+        result = [self _mergeOverlappingClusters:clusters
+                                      projection:projection
+                                           cells:cells
+                                       colsCount:colsCount
+                                       rowsCount:rowsCount
+                                        firstRow:firstRow];
+    } else if (self.clusteringStrategy == KPGridClusteringAlgorithmStrategyCollisionResolution) {
+        result = KPClusterResolveCollisions(clusters, &projection, self.annotationSize, self.annotationCenterOffset);
+    }
+
+    kp_index_list_free(&nodeIndexes);
+
+    free(nextNodes);
+    free(cells);
+
+    return result;
+}
+
+- (void)_ensureStrategyIntegrity {
+    if (self.clusteringStrategy != KPGridClusteringAlgorithmStrategyBasic &&
+        CGSizeEqualToSize(self.annotationSize, CGSizeZero)) {
+        NSString *failureReason = @"annotationSize must be set when using two phase or collision resolution strategy";
+
+        @throw [NSException exceptionWithName:NSGenericException reason:failureReason userInfo:nil];
+    }
+}
+
+/*
+ Hexagonal counterpart of -[KPGridClusteringAlgorithm _mergeOverlappingClusters:...]: every cluster is checked against
+ three of its six neighbours (see KPHexClusterAdjacentClusterLocationsTable) and merges are done on aggregates with union-find.
+ */
+- (NSArray *)_mergeOverlappingClusters:(NSArray *)clusters
+                            projection:(kp_map_projection_t)projection
+                                 cells:(kp_hex_cell_t *)cells
+                             colsCount:(NSUInteger)colsCount
+                             rowsCount:(NSUInteger)rowsCount
+                              firstRow:(NSInteger)firstRow
+{
+    NSUInteger clustersCount = clusters.count;
+
+    kp_annotation_statistics_t *aggregates = malloc(clustersCount * sizeof(kp_annotation_statistics_t));
+    NSUInteger *parents = malloc(clustersCount * sizeof(NSUInteger));
+
+    // Memoized coord -> view point projections, NAN means that the point must be (re)calculated
+    CGPoint *pointsInMapView = malloc(clustersCount * sizeof(CGPoint));
+
+    for (NSUInteger idx = 0; idx < clustersCount; idx++) {
+        KPAnnotation *cluster = clusters[idx];
+
+        aggregates[idx] = cluster.statistics;
+        parents[idx] = idx;
+        pointsInMapView[idx] = CGPointMake(NAN, NAN);
+    }
+
+    kp_map_projection_t *projectionRef = &projection;
+
+    CGPoint (^pointInMapViewForClusterIndex)(NSUInteger) = ^CGPoint(NSUInteger idx) {
+        if (isnan(pointsInMapView[idx].x)) {
+            pointsInMapView[idx] = KPMapProjectionGetPointForCoordinate(projectionRef, KPAnnotationStatisticsGetCentroid(aggregates + idx));
+        }
+
+        return pointsInMapView[idx];
+    };
+
+    CGSize annotationSize = self.annotationSize;
+    CGPoint annotationCenterOffset = self.annotationCenterOffset;
+
+    // The margin hexagons are always empty, so they are never current ones
+    NSUInteger cellIdx = colsCount + 1;
+    NSUInteger lastCellIdx = (rowsCount - 1) * colsCount - 1;
+
+    while (cellIdx < lastCellIdx) {
+        kp_hex_cell_t *currentCell = cells + cellIdx;
+
+        if (currentCell->state != KPClusterStateHasData) {
+            cellIdx++;
+
+            continue;
+        }
+
+        NSInteger parity = KPHexRowParity(firstRow + (NSInteger)(cellIdx / colsCount));
+
+        // KPHexClusterDistributionSextant is one of 1, 2, 4, ..., 32: log2 gives the index in KPHexClusterAdjacentClusterLocationsTable
+        int lookupIndexForCurrentCellSextant = log2f(currentCell->distributionSextant);
+
+        NSUInteger absorbingCellIdx = NSNotFound;
+
+        for (int adjacentClustersPositionIndex = 0; adjacentClustersPositionIndex < 3; adjacentClustersPositionIndex++) {
+            int adjacentClusterLocation = KPHexClusterAdjacentClusterLocationsTable[lookupIndexForCurrentCellSextant][adjacentClustersPositionIndex];
+
+            NSUInteger adjacentCellIdx = (NSInteger)cellIdx
+                                       + KPHexAdjacentClusterPositionDeltas[parity][adjacentClusterLocation][1] * (NSInteger)colsCount
+                                       + KPHexAdjacentClusterPositionDeltas[parity][adjacentClusterLocation][0];
+
+            kp_hex_cell_t *adjacentCell = cells + adjacentCellIdx;
+
+            if (adjacentCell->state != KPClusterStateHasData || (KPHexClusterConformityTable[adjacentClusterLocation] & adjacentCell->distributionSextant) == 0) {
+                continue;
+            }
+
+            NSUInteger index1 = currentCell->annotationIndex;
+            NSUInteger index2 = adjacentCell->annotationIndex;
+
+            NSCAssert(parents[index1] == index1 && parents[index2] == index2, nil);
+
+            if (KPClusterAnnotationViewsIntersect(pointInMapViewForClusterIndex(index1), pointInMapViewForClusterIndex(index2), annotationSize, annotationCenterOffset) == NO) {
+                continue;
+            }
+
+            kp_annotation_statistics_t unionAggregate = KPAnnotationStatisticsUnion(aggregates + index1, aggregates + index2);
+
+            MKMapPoint newClusterMapPoint = MKMapPointForCoordinate(KPAnnotationStatisticsGetCentroid(&unionAggregate));
+
+            // Hexagons are the Voronoi cells of their centers: merged cluster is kept by the hexagon whose center is closer to it
+            double distanceToCurrentCenter  = KPMapProjectionGetDistanceSquaredBetweenMapPoints(projectionRef, currentCell->center, newClusterMapPoint);
+            double distanceToAdjacentCenter = KPMapProjectionGetDistanceSquaredBetweenMapPoints(projectionRef, adjacentCell->center, newClusterMapPoint);
+
+            if (distanceToCurrentCenter <= distanceToAdjacentCenter) {
+                adjacentCell->state = KPClusterStateMerged;
+
+                parents[index2] = index1;
+                aggregates[index1] = unionAggregate;
+                pointsInMapView[index1].x = NAN;
+
+                currentCell->distributionSextant = KPHexClusterDistributionSextantForPointAroundCenter(currentCell->center, newClusterMapPoint);
+            } else {
+                currentCell->state = KPClusterStateMerged;
+
+                parents[index1] = index2;
+                aggregates[index2] = unionAggregate;
+                pointsInMapView[index2].x = NAN;
+
+                adjacentCell->distributionSextant = KPHexClusterDistributionSextantForPointAroundCenter(adjacentCell->center, newClusterMapPoint);
+
+                absorbingCellIdx = adjacentCellIdx;
+
+                break; // current hexagon has no cluster anymore
+            }
+        }
+
+        // If the absorbing cluster lies upstream, its new point is checked against its neighbours again.
+        // Every merge removes one cluster, so going back can not loop forever.
+        if (absorbingCellIdx != NSNotFound && absorbingCellIdx < cellIdx) {
+            cellIdx = absorbingCellIdx;
+        } else {
+            cellIdx++;
+        }
+    }
+
+    NSArray *mergedClusters = KPClusterUnionFindCollectClusters(clusters, parents, aggregates);
+
+    free(pointsInMapView);
+    free(parents);
+    free(aggregates);
+
+    return mergedClusters;
+}
+
+@end
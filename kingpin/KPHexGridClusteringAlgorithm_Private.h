@@ -0,0 +1,182 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import "KPHexGridClusteringAlgorithm.h"
+#import "KPGridClusteringAlgorithm_Private.h"
+
+#import "KPAnnotation_Private.h"
+#import "KPGeometry.h"
+
+/*
+ Hexagonal grid uses "pointy top" hexagons laid on MKMapPoints starting from the map origin, so cells do not move when the map is panned.
+ Hexagons are addressed by "odd-r" offset coordinates: row is the axial r, odd rows are shifted by half a hexagon to the east.
+ See http://www.redblobgames.com/grids/hexagons/ for the whole story.
+
+      / \     / \
+    /     \ /     \
+   |  NW   |  NE   |
+  / \     / \     / \
+/     \ /     \ /     \
+|   W   |current|   E   |
+\     / \     / \     /
+  \ /     \ /     \ /
+   |  SW   |  SE   |
+    \     / \     /
+      \ /     \ /
+ */
+typedef NS_ENUM(NSInteger, KPHexDirection) {
+    KPHexDirectionEast = 0,
+    KPHexDirectionNorthEast,
+    KPHexDirectionNorthWest,
+    KPHexDirectionWest,
+    KPHexDirectionSouthWest,
+    KPHexDirectionSouthEast,
+};
+
+/*
+ Cluster's point relative to the center of its hexagon: one of six sextants, each facing the neighbour of the same direction.
+ It is the hexagonal counterpart of KPClusterDistributionQuadrant.
+ */
+typedef NS_OPTIONS(NSInteger, KPHexClusterDistributionSextant) {
+    KPHexClusterDistributionSextantEast      = 1 << KPHexDirectionEast,
+    KPHexClusterDistributionSextantNorthEast = 1 << KPHexDirectionNorthEast,
+    KPHexClusterDistributionSextantNorthWest = 1 << KPHexDirectionNorthWest,
+    KPHexClusterDistributionSextantWest      = 1 << KPHexDirectionWest,
+    KPHexClusterDistributionSextantSouthWest = 1 << KPHexDirectionSouthWest,
+    KPHexClusterDistributionSextantSouthEast = 1 << KPHexDirectionSouthEast,
+};
+
+/*
+ Cluster in a given sextant is closest to the neighbour this sextant faces and to the two neighbours around it,
+ the other three neighbours may be skipped for this cluster.
+ */
+static const int KPHexClusterAdjacentClusterLocationsTable[6][3] = {
+    {KPHexDirectionSouthEast, KPHexDirectionEast,      KPHexDirectionNorthEast},
+    {KPHexDirectionEast,      KPHexDirectionNorthEast, KPHexDirectionNorthWest},
+    {KPHexDirectionNorthEast, KPHexDirectionNorthWest, KPHexDirectionWest},
+    {KPHexDirectionNorthWest, KPHexDirectionWest,      KPHexDirectionSouthWest},
+    {KPHexDirectionWest,      KPHexDirectionSouthWest, KPHexDirectionSouthEast},
+    {KPHexDirectionSouthWest, KPHexDirectionSouthEast, KPHexDirectionEast},
+};
+
+/*
+ Adjacent cluster worth a merge check must have its point in one of the sextants facing back to the current hexagon:
+ for the neighbour in direction d these are the sextants around the opposite direction d + 3.
+ */
+static const int KPHexClusterConformityTable[6] = {
+    KPHexClusterDistributionSextantNorthWest | KPHexClusterDistributionSextantWest      | KPHexClusterDistributionSextantSouthWest, // E
+    KPHexClusterDistributionSextantWest      | KPHexClusterDistributionSextantSouthWest | KPHexClusterDistributionSextantSouthEast, // NE
+    KPHexClusterDistributionSextantSouthWest | KPHexClusterDistributionSextantSouthEast | KPHexClusterDistributionSextantEast,      // NW
+    KPHexClusterDistributionSextantSouthEast | KPHexClusterDistributionSextantEast      | KPHexClusterDistributionSextantNorthEast, // W
+    KPHexClusterDistributionSextantEast      | KPHexClusterDistributionSextantNorthEast | KPHexClusterDistributionSextantNorthWest, // SW
+    KPHexClusterDistributionSextantNorthEast | KPHexClusterDistributionSextantNorthWest | KPHexClusterDistributionSextantWest,      // SE
+};
+
+// {col, row} deltas of neighbours, they depend on the parity of the row because odd rows are shifted (y grows to the south)
+static const int KPHexAdjacentClusterPositionDeltas[2][6][2] = {
+    { { 1, 0}, { 0, -1}, {-1, -1}, {-1, 0}, {-1, 1}, { 0, 1} }, // even rows
+    { { 1, 0}, { 1, -1}, { 0, -1}, {-1, 0}, { 0, 1}, { 1, 1} }, // odd rows
+};
+
+static const double KPHexSqrt3 = 1.7320508075688772;
+
+typedef struct {
+    NSInteger col;
+    NSInteger row;
+} kp_hex_position_t;
+
+static inline NSInteger KPHexRowParity(NSInteger row) {
+    return row & 1; // two's complement: odd negative rows are odd as well
+}
+
+/*
+ Hexagon containing a map point: fractional axial coordinates of the point are rounded in cube coordinates (x + y + z = 0)
+ by rounding all three and fixing the one which was rounded the most. No search over neighbour centers is needed.
+ hexagonRadius is the distance from the center of hexagon to its corners in map points.
+ */
+static inline kp_hex_position_t KPHexPositionForMapPoint(MKMapPoint mapPoint, double hexagonRadius) {
+    double q = (KPHexSqrt3 / 3 * mapPoint.x - mapPoint.y / 3) / hexagonRadius;
+    double r = (2. / 3 * mapPoint.y) / hexagonRadius;
+    double s = -q - r;
+
+    double roundedQ = round(q);
+    double roundedR = round(r);
+    double roundedS = round(s);
+
+    double dq = fabs(roundedQ - q);
+    double dr = fabs(roundedR - r);
+    double ds = fabs(roundedS - s);
+
+    if (dq > dr && dq > ds) {
+        roundedQ = -roundedR - roundedS;
+    } else if (dr > ds) {
+        roundedR = -roundedQ - roundedS;
+    }
+
+    NSInteger axialQ = (NSInteger)roundedQ;
+    NSInteger axialR = (NSInteger)roundedR;
+
+    kp_hex_position_t position;
+
+    position.row = axialR;
+    position.col = axialQ + (axialR - KPHexRowParity(axialR)) / 2;
+
+    return position;
+}
+
+static inline MKMapPoint KPHexCenterForPosition(kp_hex_position_t position, double hexagonRadius) {
+    return MKMapPointMake(hexagonRadius * KPHexSqrt3 * (position.col + 0.5 * KPHexRowParity(position.row)),
+                          hexagonRadius * 1.5 * position.row);
+}
+
+static inline KPHexClusterDistributionSextant KPHexClusterDistributionSextantForPointAroundCenter(MKMapPoint center, MKMapPoint point) {
+    double dx = point.x - center.x;
+
+    if (dx > MKMapSizeWorld.width / 2) {
+        dx -= MKMapSizeWorld.width;
+    } else if (dx < -MKMapSizeWorld.width / 2) {
+        dx += MKMapSizeWorld.width;
+    }
+
+    // y of MKMapPoints grows to the south, so it is flipped to get the usual counterclockwise angle
+    double angle = atan2(center.y - point.y, dx);
+
+    NSInteger direction = (NSInteger)floor(angle / (M_PI / 3) + 0.5);
+
+    return 1 << ((direction + 6) % 6);
+}
+
+/*
+ Cell of hexagonal cluster grid. The annotations of a cell are linked by node indexes of 2-d tree:
+ firstNode -> nextNodes[firstNode] -> ... -> NSNotFound.
+ */
+typedef struct {
+    kp_annotation_statistics_t statistics;
+    MKMapPoint center;
+    NSUInteger firstNode;
+    NSUInteger annotationIndex;
+    kp_cluster_state_t state;
+    KPHexClusterDistributionSextant distributionSextant;
+} kp_hex_cell_t;
+
+@interface KPHexGridClusteringAlgorithm (Private)
+
+// Does not touch MKMapView: everything it needs from map view is captured by projection.
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                              projection:(kp_map_projection_t)projection
+                          annotationTree:(KPAnnotationTree *)annotationTree;
+
+@end
@@ -0,0 +1,42 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import "KPClusteringAlgorithm.h"
+
+/**
+ Mini-batch k-means clustering producing at most numberOfClusters clusters in a clustering rect.
+ Centroids are seeded k-means++ style and refined with mini-batch iterations until they converge or maximumNumberOfIterations is reached.
+ The final assignment of annotations to centroids walks the 2-d tree and takes whole subtrees that are closest to a single centroid
+ without computing distances for every annotation (filtering algorithm).
+ Random sampling is seeded with a constant, so the same annotations in the same rect always give the same clusters,
+ unless iterationTimeBudget is set: iterations are then cut by the clock and the result depends on the speed of the device.
+ */
+@interface KPKMeansClusteringAlgorithm : NSObject <KPClusteringAlgorithm>
+
+/// Target number of clusters (k), default is 10
+@property (assign, nonatomic) NSUInteger numberOfClusters;
+
+/// Number of annotations sampled by every mini-batch iteration, default is 500
+@property (assign, nonatomic) NSUInteger miniBatchSize;
+
+/// Upper bound for the number of mini-batch iterations, default is 100
+@property (assign, nonatomic) NSUInteger maximumNumberOfIterations;
+
+/// Time in seconds after which no more mini-batch iterations are started, default is 0 (no time limit)
+@property (assign, nonatomic) NSTimeInterval iterationTimeBudget;
+
+@end
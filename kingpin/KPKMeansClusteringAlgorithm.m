@@ -0,0 +1,470 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <MapKit/MapKit.h>
+
+#import "KPKMeansClusteringAlgorithm.h"
+
+#import "KPAnnotationTree.h"
+#import "KPAnnotationTree_Private.h"
+#import "KPAnnotation.h"
+#import "KPAnnotation_Private.h"
+
+#import "KPGeometry.h"
+
+#import "kp_index_list.h"
+
+// Mini-batch iterations stop early when no centroid has moved farther than this (in view points)
+static const double KPKMeansConvergenceDistance = 0.1;
+
+typedef struct {
+    kp_treenode_t *node;
+    NSUInteger candidatesOffset;
+    NSUInteger candidatesCount;
+    BOOL insideMapRect;
+} kp_kmeans_filtering_stack_entry_t;
+
+// xorshift64*: cheap pseudo-random numbers, seeded with a constant so that clustering is deterministic
+static inline uint64_t KPKMeansRandom(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 2685821657736338717ULL;
+}
+
+// Uniformly distributed in [0, 1)
+static inline double KPKMeansRandomDouble(uint64_t *state) {
+    return (KPKMeansRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline double KPKMeansDistanceSquared(CGPoint p1, CGPoint p2) {
+    double dx = p1.x - p2.x;
+    double dy = p1.y - p2.y;
+
+    return dx * dx + dy * dy;
+}
+
+static inline uint32_t KPKMeansNearestCentroid(CGPoint point, CGPoint *centroids, uint32_t *candidates, NSUInteger candidatesCount) {
+    uint32_t nearest = candidates[0];
+    double nearestDistance = KPKMeansDistanceSquared(point, centroids[nearest]);
+
+    for (NSUInteger candidateIdx = 1; candidateIdx < candidatesCount; candidateIdx++) {
+        double distance = KPKMeansDistanceSquared(point, centroids[candidates[candidateIdx]]);
+
+        if (distance < nearestDistance) {
+            nearest = candidates[candidateIdx];
+            nearestDistance = distance;
+        }
+    }
+
+    return nearest;
+}
+
+/*
+ Filtering step of Kanungo et al. "An efficient k-means clustering algorithm: analysis and implementation":
+ the candidate closest to the middle of the bounds is kept, every other candidate is dropped if even the vertex of the bounds
+ lying farthest in its direction is closer to the closest candidate, i.e. it can't be the nearest centroid anywhere inside the bounds.
+ */
+static inline NSUInteger KPKMeansFilterCandidates(CGPoint *centroids, uint32_t *candidates, NSUInteger candidatesCount, CGPoint boundsMin, CGPoint boundsMax, uint32_t *filteredCandidates) {
+    CGPoint boundsMid = CGPointMake((boundsMin.x + boundsMax.x) / 2, (boundsMin.y + boundsMax.y) / 2);
+
+    uint32_t closest = KPKMeansNearestCentroid(boundsMid, centroids, candidates, candidatesCount);
+    CGPoint closestCentroid = centroids[closest];
+
+    NSUInteger filteredCount = 0;
+
+    for (NSUInteger candidateIdx = 0; candidateIdx < candidatesCount; candidateIdx++) {
+        uint32_t candidate = candidates[candidateIdx];
+        CGPoint centroid = centroids[candidate];
+
+        CGPoint vertex = CGPointMake(
+                                     centroid.x > closestCentroid.x ? boundsMax.x : boundsMin.x,
+                                     centroid.y > closestCentroid.y ? boundsMax.y : boundsMin.y
+                                     );
+
+        if (candidate == closest || KPKMeansDistanceSquared(centroid, vertex) < KPKMeansDistanceSquared(closestCentroid, vertex)) {
+            filteredCandidates[filteredCount++] = candidate;
+        }
+    }
+
+    return filteredCount;
+}
+
+// k-means++ seeding on a random sample of points: every next centroid is chosen with probability proportional to squared distance to the nearest chosen one
+static inline void KPKMeansSeedCentroids(CGPoint *centroids, NSUInteger centroidsCount, CGPoint *points, NSUInteger pointsCount, NSUInteger sampleSize, uint64_t *randomState) {
+    NSUInteger sampleCount = MIN(pointsCount, sampleSize);
+
+    CGPoint *sample = malloc(sampleCount * sizeof(CGPoint));
+    double *distances = malloc(sampleCount * sizeof(double));
+
+    for (NSUInteger sampleIdx = 0; sampleIdx < sampleCount; sampleIdx++) {
+        sample[sampleIdx] = sampleCount == pointsCount ? points[sampleIdx] : points[KPKMeansRandom(randomState) % pointsCount];
+    }
+
+    centroids[0] = sample[KPKMeansRandom(randomState) % sampleCount];
+
+    for (NSUInteger sampleIdx = 0; sampleIdx < sampleCount; sampleIdx++) {
+        distances[sampleIdx] = KPKMeansDistanceSquared(sample[sampleIdx], centroids[0]);
+    }
+
+    for (NSUInteger centroidIdx = 1; centroidIdx < centroidsCount; centroidIdx++) {
+        double totalDistance = 0;
+
+        for (NSUInteger sampleIdx = 0; sampleIdx < sampleCount; sampleIdx++) {
+            totalDistance += distances[sampleIdx];
+        }
+
+        NSUInteger chosenIdx = sampleCount - 1;
+
+        if (totalDistance > 0) {
+            double target = KPKMeansRandomDouble(randomState) * totalDistance;
+
+            for (NSUInteger sampleIdx = 0; sampleIdx < sampleCount; sampleIdx++) {
+                target -= distances[sampleIdx];
+
+                if (target < 0) {
+                    chosenIdx = sampleIdx;
+                    break;
+                }
+            }
+        } else {
+            // All the sampled points coincide with chosen centroids
+            chosenIdx = KPKMeansRandom(randomState) % sampleCount;
+        }
+
+        centroids[centroidIdx] = sample[chosenIdx];
+
+        for (NSUInteger sampleIdx = 0; sampleIdx < sampleCount; sampleIdx++) {
+            distances[sampleIdx] = MIN(distances[sampleIdx], KPKMeansDistanceSquared(sample[sampleIdx], centroids[centroidIdx]));
+        }
+    }
+
+    free(distances);
+    free(sample);
+}
+
+@implementation KPKMeansClusteringAlgorithm
+
+- (id)init {
+
+    if ((self = [super init])) {
+        self.numberOfClusters = 10;
+        self.miniBatchSize = 500;
+        self.maximumNumberOfIterations = 100;
+        self.iterationTimeBudget = 0;
+    }
+
+    return self;
+}
+
+#pragma mark - KPClusteringAlgorithm
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                           parentMapView:(MKMapView *)mapView
+                          annotationTree:(KPAnnotationTree *)annotationTree
+{
+    kp_map_projection_t projection = KPMapProjectionMake(mapView.visibleMapRect, mapView.frame.size);
+
+    return [self clusterAnnotationsInMapRect:mapRect
+                                  projection:projection
+                              annotationTree:annotationTree];
+}
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                          visibleMapRect:(MKMapRect)visibleMapRect
+                             mapViewSize:(CGSize)mapViewSize
+                          annotationTree:(KPAnnotationTree *)annotationTree
+{
+    return [self clusterAnnotationsInMapRect:mapRect
+                                  projection:KPMapProjectionMake(visibleMapRect, mapViewSize)
+                              annotationTree:annotationTree];
+}
+
+- (NSString *)clusteringConfigurationKey {
+    return [NSString stringWithFormat:@"KMeans/%lu/%lu/%lu/%g",
+            (unsigned long)self.numberOfClusters, (unsigned long)self.miniBatchSize, (unsigned long)self.maximumNumberOfIterations, self.iterationTimeBudget];
+}
+
+#pragma mark - Private
+
+- (NSArray *)clusterAnnotationsInMapRect:(MKMapRect)mapRect
+                              projection:(kp_map_projection_t)projection
+                          annotationTree:(KPAnnotationTree *)annotationTree
+{
+    kp_2dtree_t tree = annotationTree.tree;
+
+    if (tree.size == 0) {
+        return @[];
+    }
+
+    kp_map_projection_t *projectionRef = &projection;
+
+    // View points of annotations inside mapRect: population for seeding and mini-batch sampling
+    __block NSUInteger pointsCount = 0;
+    CGPoint *points = malloc(tree.size * sizeof(CGPoint));
+
+    kp_2dtree_search_scratch_t searchScratch = kp_2dtree_search_scratch_create(&tree);
+
+    [annotationTree enumerateNodesInMapRect:mapRect searchScratch:&searchScratch usingBlock:^(kp_treenode_t *node) {
+        points[pointsCount++] = KPMapProjectionGetPointForMapPoint(projectionRef, node->mk_map_point);
+    }];
+
+    kp_2dtree_search_scratch_free(&searchScratch);
+
+    if (pointsCount == 0) {
+        free(points);
+
+        return @[];
+    }
+
+    NSUInteger centroidsCount = MIN(MAX(self.numberOfClusters, 1), pointsCount);
+    NSUInteger miniBatchSize = MAX(self.miniBatchSize, 1);
+
+    CGPoint *centroids = malloc(centroidsCount * sizeof(CGPoint));
+    uint64_t randomState = 0x9E3779B97F4A7C15ULL;
+
+    KPKMeansSeedCentroids(centroids, centroidsCount, points, pointsCount, MAX(miniBatchSize, centroidsCount), &randomState);
+
+    [self _refineCentroids:centroids
+                     count:centroidsCount
+                withPoints:points
+                     count:pointsCount
+             miniBatchSize:miniBatchSize
+               randomState:&randomState];
+
+    free(points);
+
+    NSArray *clusters = [self _clustersByAssigningAnnotationsInMapRect:mapRect
+                                                           toCentroids:centroids
+                                                                 count:centroidsCount
+                                                            projection:projectionRef
+                                                        annotationTree:annotationTree];
+
+    free(centroids);
+
+    return clusters;
+}
+
+/*
+ Mini-batch k-means by Sculley, "Web-scale k-means clustering": every iteration assigns a random batch of points to their nearest centroids
+ and moves every centroid towards its points with a per-centroid learning rate decreasing as 1 / (number of points it has seen).
+ */
+- (void)_refineCentroids:(CGPoint *)centroids
+                   count:(NSUInteger)centroidsCount
+              withPoints:(CGPoint *)points
+                   count:(NSUInteger)pointsCount
+           miniBatchSize:(NSUInteger)miniBatchSize
+             randomState:(uint64_t *)randomState
+{
+    NSUInteger *centroidCounts = calloc(centroidsCount, sizeof(NSUInteger));
+    CGPoint *previousCentroids = malloc(centroidsCount * sizeof(CGPoint));
+
+    uint32_t *allCandidates = malloc(centroidsCount * sizeof(uint32_t));
+
+    for (NSUInteger centroidIdx = 0; centroidIdx < centroidsCount; centroidIdx++) {
+        allCandidates[centroidIdx] = (uint32_t)centroidIdx;
+    }
+
+    NSUInteger *batchPoints = malloc(miniBatchSize * sizeof(NSUInteger));
+    uint32_t *batchCentroids = malloc(miniBatchSize * sizeof(uint32_t));
+
+    double convergenceDistanceSquared = KPKMeansConvergenceDistance * KPKMeansConvergenceDistance;
+
+    NSTimeInterval iterationTimeBudget = self.iterationTimeBudget;
+    CFAbsoluteTime deadline = CFAbsoluteTimeGetCurrent() + iterationTimeBudget;
+
+    for (NSUInteger iteration = 0; iteration < self.maximumNumberOfIterations; iteration++) {
+        if (iterationTimeBudget > 0 && CFAbsoluteTimeGetCurrent() >= deadline) {
+            break;
+        }
+
+        memcpy(previousCentroids, centroids, centroidsCount * sizeof(CGPoint));
+
+        for (NSUInteger batchIdx = 0; batchIdx < miniBatchSize; batchIdx++) {
+            NSUInteger pointIdx = KPKMeansRandom(randomState) % pointsCount;
+
+            batchPoints[batchIdx] = pointIdx;
+            batchCentroids[batchIdx] = KPKMeansNearestCentroid(points[pointIdx], centroids, allCandidates, centroidsCount);
+        }
+
+        for (NSUInteger batchIdx = 0; batchIdx < miniBatchSize; batchIdx++) {
+            uint32_t centroidIdx = batchCentroids[batchIdx];
+            CGPoint point = points[batchPoints[batchIdx]];
+
+            double learningRate = 1.0 / ++centroidCounts[centroidIdx];
+
+            centroids[centroidIdx].x += learningRate * (point.x - centroids[centroidIdx].x);
+            centroids[centroidIdx].y += learningRate * (point.y - centroids[centroidIdx].y);
+        }
+
+        double maximumShiftSquared = 0;
+
+        for (NSUInteger centroidIdx = 0; centroidIdx < centroidsCount; centroidIdx++) {
+            maximumShiftSquared = MAX(maximumShiftSquared, KPKMeansDistanceSquared(centroids[centroidIdx], previousCentroids[centroidIdx]));
+        }
+
+        if (maximumShiftSquared < convergenceDistanceSquared) {
+            break;
+        }
+    }
+
+    free(batchCentroids);
+    free(batchPoints);
+    free(allCandidates);
+    free(previousCentroids);
+    free(centroidCounts);
+}
+
+/*
+ Assigns every annotation inside mapRect to its nearest centroid by walking the 2-d tree.
+ Every tree node carries the list of centroids that can still be the nearest for some point of its subtree:
+ the list is narrowed with subtree bounds on the way down, and once a single candidate is left,
+ the whole subtree is assigned to it without computing any more distances.
+ */
+- (NSArray *)_clustersByAssigningAnnotationsInMapRect:(MKMapRect)mapRect
+                                          toCentroids:(CGPoint *)centroids
+                                                count:(NSUInteger)centroidsCount
+                                           projection:(kp_map_projection_t *)projection
+                                       annotationTree:(KPAnnotationTree *)annotationTree
+{
+    kp_2dtree_t tree = annotationTree.tree;
+    kp_treenode_t *root = tree.root;
+
+    kp_subtree_bounds_t *subtreeBounds = [annotationTree subtreeBounds];
+
+    // Members of every centroid as node indexes: clusters index the tree instead of retaining their annotations
+    kp_index_list_t *members = malloc(centroidsCount * sizeof(kp_index_list_t));
+
+    for (NSUInteger centroidIdx = 0; centroidIdx < centroidsCount; centroidIdx++) {
+        members[centroidIdx] = kp_index_list_create(64);
+    }
+
+    // Every node is pushed at most once per part of mapRect
+    kp_kmeans_filtering_stack_entry_t *stack = malloc(tree.size * sizeof(kp_kmeans_filtering_stack_entry_t));
+
+    /*
+     Candidate lists are stacked in one buffer in the same LIFO order as the nodes: when a node is popped,
+     every list above its own one belongs to subtrees that are already done and can be overwritten.
+     */
+    NSUInteger candidatesCapacity = 4 * centroidsCount;
+    uint32_t *candidates = malloc(candidatesCapacity * sizeof(uint32_t));
+
+    MKMapRect parts[2];
+    NSUInteger partsCount = MKMapRectDivideAtDateline(mapRect, parts);
+
+    for (NSUInteger partIdx = 0; partIdx < partsCount; partIdx++) {
+        MKMapPoint rectMin = MKMapPointMake(MKMapRectGetMinX(parts[partIdx]), MKMapRectGetMinY(parts[partIdx]));
+        MKMapPoint rectMax = MKMapPointMake(MKMapRectGetMaxX(parts[partIdx]), MKMapRectGetMaxY(parts[partIdx]));
+
+        for (NSUInteger centroidIdx = 0; centroidIdx < centroidsCount; centroidIdx++) {
+            candidates[centroidIdx] = (uint32_t)centroidIdx;
+        }
+
+        NSUInteger stackCount = 0;
+
+        stack[stackCount++] = (kp_kmeans_filtering_stack_entry_t){ root, 0, centroidsCount, NO };
+
+        while (stackCount > 0) {
+            kp_kmeans_filtering_stack_entry_t entry = stack[--stackCount];
+
+            kp_treenode_t *node = entry.node;
+            kp_subtree_bounds_t *bounds = subtreeBounds + (node - root);
+
+            BOOL insideMapRect = entry.insideMapRect;
+
+            // Same closed interval test as the one of kp_2dtree_search_nodes_with_scratch()
+            if (insideMapRect == NO) {
+                if (bounds->max.x < rectMin.x || rectMax.x < bounds->min.x ||
+                    bounds->max.y < rectMin.y || rectMax.y < bounds->min.y) {
+                    continue;
+                }
+
+                insideMapRect = (rectMin.x <= bounds->min.x && bounds->max.x <= rectMax.x &&
+                                 rectMin.y <= bounds->min.y && bounds->max.y <= rectMax.y);
+            }
+
+            NSUInteger candidatesOffset = entry.candidatesOffset;
+            NSUInteger candidatesCount = entry.candidatesCount;
+
+            if (candidatesCount > 1) {
+                CGPoint boundsMin = KPMapProjectionGetPointForMapPoint(projection, bounds->min);
+                CGPoint boundsMax = KPMapProjectionGetPointForMapPoint(projection, bounds->max);
+
+                // Subtree lying across the 180th meridian on the far side of the world is projected to both edges of the view: it is not a box in view points
+                if (boundsMin.x <= boundsMax.x) {
+                    NSUInteger candidatesTop = entry.candidatesOffset + entry.candidatesCount;
+
+                    if (candidatesTop + candidatesCount > candidatesCapacity) {
+                        candidatesCapacity = 2 * (candidatesTop + candidatesCount);
+                        candidates = realloc(candidates, candidatesCapacity * sizeof(uint32_t));
+                    }
+
+                    candidatesCount = KPKMeansFilterCandidates(centroids, candidates + candidatesOffset, candidatesCount, boundsMin, boundsMax, candidates + candidatesTop);
+                    candidatesOffset = candidatesTop;
+                }
+            }
+
+            if (insideMapRect ||
+                (rectMin.x <= node->mk_map_point.x && node->mk_map_point.x <= rectMax.x &&
+                 rectMin.y <= node->mk_map_point.y && node->mk_map_point.y <= rectMax.y)) {
+
+                uint32_t centroidIdx = candidates[candidatesOffset];
+
+                if (candidatesCount > 1) {
+                    CGPoint point = KPMapProjectionGetPointForMapPoint(projection, node->mk_map_point);
+
+                    centroidIdx = KPKMeansNearestCentroid(point, centroids, candidates + candidatesOffset, candidatesCount);
+                }
+
+                kp_index_list_append(members + centroidIdx, node - root);
+            }
+
+            if (node->right != NULL) {
+                stack[stackCount++] = (kp_kmeans_filtering_stack_entry_t){ node->right, candidatesOffset, candidatesCount, insideMapRect };
+            }
+
+            if (node->left != NULL) {
+                stack[stackCount++] = (kp_kmeans_filtering_stack_entry_t){ node->left, candidatesOffset, candidatesCount, insideMapRect };
+            }
+        }
+    }
+
+    free(candidates);
+    free(stack);
+
+    NSMutableArray *clusters = [NSMutableArray arrayWithCapacity:centroidsCount];
+
+    for (NSUInteger centroidIdx = 0; centroidIdx < centroidsCount; centroidIdx++) {
+        kp_index_list_t *clusterMembers = members + centroidIdx;
+
+        if (clusterMembers->count > 0) {
+            kp_annotation_statistics_t statistics = KPAnnotationStatisticsMake();
+
+            KPAnnotationStatisticsAddCoordinatesAtIndexes(&statistics, tree.coordinates, tree.weights, clusterMembers->indexes, clusterMembers->count);
+
+            [clusters addObject:[[KPAnnotation alloc] initWithAnnotationTree:annotationTree nodeIndexes:clusterMembers->indexes statistics:statistics]];
+        }
+
+        kp_index_list_free(clusterMembers);
+    }
+
+    free(members);
+
+    return clusters;
+}
+
+@end
@@ -15,6 +15,12 @@
 //
 
 #import <kingpin/KPAnnotation.h>
+#import <kingpin/KPAttributeReducer.h>
+#import <kingpin/KPClusterCache.h>
 #import <kingpin/KPClusteringAlgorithm.h>
 #import <kingpin/KPGridClusteringAlgorithm.h>
+#import <kingpin/KPHexGridClusteringAlgorithm.h>
+#import <kingpin/KPDistanceClusteringAlgorithm.h>
+#import <kingpin/KPDBSCANClusteringAlgorithm.h>
+#import <kingpin/KPKMeansClusteringAlgorithm.h>
 #import <kingpin/KPClusteringController.h>
@@ -15,6 +15,7 @@
 //
 
 #import "KPGeometry.h"
+#import "KPAnnotationAccessors.h"
 
 #import <MapKit/MKAnnotation.h>
 
@@ -86,12 +87,59 @@ typedef struct {
     kp_stack_t stack;
     NSUInteger size;
     kp_search_stack_info_t *search_stack_info;
+
+    // Per-annotation data indexed by node index (see kp_2dtree_node_index()), read from annotations once when the tree is built
+    CLLocationCoordinate2D *coordinates;
+    double *weights;
+    NSUInteger *categories;
+    double *priorities; // 0 for annotations not conforming to KPPrioritizedAnnotation
+
+    NSUInteger categoriesCount; // greatest category + 1
+    BOOL prioritized;           // whether any annotation conforms to KPPrioritizedAnnotation
 } kp_2dtree_t;
 
+/*
+ Search scratch space: the stack and the stack info storage used by a single search.
+ The tree owns one instance of it (tree->stack and tree->search_stack_info), so kp_2dtree_search() is not reentrant.
+ Every thread that searches the same tree concurrently must use its own scratch created with kp_2dtree_search_scratch_create().
+ */
+typedef struct {
+    kp_stack_t stack;
+    kp_search_stack_info_t *search_stack_info;
+} kp_2dtree_search_scratch_t;
+
 static inline kp_2dtree_t kp_2dtree_create(NSArray *annotations);
 static inline void kp_2dtree_free(kp_2dtree_t *tree);
 static inline void kp_2dtree_search(kp_2dtree_t *tree, NSMutableArray *result, MKMapPoint *minPoint, MKMapPoint *maxPoint);
 
+static inline kp_2dtree_search_scratch_t kp_2dtree_search_scratch_create(kp_2dtree_t *tree);
+static inline void kp_2dtree_search_scratch_free(kp_2dtree_search_scratch_t *scratch);
+static inline void kp_2dtree_search_with_scratch(kp_2dtree_t *tree, kp_2dtree_search_scratch_t *scratch, NSMutableArray *result, MKMapPoint *minPoint, MKMapPoint *maxPoint);
+
+/*
+ Nodes are allocated in one contiguous array (tree->root), so the offset of a node in this array is a stable index of its annotation
+ in range [0, tree->size): clustering algorithms use it to keep per-annotation state in flat arrays and bitsets.
+ */
+typedef void (^kp_2dtree_node_visitor_t)(kp_treenode_t *node);
+
+static inline void kp_2dtree_search_nodes_with_scratch(kp_2dtree_t *tree, kp_2dtree_search_scratch_t *scratch, MKMapPoint *minPoint, MKMapPoint *maxPoint, kp_2dtree_node_visitor_t visitor);
+
+static inline NSUInteger kp_2dtree_node_index(const kp_2dtree_t *tree, const kp_treenode_t *node) {
+    return (NSUInteger)(node - tree->root);
+}
+
+/*
+ Bounding box of all map points in the subtree rooted at a node (the node itself included).
+ Filtering algorithms use it to decide for a whole subtree at once: skip it, take it as a whole or descend into it.
+ */
+typedef struct {
+    MKMapPoint min;
+    MKMapPoint max;
+} kp_subtree_bounds_t;
+
+// Returns malloc'ed array of tree->size bounds indexed by node index (see kp_2dtree_node_index()). Caller is responsible for freeing it.
+static inline kp_subtree_bounds_t *kp_2dtree_subtree_bounds_create(const kp_2dtree_t *tree);
+
 #pragma mark -
 
 static inline void kp_2dtree_free(kp_2dtree_t *tree) {
@@ -100,6 +148,10 @@ static inline void kp_2dtree_free(kp_2dtree_t *tree) {
     free(tree->root);
     free(tree->stack.storage);
     free(tree->search_stack_info);
+    free(tree->coordinates);
+    free(tree->weights);
+    free(tree->categories);
+    free(tree->priorities);
 }
 
 static inline kp_2dtree_t kp_2dtree_create(NSArray *annotations) {
@@ -114,6 +166,10 @@ static inline kp_2dtree_t kp_2dtree_create(NSArray *annotations) {
 
     tree.search_stack_info = malloc(count * sizeof(kp_search_stack_info_t));
     tree.root = malloc(count * sizeof(kp_treenode_t));
+    tree.coordinates = malloc(count * sizeof(CLLocationCoordinate2D));
+    tree.weights = malloc(count * sizeof(double));
+    tree.categories = malloc(count * sizeof(NSUInteger));
+    tree.priorities = malloc(count * sizeof(double));
 
     kp_build_stack_info_t *build_stack_info = malloc(count * sizeof(kp_build_stack_info_t));
     kp_build_stack_info_t *top_snapshot;
@@ -125,6 +181,10 @@ static inline kp_2dtree_t kp_2dtree_create(NSArray *annotations) {
     kp_internal_annotation_t *annotationsY = malloc(count * sizeof(kp_internal_annotation_t));
 
     MKMapPoint *temporary_point_storage = malloc(count * sizeof(MKMapPoint));
+    CLLocationCoordinate2D *temporary_coordinate_storage = malloc(count * sizeof(CLLocationCoordinate2D));
+    double *temporary_weight_storage = malloc(count * sizeof(double));
+    NSUInteger *temporary_category_storage = malloc(count * sizeof(NSUInteger));
+    double *temporary_priority_storage = malloc(count * sizeof(double)); // NAN for annotations not conforming to KPPrioritizedAnnotation
     kp_internal_annotation_t *temporary_annotation_storage = malloc((count / 2) * sizeof(kp_internal_annotation_t));
 
     /*
@@ -144,9 +204,14 @@ static inline kp_2dtree_t kp_2dtree_create(NSArray *annotations) {
     dispatch_apply(count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t idx) {
         id <MKAnnotation> annotation = annotations[idx];
 
-        MKMapPoint mapPoint = MKMapPointForCoordinate(annotation.coordinate);
+        CLLocationCoordinate2D coordinate = annotation.coordinate;
+        MKMapPoint mapPoint = MKMapPointForCoordinate(coordinate);
 
         temporary_point_storage[idx] = mapPoint;
+        temporary_coordinate_storage[idx] = coordinate;
+        temporary_weight_storage[idx] = KPAnnotationGetWeight(annotation);
+        temporary_category_storage[idx] = KPAnnotationGetCategory(annotation);
+        temporary_priority_storage[idx] = KPAnnotationGetPriority(annotation);
 
         kp_internal_annotation_t _annotation;
 
@@ -229,6 +294,21 @@ static inline kp_2dtree_t kp_2dtree_create(NSArray *annotations) {
         top->node->annotation   = top->annotationsSortedByCurrentAxis[medianIdx].annotation;
         top->node->mk_map_point = *(top->annotationsSortedByCurrentAxis[medianIdx].mapPoint);
 
+        // mapPoint points into temporary_point_storage, so its offset is the index of annotation in the original array
+        NSUInteger annotationIdx = top->annotationsSortedByCurrentAxis[medianIdx].mapPoint - temporary_point_storage;
+        NSUInteger nodeIdx = top->node - tree.root;
+
+        tree.coordinates[nodeIdx] = temporary_coordinate_storage[annotationIdx];
+        tree.weights[nodeIdx] = temporary_weight_storage[annotationIdx];
+        tree.categories[nodeIdx] = temporary_category_storage[annotationIdx];
+
+        tree.categoriesCount = MAX(tree.categoriesCount, tree.categories[nodeIdx] + 1);
+
+        double priority = temporary_priority_storage[annotationIdx];
+
+        tree.priorities[nodeIdx] = isnan(priority) ? 0 : priority;
+        tree.prioritized = tree.prioritized || isnan(priority) == NO;
+
         /*
          The following strings take heavy use of C pointer <s>gymnastics</s> arithmetics:
 
@@ -321,17 +401,92 @@ static inline kp_2dtree_t kp_2dtree_create(NSArray *annotations) {
     
     free(temporary_annotation_storage);
     free(temporary_point_storage);
+    free(temporary_coordinate_storage);
+    free(temporary_weight_storage);
+    free(temporary_category_storage);
+    free(temporary_priority_storage);
     
     return tree;
 }
 
+static inline kp_subtree_bounds_t *kp_2dtree_subtree_bounds_create(const kp_2dtree_t *tree) {
+    if (tree->size == 0) return NULL;
+
+    kp_subtree_bounds_t *bounds = malloc(tree->size * sizeof(kp_subtree_bounds_t));
+
+    /*
+     kp_2dtree_create() takes nodes from tree->root array only when their parents are already there,
+     so every child has greater index than its parent and the reverse sweep visits children before parents (post-order).
+     */
+    NSUInteger idx = tree->size;
+
+    do {
+        idx--;
+
+        kp_treenode_t *node = tree->root + idx;
+        kp_subtree_bounds_t *nodeBounds = bounds + idx;
+
+        nodeBounds->min = node->mk_map_point;
+        nodeBounds->max = node->mk_map_point;
+
+        kp_treenode_t *children[2] = { node->left, node->right };
+
+        for (int childIdx = 0; childIdx < 2; childIdx++) {
+            if (children[childIdx] == NULL) continue;
+
+            kp_subtree_bounds_t *childBounds = bounds + (children[childIdx] - tree->root);
+
+            nodeBounds->min.x = MIN(nodeBounds->min.x, childBounds->min.x);
+            nodeBounds->min.y = MIN(nodeBounds->min.y, childBounds->min.y);
+            nodeBounds->max.x = MAX(nodeBounds->max.x, childBounds->max.x);
+            nodeBounds->max.y = MAX(nodeBounds->max.y, childBounds->max.y);
+        }
+    } while (idx != 0);
+
+    return bounds;
+}
+
+static inline kp_2dtree_search_scratch_t kp_2dtree_search_scratch_create(kp_2dtree_t *tree) {
+    kp_2dtree_search_scratch_t scratch;
+    memset(&scratch, 0, sizeof(kp_2dtree_search_scratch_t));
+
+    if (tree->size == 0) return scratch;
+
+    scratch.stack = kp_stack_create(tree->size);
+    scratch.search_stack_info = malloc(tree->size * sizeof(kp_search_stack_info_t));
+
+    return scratch;
+}
+
+static inline void kp_2dtree_search_scratch_free(kp_2dtree_search_scratch_t *scratch) {
+    free(scratch->stack.storage);
+    free(scratch->search_stack_info);
+}
+
 static inline void kp_2dtree_search(kp_2dtree_t *tree, NSMutableArray *result, MKMapPoint *minPoint, MKMapPoint *maxPoint) {
+    kp_2dtree_search_scratch_t scratch;
+
+    scratch.stack = tree->stack;
+    scratch.search_stack_info = tree->search_stack_info;
+
+    kp_2dtree_search_with_scratch(tree, &scratch, result, minPoint, maxPoint);
+}
+
+static inline void kp_2dtree_search_with_scratch(kp_2dtree_t *tree, kp_2dtree_search_scratch_t *scratch, NSMutableArray *result, MKMapPoint *minPoint, MKMapPoint *maxPoint) {
+    kp_2dtree_search_nodes_with_scratch(tree, scratch, minPoint, maxPoint, ^(kp_treenode_t *node) {
+        [result addObject:node->annotation];
+    });
+}
+
+static inline void kp_2dtree_search_nodes_with_scratch(kp_2dtree_t *tree, kp_2dtree_search_scratch_t *scratch, MKMapPoint *minPoint, MKMapPoint *maxPoint, kp_2dtree_node_visitor_t visitor) {
     if (tree->size == 0) return;
 
-    kp_stack_reset(&tree->stack);
-    kp_stack_push(&tree->stack, NULL);
+    kp_stack_t *stack = &scratch->stack;
+
+    kp_stack_reset(stack);
+    kp_stack_push(stack, NULL);
 
-    kp_search_stack_info_t *top = tree->search_stack_info;
+    kp_search_stack_info_t *top = scratch->search_stack_info;
     kp_search_stack_info_t *top_snapshot;
 
     top->level = 0;
@@ -343,7 +498,7 @@ static inline void kp_2dtree_search(kp_2dtree_t *tree, NSMutableArray *result, M
             minPoint->y <= top->node->mk_map_point.y &&
             top->node->mk_map_point.x <= maxPoint->x &&
             top->node->mk_map_point.y <= maxPoint->y) {
-            [result addObject:top->node->annotation];
+            visitor(top->node);
         }
 
         double val = MKMapPointGetCoordinateForAxis(&top->node->mk_map_point, top->axis);
@@ -359,7 +514,7 @@ static inline void kp_2dtree_search(kp_2dtree_t *tree, NSMutableArray *result, M
             top->level = top_snapshot->level + 1;
             top->node  = top_snapshot->node->left;
 
-            kp_stack_push(&tree->stack, top);
+            kp_stack_push(stack, top);
         }
 
         else if (MKMapPointGetCoordinateForAxis(minPoint, top->axis) >= val && top_snapshot->node->right != NULL){
@@ -369,7 +524,7 @@ static inline void kp_2dtree_search(kp_2dtree_t *tree, NSMutableArray *result, M
             top->level = top_snapshot->level + 1;
             top->node  = top_snapshot->node->right;
 
-            kp_stack_push(&tree->stack, top);
+            kp_stack_push(stack, top);
         }
 
         else {
@@ -380,7 +535,7 @@ static inline void kp_2dtree_search(kp_2dtree_t *tree, NSMutableArray *result, M
                 top->level = top_snapshot->level + 1;
                 top->node  = top_snapshot->node->right;
 
-                kp_stack_push(&tree->stack, top);
+                kp_stack_push(stack, top);
             }
 
             if (top_snapshot->node->left != NULL) {
@@ -390,11 +545,11 @@ static inline void kp_2dtree_search(kp_2dtree_t *tree, NSMutableArray *result, M
                 top->level = top_snapshot->level + 1;
                 top->node  = top_snapshot->node->left;
 
-                kp_stack_push(&tree->stack, top);
+                kp_stack_push(stack, top);
             }
         }
 
-        top = kp_stack_pop(&tree->stack);
+        top = kp_stack_pop(stack);
     }
 }
 
@@ -0,0 +1,51 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/*
+ Flat bitset indexed by annotation index (see kp_2dtree_node_index()).
+ One bit per annotation: 1M annotations need 128KB, which is cheap enough to be allocated on every clustering pass.
+ */
+typedef struct {
+    uint64_t *words;
+    NSUInteger size;
+} kp_bitset_t;
+
+static inline kp_bitset_t kp_bitset_create(NSUInteger size) {
+    kp_bitset_t bitset;
+
+    bitset.size = size;
+    bitset.words = calloc((size + 63) >> 6, sizeof(uint64_t));
+
+    return bitset;
+}
+
+static inline void kp_bitset_free(kp_bitset_t *bitset) {
+    free(bitset->words);
+}
+
+static inline BOOL kp_bitset_test(kp_bitset_t *bitset, NSUInteger idx) {
+    return (bitset->words[idx >> 6] >> (idx & 63)) & 1;
+}
+
+static inline void kp_bitset_set(kp_bitset_t *bitset, NSUInteger idx) {
+    bitset->words[idx >> 6] |= (1ULL << (idx & 63));
+}
+
+static inline void kp_bitset_clear(kp_bitset_t *bitset, NSUInteger idx) {
+    bitset->words[idx >> 6] &= ~(1ULL << (idx & 63));
+}
@@ -0,0 +1,67 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/*
+ Growable list of node indexes of 2-d tree, used to collect cluster members without retaining them.
+ Clearing keeps the storage so a list can be reused for every cell of a grid pass.
+ */
+typedef struct {
+    NSUInteger *indexes;
+    NSUInteger count;
+    NSUInteger capacity;
+} kp_index_list_t;
+
+static inline kp_index_list_t kp_index_list_create(NSUInteger capacity) {
+    kp_index_list_t list;
+
+    list.capacity = MAX(capacity, 1);
+    list.count = 0;
+    list.indexes = malloc(list.capacity * sizeof(NSUInteger));
+
+    return list;
+}
+
+static inline void kp_index_list_free(kp_index_list_t *list) {
+    free(list->indexes);
+}
+
+static inline void kp_index_list_clear(kp_index_list_t *list) {
+    list->count = 0;
+}
+
+static inline void kp_index_list_append(kp_index_list_t *list, NSUInteger index) {
+    if (list->count == list->capacity) {
+        list->capacity *= 2;
+        list->indexes = realloc(list->indexes, list->capacity * sizeof(NSUInteger));
+    }
+
+    list->indexes[list->count++] = index;
+}
+
+static inline void kp_index_list_append_indexes(kp_index_list_t *list, const NSUInteger *indexes, NSUInteger count) {
+    if (list->count + count > list->capacity) {
+        while (list->count + count > list->capacity) {
+            list->capacity *= 2;
+        }
+
+        list->indexes = realloc(list->indexes, list->capacity * sizeof(NSUInteger));
+    }
+
+    memcpy(list->indexes + list->count, indexes, count * sizeof(NSUInteger));
+    list->count += count;
+}
@@ -0,0 +1,89 @@
+//
+// Copyright 2012 Bryan Bonczek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/*
+ Spatial hash of items (indexes 0..<capacity) by integer bucket coordinates.
+ Buckets live in an open addressing table of at least twice as many slots as items, every slot heads a linked list of items:
+ heads[slot] -> next[item] -> ... -> NSNotFound. Insertion and lookup are O(1) on average, clearing is O(number of slots).
+ */
+typedef struct {
+    NSUInteger slotsCount; // power of two
+    int64_t *keysX;
+    int64_t *keysY;
+    NSUInteger *heads;     // NSNotFound for an empty slot
+    NSUInteger *next;
+} kp_spatial_hash_t;
+
+static inline void kp_spatial_hash_clear(kp_spatial_hash_t *hash) {
+    for (NSUInteger slot = 0; slot < hash->slotsCount; slot++) {
+        hash->heads[slot] = NSNotFound;
+    }
+}
+
+static inline kp_spatial_hash_t kp_spatial_hash_create(NSUInteger capacity) {
+    kp_spatial_hash_t hash;
+
+    hash.slotsCount = 16;
+
+    while (hash.slotsCount < 2 * capacity) {
+        hash.slotsCount <<= 1;
+    }
+
+    hash.keysX = malloc(hash.slotsCount * sizeof(int64_t));
+    hash.keysY = malloc(hash.slotsCount * sizeof(int64_t));
+    hash.heads = malloc(hash.slotsCount * sizeof(NSUInteger));
+    hash.next = malloc(MAX(capacity, 1) * sizeof(NSUInteger));
+
+    kp_spatial_hash_clear(&hash);
+
+    return hash;
+}
+
+static inline void kp_spatial_hash_free(kp_spatial_hash_t *hash) {
+    free(hash->keysX);
+    free(hash->keysY);
+    free(hash->heads);
+    free(hash->next);
+}
+
+// Slot of the bucket (x, y): either the slot holding it or the empty slot where it should be inserted
+static inline NSUInteger kp_spatial_hash_slot(kp_spatial_hash_t *hash, int64_t x, int64_t y) {
+    NSUInteger mask = hash->slotsCount - 1;
+    NSUInteger slot = (NSUInteger)(((uint64_t)x * 73856093ULL) ^ ((uint64_t)y * 19349663ULL)) & mask;
+
+    while (hash->heads[slot] != NSNotFound && (hash->keysX[slot] != x || hash->keysY[slot] != y)) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+static inline void kp_spatial_hash_insert(kp_spatial_hash_t *hash, int64_t x, int64_t y, NSUInteger item) {
+    NSUInteger slot = kp_spatial_hash_slot(hash, x, y);
+
+    hash->keysX[slot] = x;
+    hash->keysY[slot] = y;
+
+    hash->next[item] = hash->heads[slot];
+    hash->heads[slot] = item;
+}
+
+// First item of the bucket (x, y) or NSNotFound, the rest are linked by next
+static inline NSUInteger kp_spatial_hash_first(kp_spatial_hash_t *hash, int64_t x, int64_t y) {
+    return hash->heads[kp_spatial_hash_slot(hash, x, y)];
+}